@@ -8,9 +8,11 @@
 
 #include "gam.h"
 
+#include <gam/gam_defs.h>
 #include <parsers/apt_dat.h>
 #include <parsers/scenery_packs.h>
 #include <utils/log.h>
+#include <utils/trace.h>
 
 #include "interface/frontend.h"
 
@@ -20,6 +22,8 @@ gam_init() {
     char                **file_data = NULL;
     size_t                file_data_size;
 
+    TRACE_THREAD_NAME("main");
+
     scen_data = scenery_packs_parse(USER_XPLANE_ROOT);
     file_data_size = scenery_packs_get_data(scen_data, NULL);
     scenery_packs_get_data(scen_data, &file_data);
@@ -28,6 +32,9 @@ gam_init() {
     frontend_init(db);
     frontend_destroy();
 
+    /* Spans refer to the scenery paths, export before they are freed */
+    TRACE_WRITE(GAM_TRACE_FILE);
+
     db = apt_dat_db_free(db);
     scenery_packs_free(scen_data);
 
@@ -17,6 +17,10 @@ extern "C" {
 #define GAM_WINDOW_WIDTH                738
 #define GAM_WINDOW_HEIGHT               520
 #define GAM_WINDOW_RENDER_FPS_TGT       120 /* FPS */
+/* Workers shared by every map surface, however many there are */
+#define GAM_RENDER_POOL_THREADS         2
+/* Threads rasterizing each frame of a map surface, see cairo_mt_set_bands */
+#define GAM_RENDER_BANDS                1
 
 #define GAM_UI_BG_COLOR                 0x242424
 #define GAM_UI_PANEL_COLOR              0x2f2f2f
@@ -35,6 +39,29 @@ extern "C" {
 #define GAM_UI_APT_CONTENT_PANEL_H      (GAM_WINDOW_HEIGHT - (GAM_UI_GLOBAL_BORDER * 4))
 #define GAM_UI_APT_CONTENT_PANEL_R      10
 
+/* Frame time overlay, drawn in the title area */
+#define GAM_UI_PERF_HUD                 0 /* Enable */
+#define GAM_UI_PERF_HUD_X               GAM_UI_GLOBAL_BORDER
+#define GAM_UI_PERF_HUD_Y               5
+#define GAM_UI_PERF_HUD_W               300
+#define GAM_UI_PERF_HUD_H               (GAM_UI_GLOBAL_BORDER * 3 - 10)
+#define GAM_UI_PERF_HUD_COLOR           0x8FD16A
+#define GAM_UI_PERF_HUD_OVER_COLOR      0xD6574B
+
+/* Per-layer timings, costs a clock read per layer and frame */
+#define GAM_PERF_STATS                  0 /* Enable */
+/* Per-stage timings are written here on exit, with GAM_PERF_STATS */
+#define GAM_PERF_STATS_FILE             "gam_perf_stats.txt"
+/* Written at exit when built with GAM_TRACE */
+#define GAM_TRACE_FILE                  "gam_trace.json"
+/*
+ * Rendered airports are kept between runs (see graphics/render_cache.h) in
+ * $GAM_CACHE_DIR if set, else in this directory under $XDG_CACHE_HOME or ~/.cache
+ */
+#define GAM_RENDER_CACHE_ENV            "GAM_CACHE_DIR"
+#define GAM_RENDER_CACHE_DIR            "gam"
+#define GAM_RENDER_CACHE_BUDGET         (256UL * 1024 * 1024) /* Bytes */
+
 #ifdef __cplusplus
 }
 #endif
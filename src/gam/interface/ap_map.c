@@ -11,9 +11,19 @@
 #include <float.h>
 #include <gam/gam_defs.h>
 #include <math.h>
+#include <stdbool.h>
 #include <utils/constants.h>
 #include <utils/hex_to_rgb.h>
 #include <utils/log.h>
+#include <utils/perf_stats.h>
+#include <utils/trace.h>
+#include <utils/utils.h>
+#include <utils/vec.h>
+
+/* Runway stroke widths are rounded to this so similar runways share a stroke */
+#define AP_MAP_RWY_WIDTH_BUCKET_PX 0.5
+/* Bump whenever the drawing changes, cached renders keyed on older code are then unused */
+#define AP_MAP_CACHE_VERSION       1
 
 typedef struct bounding_box {
     double lat1;
@@ -22,6 +32,16 @@ typedef struct bounding_box {
     double lon2;
 } bounding_box_t;
 
+/* One recorded path, drawn with a single stroke (line_width > 0) or fill */
+typedef struct ap_map_layer {
+    cairo_path_t *path;
+    unsigned      color;
+    double        line_width;
+    perf_stage_t  stage;
+} ap_map_layer_t;
+
+VECTOR_DEFINE(vector_layer, ap_map_layer_t)
+
 struct ap_map {
     bounding_box_t map_bounds;
 
@@ -31,7 +51,16 @@ struct ap_map {
     double         draw_w_ratio;
     double         draw_h_ratio;
 
-    airport_db_t  *db;
+    struct {
+        vector_layer_t layers;
+        size_t         ap_index;
+        bool           valid;
+    } dlist;
+    /* Benchmark baseline, paths are built and drawn every frame instead of recorded */
+    bool           immediate;
+
+    /* Shared with every other map, never written */
+    const airport_db_t *db;
 };
 
 static lat2d_t
@@ -65,8 +94,10 @@ haversine_formula_meters(double lat1, double lon1, double lat2, double lon2) {
 
 static void
 ap_map_bounds_latlon(ap_map_t *ap, size_t ap_index) {
-    // Temporary
-    ASSERT(ap->db->airports[ap_index].boundaries.latitude != NULL);
+    const airport_bounds_t *bnds = &ap->db->airports[ap_index].boundaries;
+    size_t                  size;
+    const double           *lats = vector_double_span(&bnds->latitude, &size);
+    const double           *lons = bnds->longitude.data;
 
     /* Set to values lat/lon could *never* be so we are sure the min/max are accurate */
     ap->map_bounds.lat1 = -1000;
@@ -74,14 +105,9 @@ ap_map_bounds_latlon(ap_map_t *ap, size_t ap_index) {
     ap->map_bounds.lat2 = 1000;
     ap->map_bounds.lon2 = 1000;
 
-    for (size_t i = 0; i < vector_size(ap->db->airports[ap_index].boundaries.latitude); ++i) {
-        const airport_bounds_t *bnds = &ap->db->airports[ap_index].boundaries;
-
-        double                  cur_lat_v;
-        double                  cur_lon_v;
-
-        vector_get(bnds->latitude, i, &cur_lat_v);
-        vector_get(bnds->longitude, i, &cur_lon_v);
+    for (size_t i = 0; i < size; ++i) {
+        const double cur_lat_v = lats[i];
+        const double cur_lon_v = lons[i];
 
         if (cur_lat_v > ap->map_bounds.lat1) {
             ap->map_bounds.lat1 = cur_lat_v;
@@ -187,100 +213,270 @@ ap_map_pixels_per_meter(const ap_map_t *ap, size_t ap_index) {
     return (xy_distance / real_dist_meters);
 }
 
+static vec2d_t
+ap_map_project_bounds_point(const ap_map_t *ap, const airport_bounds_t *bnds, size_t index) {
+    return ap_map_latlon_project(ap,
+        lat2d_t_create(bnds->latitude.data[index], bnds->longitude.data[index]));
+}
+
+/* Twice the signed area of a lat/lon ring, only the sign is of interest */
 static double
-ap_map_meters_to_pixels(const ap_map_t *ap, size_t ap_index, double meters) {
-    return ap_map_pixels_per_meter(ap, ap_index) * meters;
+ap_map_bounds_winding(const airport_bounds_t *bnds) {
+    size_t        size;
+    const double *lats = vector_double_span(&bnds->latitude, &size);
+    const double *lons = bnds->longitude.data;
+    double        area = 0.0;
+
+    for (size_t i = 0; i < size; ++i) {
+        const size_t next = (i + 1 == size) ? 0 : (i + 1);
+        area += (lats[i] * lons[next]) - (lats[next] * lons[i]);
+    }
+
+    return area;
+}
+
+static double
+ap_map_runway_width_px(const runway_info_t *rwy, double px_per_meter) {
+    if (rwy->width > 0.0) {
+        return px_per_meter * rwy->width;
+    }
+
+    return GAM_UI_APT_RUNWAY_WIDTH_DEFAULT;
+}
+
+static long
+ap_map_runway_width_bucket(const runway_info_t *rwy, double px_per_meter) {
+    long bucket = lround(ap_map_runway_width_px(rwy, px_per_meter) / AP_MAP_RWY_WIDTH_BUCKET_PX);
+    return (bucket > 0) ? bucket : 1;
 }
 
+/* Emit every runway falling into the given width bucket */
 static void
-ap_map_draw_runways(cairo_t *cr, const ap_map_t *ap, size_t ap_index) {
+ap_map_path_runways(
+    cairo_t *cr, const ap_map_t *ap, size_t ap_index, double px_per_meter, long bucket) {
     const airport_info_t *ap_info = &ap->db->airports[ap_index];
+
     for (size_t i = 0; i < ap_info->runways_size; ++i) {
-        const runway_info_t *rwy = &ap->db->airports[ap_index].runways[i];
-        vec2d_t              rwy_coords[2];
-        double               rwy_width_px;
+        const runway_info_t *rwy = &ap_info->runways[i];
+
+        if (ap_map_runway_width_bucket(rwy, px_per_meter) != bucket) {
+            continue;
+        }
 
         for (int j = 0; j < 2; ++j) {
             lat2d_t p = lat2d_t_create(rwy->latitude[j], rwy->longitude[j]);
-            rwy_coords[j] = ap_map_latlon_project(ap, p);
-        }
+            vec2d_t rwy_coord = ap_map_latlon_project(ap, p);
 
-        if (rwy->width > 0.0) {
-            rwy_width_px = ap_map_meters_to_pixels(ap, ap_index, rwy->width);
-        } else {
-            rwy_width_px = GAM_UI_APT_RUNWAY_WIDTH_DEFAULT;
+            if (j == 0) {
+                cairo_move_to(cr, rwy_coord.x, rwy_coord.y);
+            } else {
+                cairo_line_to(cr, rwy_coord.x, rwy_coord.y);
+            }
         }
-
-        cairo_set_source_rgb(cr, HEX_TO_RGB_INPLACE(GAM_UI_APT_RUNWAY_COLOR));
-        cairo_set_line_width(cr, rwy_width_px);
-        cairo_move_to(cr, rwy_coords[0].x, rwy_coords[0].y);
-        cairo_line_to(cr, rwy_coords[1].x, rwy_coords[1].y);
-        cairo_stroke(cr);
     }
 }
 
+/* The whole boundary is one polyline */
 static void
-ap_map_draw_airport_bounds(cairo_t *cr, const ap_map_t *ap, size_t ap_index) {
+ap_map_path_airport_bounds(cairo_t *cr, const ap_map_t *ap, size_t ap_index) {
     const airport_info_t *ap_info = &ap->db->airports[ap_index];
-    const size_t          bounds_size = vector_size(ap_info->boundaries.latitude);
+    const size_t          bounds_size = vector_double_size(&ap_info->boundaries.latitude);
 
-    for (size_t i = 1; i < bounds_size; ++i) {
-        vec2d_t points[2];
-        size_t  j, j_ind;
+    if (bounds_size < 2) {
+        return;
+    }
 
-        for (j = (i - 1), j_ind = 0; j <= i; ++j, ++j_ind) {
-            double lat, lon;
-            vector_get(ap_info->boundaries.latitude, j, &lat);
-            vector_get(ap_info->boundaries.longitude, j, &lon);
+    for (size_t i = 0; i < bounds_size; ++i) {
+        vec2d_t point = ap_map_project_bounds_point(ap, &ap_info->boundaries, i);
 
-            lat2d_t lp = lat2d_t_create(lat, lon);
-            points[j_ind] = ap_map_latlon_project(ap, lp);
+        if (i == 0) {
+            cairo_move_to(cr, point.x, point.y);
+        } else {
+            cairo_line_to(cr, point.x, point.y);
         }
-
-        cairo_set_source_rgb(cr, HEX_TO_RGB_INPLACE(GAM_UI_APT_BOUNDS_COLOR));
-        cairo_set_line_width(cr, 2);
-        cairo_move_to(cr, points[0].x, points[0].y);
-        cairo_line_to(cr, points[1].x, points[1].y);
-        cairo_stroke(cr);
     }
 }
 
+/*
+ * All pavement sections share one path. Every ring is emitted with the same
+ * orientation so that, with the non-zero winding rule, overlapping sections
+ * are filled as their union.
+ */
 static void
-ap_map_draw_pave_bounds(cairo_t *cr, const ap_map_t *ap, size_t ap_index) {
-    const airport_info_t *ap_info = &ap->db->airports[ap_index];
-    const size_t          pave_bounds_size = vector_size(ap_info->pave_bounds);
+ap_map_path_pave_bounds(cairo_t *cr, const ap_map_t *ap, size_t ap_index) {
+    const airport_info_t   *ap_info = &ap->db->airports[ap_index];
+    size_t                  pave_bounds_size;
+    const airport_bounds_t *pave_bounds =
+        vector_bounds_span(&ap_info->pave_bounds, &pave_bounds_size);
 
     for (size_t i = 0; i < pave_bounds_size; ++i) {
-        airport_bounds_t pave_sect;
-        vector_get(ap_info->pave_bounds, i, &pave_sect);
-        const size_t pave_sect_size = vector_size(pave_sect.latitude);
+        const airport_bounds_t *pave_sect = &pave_bounds[i];
+        const size_t            pave_sect_size = vector_double_size(&pave_sect->latitude);
 
-        cairo_set_source_rgb(cr, HEX_TO_RGB_INPLACE(GAM_UI_APT_PAVE_BOUNDS_COLOR));
-        cairo_new_sub_path(cr);
+        if (pave_sect_size == 0) {
+            continue;
+        }
 
-        for (size_t j = 0; j < pave_sect_size; ++j) {
-            vec2d_t point;
-            double  lat, lon;
+        const bool reverse = (ap_map_bounds_winding(pave_sect) < 0.0);
 
-            vector_get(pave_sect.latitude, j, &lat);
-            vector_get(pave_sect.longitude, j, &lon);
+        cairo_new_sub_path(cr);
 
-            lat2d_t lp = lat2d_t_create(lat, lon);
-            point = ap_map_latlon_project(ap, lp);
+        for (size_t j = 0; j < pave_sect_size; ++j) {
+            const size_t idx = reverse ? (pave_sect_size - 1 - j) : j;
+            vec2d_t      point = ap_map_project_bounds_point(ap, pave_sect, idx);
 
             if (j == 0) {
                 /* Starting position */
                 cairo_move_to(cr, point.x, point.y);
+            } else {
+                cairo_line_to(cr, point.x, point.y);
             }
-
-            cairo_line_to(cr, point.x, point.y);
         }
 
         cairo_close_path(cr);
+    }
+}
+
+/* Takes ownership of whatever path is currently built on cr */
+static void
+ap_map_record_layer(
+    cairo_t *cr, ap_map_t *ap, perf_stage_t stage, unsigned color, double line_width) {
+    ap_map_layer_t layer;
+
+    layer.path = cairo_copy_path(cr);
+    layer.color = color;
+    layer.line_width = line_width;
+    layer.stage = stage;
+    cairo_new_path(cr);
+
+    vector_layer_push(&ap->dlist.layers, layer);
+}
+
+/* Strokes (line_width > 0) or fills whatever path is currently built on cr */
+static void
+ap_map_paint_path(cairo_t *cr, unsigned color, double line_width) {
+    cairo_set_source_rgb(cr, HEX_TO_RGB_INPLACE(color));
+
+    if (line_width > 0.0) {
+        cairo_set_line_width(cr, line_width);
+        cairo_stroke(cr);
+    } else {
         cairo_fill(cr);
     }
 }
 
+static void
+ap_map_paint_layer(
+    cairo_t *cr, ap_map_t *ap, perf_stage_t stage, unsigned color, double line_width) {
+    UNUSED(ap);
+    UNUSED(stage);
+    ap_map_paint_path(cr, color, line_width);
+}
+
+static void
+ap_map_clear_layers(ap_map_t *ap) {
+    size_t          layers_size;
+    ap_map_layer_t *layers = vector_layer_span(&ap->dlist.layers, &layers_size);
+
+    for (size_t i = 0; i < layers_size; ++i) {
+        cairo_path_destroy(layers[i].path);
+    }
+
+    vector_layer_clear(&ap->dlist.layers);
+}
+
+/*
+ * Builds each style layer's path on cr in map coordinates, in the order they
+ * are drawn, handing every one to emit. Only reads ap.
+ */
+static void
+ap_map_build_layers(cairo_t *cr, ap_map_t *ap, size_t ap_index,
+    void (*emit)(cairo_t *, ap_map_t *, perf_stage_t, unsigned, double)) {
+    const airport_info_t *ap_info = &ap->db->airports[ap_index];
+
+    cairo_new_path(cr);
+
+    ap_map_path_airport_bounds(cr, ap, ap_index);
+    emit(cr, ap, PERF_STAGE_BOUNDS, GAM_UI_APT_BOUNDS_COLOR, 2.0);
+
+    ap_map_path_pave_bounds(cr, ap, ap_index);
+    emit(cr, ap, PERF_STAGE_PAVEMENT, GAM_UI_APT_PAVE_BOUNDS_COLOR, 0.0);
+
+    const double px_per_meter = ap_map_pixels_per_meter(ap, ap_index);
+
+    for (size_t i = 0; i < ap_info->runways_size; ++i) {
+        const long bucket = ap_map_runway_width_bucket(&ap_info->runways[i], px_per_meter);
+        bool       seen = false;
+
+        /* Bucket was already emitted along with an earlier runway */
+        for (size_t j = 0; j < i && !seen; ++j) {
+            seen = (ap_map_runway_width_bucket(&ap_info->runways[j], px_per_meter) == bucket);
+        }
+
+        if (seen) {
+            continue;
+        }
+
+        ap_map_path_runways(cr, ap, ap_index, px_per_meter, bucket);
+        emit(cr, ap, PERF_STAGE_RUNWAYS, GAM_UI_APT_RUNWAY_COLOR,
+            (double)bucket * AP_MAP_RWY_WIDTH_BUCKET_PX);
+    }
+}
+
+/*
+ * Projects the airport once and stores each style layer as a cairo path in
+ * untranslated map coordinates, in the order they are drawn.
+ */
+static void
+ap_map_record(cairo_t *cr, ap_map_t *ap, size_t ap_index) {
+    TRACE_SCOPE("ap_map_record");
+
+    /* Keeps the storage, recording the next airport doesn't allocate unless it has more layers */
+    ap_map_clear_layers(ap);
+    ap_map_set_draw_dims(ap, ap_index);
+
+    cairo_save(cr);
+    cairo_identity_matrix(cr);
+    ap_map_build_layers(cr, ap, ap_index, ap_map_record_layer);
+    cairo_restore(cr);
+
+    ap->dlist.ap_index = ap_index;
+    ap->dlist.valid = true;
+}
+
+static void
+ap_map_replay(cairo_t *cr, const ap_map_t *ap) {
+    size_t                layers_size;
+    const ap_map_layer_t *layers = vector_layer_span(&ap->dlist.layers, &layers_size);
+    long                  stage_time = 0;
+
+    for (size_t i = 0; i < layers_size; ++i) {
+        const ap_map_layer_t *layer = &layers[i];
+        const long            time_start = GAM_PERF_STATS ? utils_gettime() : 0;
+        TRACE_BEGIN(perf_stats_stage_name(layer->stage));
+
+        cairo_new_path(cr);
+        cairo_append_path(cr, layer->path);
+        ap_map_paint_path(cr, layer->color, layer->line_width);
+
+        TRACE_END(perf_stats_stage_name(layer->stage));
+
+        if (!GAM_PERF_STATS) {
+            continue;
+        }
+
+        /* Layers of a stage are consecutive, record them as one sample */
+        stage_time += utils_gettime() - time_start;
+
+        const ap_map_layer_t *next = (i + 1 < layers_size) ? &layers[i + 1] : NULL;
+
+        if (next == NULL || next->stage != layer->stage) {
+            perf_stats_record(layer->stage, stage_time);
+            stage_time = 0;
+        }
+    }
+}
+
 static vec2d_t
 ap_map_get_centered_xy(ap_map_t *ap) {
     double x_addition, y_addition;
@@ -294,24 +490,106 @@ ap_map_get_centered_xy(ap_map_t *ap) {
     return vec2d_t_create(x_addition, y_addition);
 }
 
+void
+ap_map_prepare(cairo_t *cr, ap_map_t *ap, size_t ap_index) {
+    ASSERT(ap != NULL);
+
+    /* Projection is done by draw, but it has to know the airport's extent */
+    if (ap->immediate) {
+        ap_map_set_draw_dims(ap, ap_index);
+        return;
+    }
+
+    if (!ap->dlist.valid || ap->dlist.ap_index != ap_index) {
+        ap_map_record(cr, ap, ap_index);
+    }
+}
+
 void
 ap_map_draw(cairo_t *cr, ap_map_t *ap, size_t ap_index) {
-    ap_map_set_draw_dims(ap, ap_index);
+    TRACE_SCOPE("ap_map_draw");
+    ap_map_prepare(cr, ap, ap_index);
 
     cairo_save(cr);
 
     vec2d_t map_centrd = ap_map_get_centered_xy(ap);
     cairo_translate(cr, map_centrd.x, map_centrd.y);
+    cairo_set_fill_rule(cr, CAIRO_FILL_RULE_WINDING);
 
-    ap_map_draw_airport_bounds(cr, ap, ap_index);
-    ap_map_draw_pave_bounds(cr, ap, ap_index);
-    ap_map_draw_runways(cr, ap, ap_index);
+    if (ap->immediate) {
+        ap_map_build_layers(cr, ap, ap_index, ap_map_paint_layer);
+    } else {
+        ap_map_replay(cr, ap);
+    }
 
     cairo_restore(cr);
 }
 
+void
+ap_map_invalidate(ap_map_t *ap) {
+    ASSERT(ap != NULL);
+    ap->dlist.valid = false;
+}
+
+void
+ap_map_set_immediate(ap_map_t *ap, bool immediate) {
+    ASSERT(ap != NULL);
+    ap->immediate = immediate;
+    ap->dlist.valid = false;
+}
+
+static void
+ap_map_cache_key_bounds(render_cache_key_t *key, const airport_bounds_t *bnds) {
+    size_t        size;
+    const double *lats = vector_double_span(&bnds->latitude, &size);
+
+    render_cache_key_add_long(key, (long)size);
+    render_cache_key_add(key, lats, size * sizeof(*lats));
+    render_cache_key_add(key, bnds->longitude.data, size * sizeof(*lats));
+}
+
+void
+ap_map_cache_key(const airport_db_t *db, size_t ap_index, render_cache_key_t *key) {
+    ASSERT(db != NULL && key != NULL);
+    ASSERT(ap_index < db->airports_size);
+    const airport_info_t   *ap_info = &db->airports[ap_index];
+    size_t                  pave_bounds_size;
+    const airport_bounds_t *pave_bounds =
+        vector_bounds_span(&ap_info->pave_bounds, &pave_bounds_size);
+
+    render_cache_key_add_str(key, "ap_map");
+    render_cache_key_add_long(key, AP_MAP_CACHE_VERSION);
+
+    /* Style */
+    render_cache_key_add_long(key, GAM_WINDOW_WIDTH);
+    render_cache_key_add_long(key, GAM_WINDOW_HEIGHT);
+    render_cache_key_add_long(key, GAM_UI_APT_RUNWAY_COLOR);
+    render_cache_key_add_long(key, GAM_UI_APT_BOUNDS_COLOR);
+    render_cache_key_add_long(key, GAM_UI_APT_PAVE_BOUNDS_COLOR);
+    render_cache_key_add_double(key, GAM_UI_APT_RUNWAY_WIDTH_DEFAULT);
+    render_cache_key_add_double(key, GAM_UI_APT_DRAW_SIZE_W);
+    render_cache_key_add_double(key, GAM_UI_APT_DRAW_SIZE_H);
+    render_cache_key_add_double(key, AP_MAP_RWY_WIDTH_BUCKET_PX);
+
+    /* Source data */
+    render_cache_key_add_long(key, (long)ap_info->runways_size);
+    for (size_t i = 0; i < ap_info->runways_size; ++i) {
+        const runway_info_t *rwy = &ap_info->runways[i];
+
+        render_cache_key_add_double(key, rwy->width);
+        render_cache_key_add(key, rwy->latitude, sizeof(rwy->latitude));
+        render_cache_key_add(key, rwy->longitude, sizeof(rwy->longitude));
+    }
+
+    ap_map_cache_key_bounds(key, &ap_info->boundaries);
+    render_cache_key_add_long(key, (long)pave_bounds_size);
+    for (size_t i = 0; i < pave_bounds_size; ++i) {
+        ap_map_cache_key_bounds(key, &pave_bounds[i]);
+    }
+}
+
 ap_map_t *
-ap_map_create(airport_db_t *db) {
+ap_map_create(const airport_db_t *db) {
     ASSERT(db != NULL);
     ap_map_t *ap_mp;
 
@@ -323,11 +601,19 @@ ap_map_create(airport_db_t *db) {
     ap_mp->draw_w_ratio = 0.0;
     ap_mp->draw_h_ratio = 0.0;
 
+    vector_layer_init(&ap_mp->dlist.layers, 0);
+    ap_mp->dlist.ap_index = 0;
+    ap_mp->dlist.valid = false;
+    ap_mp->immediate = false;
+
     return ap_mp;
 }
 
 void *
 ap_map_destroy(ap_map_t *apm) {
+    ASSERT(apm != NULL);
+    ap_map_clear_layers(apm);
+    vector_layer_free(&apm->dlist.layers);
     free(apm);
     return NULL;
 }
\ No newline at end of file
@@ -10,7 +10,9 @@
 #define AP_MAP_H_
 
 #include <cairo/cairo.h>
+#include <graphics/render_cache.h>
 #include <parsers/apt_dat.h>
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -34,11 +36,30 @@ typedef struct lat2d {
 } lat2d_t;
 
 ap_map_t *
-ap_map_create(airport_db_t *db);
+ap_map_create(const airport_db_t *db);
 void *
 ap_map_destroy(ap_map_t *apm);
+/* Records the airport's paths unless they already are, after which ap_map_draw only reads ap */
+void
+ap_map_prepare(cairo_t *cr, ap_map_t *ap, size_t index);
 void
 ap_map_draw(cairo_t *cr, ap_map_t *ap, size_t index);
+/* Forces the airport's recorded paths to be rebuilt on the next draw */
+void
+ap_map_invalidate(ap_map_t *ap);
+/*
+ * Benchmark baseline: every draw projects the airport and builds its paths
+ * again, without recording them. prepare still has to run before draw.
+ */
+void
+ap_map_set_immediate(ap_map_t *ap, bool immediate);
+/*
+ * Adds everything ap_map_draw's output depends on for the airport to key:
+ * its runways and boundaries and the style constants. Callers add their own
+ * render parameters.
+ */
+void
+ap_map_cache_key(const airport_db_t *db, size_t ap_index, render_cache_key_t *key);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,164 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "ap_thumb.h"
+
+#include <gam/gam_defs.h>
+#include <utils/hex_to_rgb.h>
+#include <utils/log.h>
+#include <utils/trace.h>
+
+#include "ap_map.h"
+
+/* ap_map centers airports in the window, scaled to fit this square at most */
+#define AP_THUMB_SRC_SIZE                                                                          \
+    (GAM_UI_APT_DRAW_SIZE_W > GAM_UI_APT_DRAW_SIZE_H ? GAM_UI_APT_DRAW_SIZE_W                      \
+                                                     : GAM_UI_APT_DRAW_SIZE_H)
+
+struct ap_thumb {
+    const airport_db_t *db;
+    ap_map_t           *ap_map;
+    cairo_surface_t    *surface;
+    cairo_t            *cr;
+    int                 width;
+    int                 height;
+
+    render_cache_t      *cache;
+    /* Last cache hit, wrapped by cached_surface */
+    render_cache_image_t cached;
+    cairo_surface_t     *cached_surface;
+};
+
+ap_thumb_t *
+ap_thumb_create(const airport_db_t *db, int width, int height) {
+    ASSERT(db != NULL);
+    ASSERT(width > 0 && height > 0);
+    ap_thumb_t *th;
+
+    th = malloc(sizeof(*th));
+    th->db = db;
+    th->ap_map = ap_map_create(db);
+    th->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    th->cr = cairo_create(th->surface);
+    th->width = width;
+    th->height = height;
+    th->cache = NULL;
+    th->cached.map = NULL;
+    th->cached_surface = NULL;
+
+    return th;
+}
+
+void
+ap_thumb_set_cache(ap_thumb_t *th, render_cache_t *cache) {
+    ASSERT(th != NULL);
+    th->cache = cache;
+}
+
+static void
+ap_thumb_release_cached(ap_thumb_t *th) {
+    if (th->cached_surface != NULL) {
+        cairo_surface_destroy(th->cached_surface);
+        th->cached_surface = NULL;
+    }
+    render_cache_release(&th->cached);
+}
+
+static void
+ap_thumb_cache_key(const ap_thumb_t *th, size_t ap_index, render_cache_key_t *key) {
+    render_cache_key_init(key);
+    ap_map_cache_key(th->db, ap_index, key);
+    render_cache_key_add_str(key, "ap_thumb");
+    render_cache_key_add_long(key, GAM_UI_PANEL_COLOR);
+    render_cache_key_add_long(key, th->width);
+    render_cache_key_add_long(key, th->height);
+}
+
+/* Wraps the mapped pixels of an earlier render, NULL on a miss */
+static cairo_surface_t *
+ap_thumb_lookup(ap_thumb_t *th, const render_cache_key_t *key) {
+    if (!render_cache_get(th->cache, key, &th->cached)) {
+        return NULL;
+    }
+
+    if (th->cached.width != th->width || th->cached.height != th->height ||
+        th->cached.stride != cairo_image_surface_get_stride(th->surface)) {
+        render_cache_release(&th->cached);
+        return NULL;
+    }
+
+    /* Only ever read, the mapping itself is read-only */
+    th->cached_surface = cairo_image_surface_create_for_data((unsigned char *)th->cached.data,
+        CAIRO_FORMAT_ARGB32, th->width, th->height, th->cached.stride);
+    return th->cached_surface;
+}
+
+cairo_surface_t *
+ap_thumb_render(ap_thumb_t *th, size_t ap_index) {
+    TRACE_SCOPE("ap_thumb_render");
+    ASSERT(th != NULL);
+    ASSERT(ap_index < th->db->airports_size);
+    cairo_t           *cr = th->cr;
+    const double       scale =
+        (th->width < th->height ? th->width : th->height) / (double)AP_THUMB_SRC_SIZE;
+    render_cache_key_t key;
+
+    ap_thumb_release_cached(th);
+    if (th->cache != NULL) {
+        cairo_surface_t *cached;
+
+        ap_thumb_cache_key(th, ap_index, &key);
+        cached = ap_thumb_lookup(th, &key);
+        if (cached != NULL) {
+            return cached;
+        }
+    }
+
+    cairo_save(cr);
+    cairo_set_source_rgb(cr, HEX_TO_RGB_INPLACE(GAM_UI_PANEL_COLOR));
+    cairo_paint(cr);
+
+    /* Airports without a boundary have no extent to fit, leave them blank */
+    if (vector_double_size(&th->db->airports[ap_index].boundaries.latitude) > 0) {
+        /* Window center to thumbnail center, the map is drawn in window coordinates */
+        cairo_translate(cr, th->width / 2.0, th->height / 2.0);
+        cairo_scale(cr, scale, scale);
+        cairo_translate(cr, -GAM_WINDOW_WIDTH / 2.0, -GAM_WINDOW_HEIGHT / 2.0);
+        ap_map_draw(cr, th->ap_map, ap_index);
+    }
+
+    cairo_restore(cr);
+    cairo_surface_flush(th->surface);
+
+    /* A degenerate airport would leave cr unusable for every later one */
+    if (cairo_status(cr) != CAIRO_STATUS_SUCCESS) {
+        log_err("Airport %s: %s", th->db->airports[ap_index].icao,
+            cairo_status_to_string(cairo_status(cr)));
+        cairo_destroy(th->cr);
+        th->cr = cairo_create(th->surface);
+        ap_map_invalidate(th->ap_map);
+    } else if (th->cache != NULL) {
+        render_cache_put(th->cache, &key, cairo_image_surface_get_data(th->surface), th->width,
+            th->height, cairo_image_surface_get_stride(th->surface));
+    }
+
+    return th->surface;
+}
+
+void *
+ap_thumb_destroy(ap_thumb_t *th) {
+    ASSERT(th != NULL);
+
+    ap_thumb_release_cached(th);
+    th->ap_map = ap_map_destroy(th->ap_map);
+    cairo_destroy(th->cr);
+    cairo_surface_destroy(th->surface);
+    free(th);
+
+    return NULL;
+}
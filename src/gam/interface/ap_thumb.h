@@ -0,0 +1,47 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef AP_THUMB_H_
+#define AP_THUMB_H_
+
+#include <cairo/cairo.h>
+#include <graphics/render_cache.h>
+#include <parsers/apt_dat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Airport map previews at any size, drawn with ap_map_draw into an image
+ * surface that is reused for every airport. Not thread-safe, use one per
+ * thread; the database is only read. With a render cache, airports rendered
+ * before at the same size are mapped from disk instead.
+ */
+
+typedef struct ap_thumb ap_thumb_t;
+
+ap_thumb_t *
+ap_thumb_create(const airport_db_t *db, int width, int height);
+/* Optional, cache may be shared between threads */
+void
+ap_thumb_set_cache(ap_thumb_t *th, render_cache_t *cache);
+/*
+ * ARGB32, owned by th and valid until the next render. Read-only, it may be
+ * mapped from the cache.
+ */
+cairo_surface_t *
+ap_thumb_render(ap_thumb_t *th, size_t ap_index);
+void *
+ap_thumb_destroy(ap_thumb_t *th);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AP_THUMB_H_ */
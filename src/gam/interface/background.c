@@ -12,19 +12,34 @@
 #include <utils/cairo/round_rect.h>
 #include <utils/hex_to_rgb.h>
 
+static void
+background_panel_path(cairo_t *cr) {
+    rounded_rectangle(cr, GAM_UI_GLOBAL_BORDER, GAM_UI_GLOBAL_BORDER * 3,
+        GAM_UI_APT_CONTENT_PANEL_W, GAM_UI_APT_CONTENT_PANEL_H, GAM_UI_APT_CONTENT_PANEL_R);
+}
+
 void
-background_draw_enter(cairo_t *cr) {
+background_draw(cairo_t *cr) {
+    /* Outside of the rounded window */
+    cairo_set_source_rgb(cr, 0, 0, 0);
+    cairo_paint(cr);
+
     /* Background */
     cairo_set_source_rgb(cr, HEX_TO_RGB_INPLACE(GAM_UI_BG_COLOR));
     rounded_rectangle(cr, 0, 0, GAM_WINDOW_WIDTH, GAM_WINDOW_HEIGHT, GAM_UI_GLOBAL_BORDER);
     cairo_fill(cr);
 
-    /* Start clip region */
+    /* Content panel */
     cairo_set_source_rgb(cr, HEX_TO_RGB_INPLACE(GAM_UI_PANEL_COLOR));
-    rounded_rectangle(cr, GAM_UI_GLOBAL_BORDER, GAM_UI_GLOBAL_BORDER * 3,
-        GAM_UI_APT_CONTENT_PANEL_W, GAM_UI_APT_CONTENT_PANEL_H, GAM_UI_APT_CONTENT_PANEL_R);
+    background_panel_path(cr);
+    cairo_fill(cr);
+}
+
+void
+background_draw_enter(cairo_t *cr) {
+    /* Start clip region */
+    background_panel_path(cr);
     cairo_clip(cr);
-    cairo_paint(cr);
 }
 
 void
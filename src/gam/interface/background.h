@@ -15,6 +15,10 @@
 extern "C" {
 #endif
 
+/* Window background and content panel, everything here is static */
+void
+background_draw(cairo_t *cr);
+/* Clips drawing to the content panel until background_draw_exit */
 void
 background_draw_enter(cairo_t *cr);
 void
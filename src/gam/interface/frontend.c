@@ -9,116 +9,185 @@
 #include "frontend.h"
 
 #include <GL/glew.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <gam/gam_defs.h>
 #include <graphics/cairo_mt.h>
+#include <graphics/render_cache.h>
+#include <graphics/render_pool.h>
 #include <graphics/window.h>
-#include <math.h>
-#include <pthread.h>
-#include <string.h>
 #include <utils/log.h>
+#include <utils/path_hdlr.h>
+#include <utils/perf_stats.h>
+#include <utils/utils.h>
 
-#include "ap_map.h"
-#include "background.h"
-
-static window_inst_t *winst = NULL;
-static cairo_mt_t    *cmt = NULL;
-
-typedef struct mt_udata {
-    airport_db_t *db;
-    ap_map_t     *ap_map;
-
-    struct {
-        double mouse_x;
-        double mouse_y;
-        bool   mouse_click;
-    } mt;
+#include "map_view.h"
 
-    pthread_mutex_t mutex;
-} mt_udata_t;
+static window_inst_t  *winst = NULL;
+static cairo_mt_t     *cmt = NULL;
+static render_pool_t  *pool = NULL;
+static render_cache_t *cache = NULL;
 
 static void
 window_loop_cb(window_inst_t *window, void *udata) {
     UNUSED(window);
-    UNUSED(udata);
+    ASSERT(udata != NULL);
+
+    /* Events that found the queue full last time, no other input may come to draw them */
+    if (map_view_flush_input((map_view_t *)udata)) {
+        cairo_mt_request_frame(cmt);
+    }
     cairo_mt_draw(cmt);
 }
 
+static void
+frontend_push_input(map_view_t *view, const input_event_t *event) {
+    map_view_push_input(view, event);
+
+    if (cmt != NULL) {
+        cairo_mt_request_frame(cmt);
+    }
+}
+
 static void
 window_mouse_position_callback(double xpos, double ypos, void *udata) {
     ASSERT(udata != NULL);
-    mt_udata_t *mtdata = (mt_udata_t *)udata;
-    pthread_mutex_lock(&mtdata->mutex);
-    mtdata->mt.mouse_x = xpos;
-    mtdata->mt.mouse_y = ypos;
-    pthread_mutex_unlock(&mtdata->mutex);
+    input_event_t event = {.type = INPUT_EVENT_MOVE, .x = xpos, .y = ypos};
+    frontend_push_input((map_view_t *)udata, &event);
 }
 
 static void
-mt_start(cairo_t *cr, void *udata) {
-    UNUSED(cr);
+window_mouse_button_callback(bool mouse_down, bool mouse_hold, void *udata) {
     ASSERT(udata != NULL);
-    mt_udata_t *mtdata = (mt_udata_t *)udata;
-    mtdata->ap_map = ap_map_create(mtdata->db);
+    UNUSED(mouse_hold);
+    input_event_t event = {.type = INPUT_EVENT_BUTTON, .down = mouse_down};
+    frontend_push_input((map_view_t *)udata, &event);
 }
 
 static void
-mt_loop(cairo_t *cr, void *udata) {
+window_mouse_scroll_callback(int mouse_scroll, void *udata) {
     ASSERT(udata != NULL);
-    mt_udata_t   *mtdata = (mt_udata_t *)udata;
-
-    airport_db_t *db = mtdata->db;
-    ASSERT(db->airports_size > 0);
-    size_t ap_index = apt_dat_find_by_icao(db, "KLAX");
+    input_event_t event = {.type = INPUT_EVENT_SCROLL, .scroll = mouse_scroll};
+    frontend_push_input((map_view_t *)udata, &event);
+}
 
-    background_draw_enter(cr);
-    ap_map_draw(cr, mtdata->ap_map, ap_index);
-    background_draw_exit(cr);
+static void
+frontend_add_damage(const damage_t *damage, void *udata) {
+    cairo_mt_add_damage((cairo_mt_t *)udata, damage);
 }
 
 static void
-mt_end(cairo_t *cr, void *udata) {
-    UNUSED(cr);
-    ASSERT(udata != NULL);
-    mt_udata_t *mtdata = (mt_udata_t *)udata;
+frontend_request_frame(void *udata) {
+    cairo_mt_request_frame((cairo_mt_t *)udata);
+}
+
+/* Where the render cache goes, see GAM_RENDER_CACHE_DIR. NULL without any home to put it in */
+static char *
+frontend_cache_dir() {
+    const char *env = getenv(GAM_RENDER_CACHE_ENV);
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char       *parent, *dir;
 
-    mtdata->ap_map = ap_map_destroy(mtdata->ap_map);
-    pthread_mutex_destroy(&mtdata->mutex);
-    free(mtdata);
+    if (env != NULL && env[0] != '\0') {
+        return utils_strdup(env);
+    }
+
+    /* Relative ones are to be ignored, as per the XDG base directory spec */
+    if (xdg != NULL && xdg[0] == '/') {
+        parent = utils_strdup(xdg);
+    } else if (home != NULL && home[0] != '\0') {
+        parent = path_hdlr_join_paths(home, "/.cache");
+    } else {
+        return NULL;
+    }
+
+    /* render_cache_create only creates the last component */
+    if (mkdir(parent, 0700) != 0 && errno != EEXIST) {
+        log_err("Failed to create %s: %s", parent, strerror(errno));
+    }
+    dir = path_hdlr_join_paths(parent, "/" GAM_RENDER_CACHE_DIR);
+    free(parent);
+
+    return dir;
 }
 
 void
 frontend_init(airport_db_t *db) {
-    mt_udata_t *mtdata;
+    map_view_t *view;
+    char       *cache_dir;
     window_graphics_global_init();
 
-    mtdata = malloc(sizeof(*mtdata));
-    pthread_mutex_init(&mtdata->mutex, NULL);
-
-    mtdata->db = db;
-    mtdata->mt.mouse_click = false;
-    mtdata->mt.mouse_x = 0.0;
-    mtdata->mt.mouse_y = 0.0;
+    ASSERT(db->airports_size > 0);
+    view = map_view_create(db, apt_dat_find_by_icao(db, "KLAX"), GAM_UI_PERF_HUD);
+    /* Runs fine without, every airport is then rasterized when shown */
+    cache_dir = frontend_cache_dir();
+    if (cache_dir != NULL) {
+        cache = render_cache_create(cache_dir, GAM_RENDER_CACHE_BUDGET);
+        free(cache_dir);
+    }
+    map_view_set_cache(view, cache);
 
     winst = window_create(GAM_WINDOW_TITLE, GAM_WINDOW_WIDTH, GAM_WINDOW_HEIGHT);
-    window_set_mouse_pos_callback(winst, window_mouse_position_callback, mtdata);
+    window_set_mouse_pos_callback(winst, window_mouse_position_callback, view);
+    window_set_mouse_button_callback(winst, window_mouse_button_callback, view);
+    window_set_mouse_scroll_callback(winst, window_mouse_scroll_callback, view);
 
     if (glewInit() != GLEW_OK) {
         log_err("Failed to initialize glew.");
         exit(EXIT_FAILURE);
     }
 
-    /* Init MT cairo rendering */
+    /* Init MT cairo rendering, further map surfaces share the same workers */
+    pool = render_pool_create(GAM_RENDER_POOL_THREADS);
     cmt = cairo_mt_create(GAM_WINDOW_WIDTH, GAM_WINDOW_HEIGHT, GAM_WINDOW_RENDER_FPS_TGT);
-    cairo_mt_set_callbacks(cmt, mt_start, mt_loop, mt_end);
-    cairo_mt_start(cmt, mtdata);
-
-    window_set_window_loop_callback(winst, window_loop_cb, NULL);
+    /* The window swaps on vsync, frames are finished just before it draws them */
+    cairo_mt_set_pacing(cmt, CAIRO_MT_PACE_VSYNC);
+    map_view_set_damage_callback(view, frontend_add_damage, cmt);
+    map_view_set_frame_callback(view, frontend_request_frame, cmt);
+    cairo_mt_set_callbacks(cmt, map_view_start, map_view_paint, map_view_end);
+    cairo_mt_set_prepare(cmt, map_view_prepare);
+    cairo_mt_set_bands(cmt, GAM_RENDER_BANDS);
+    /* The background layer covers the whole surface */
+    cairo_mt_set_clear(cmt, false);
+    cairo_mt_start_pooled(cmt, pool, view);
+
+    window_set_window_loop_callback(winst, window_loop_cb, view);
     window_loop(winst);
 }
 
+static void
+frontend_write_perf_stats() {
+    FILE *fp;
+
+    log_msg("Frame time p50 %.3lf ms, p95 %.3lf ms, p99 %.3lf ms",
+        perf_stats_percentile(PERF_STAGE_FRAME, 50.0) / 1e6,
+        perf_stats_percentile(PERF_STAGE_FRAME, 95.0) / 1e6,
+        perf_stats_percentile(PERF_STAGE_FRAME, 99.0) / 1e6);
+
+    if (!GAM_PERF_STATS) {
+        return;
+    }
+
+    fp = fopen(GAM_PERF_STATS_FILE, "w");
+    if (fp == NULL) {
+        log_err("Failed to open %s", GAM_PERF_STATS_FILE);
+        return;
+    }
+
+    perf_stats_write(fp);
+    fclose(fp);
+}
+
 void
 frontend_destroy() {
     window_destroy(winst);
     window_graphics_global_destroy();
     cmt = cairo_mt_destroy(cmt);
+    pool = render_pool_destroy(pool);
+    if (cache != NULL) {
+        cache = render_cache_destroy(cache);
+    }
+    frontend_write_perf_stats();
 }
\ No newline at end of file
@@ -0,0 +1,364 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "map_view.h"
+
+#include <gam/gam_defs.h>
+#include <graphics/compositor.h>
+#include <utils/log.h>
+#include <utils/perf_stats.h>
+#include <utils/utils.h>
+
+#include "ap_map.h"
+#include "background.h"
+#include "perf_hud.h"
+
+struct map_view {
+    const airport_db_t *db;
+    bool                hud;
+
+    void (*on_damage)(const damage_t *damage, void *);
+    void *on_damage_udata;
+    void (*on_frame)(void *);
+    void *on_frame_udata;
+
+    /* Main thread pushes, render thread drains */
+    input_queue_t *input;
+
+    /* Render thread only */
+    ap_map_t     *ap_map;
+    size_t        ap_index;
+    compositor_t *comp;
+    int           bg_layer;
+    int           ap_layer;
+    int           hud_layer;
+
+    /* Render thread only, the airport layer as stored in the cache */
+    render_cache_t      *cache;
+    render_cache_image_t ap_cached;
+    cairo_surface_t     *ap_surface;
+    size_t               ap_surface_index;
+
+    /* Render thread only */
+    struct {
+        double mouse_x;
+        double mouse_y;
+        bool   mouse_click;
+        int    mouse_scroll;
+    } mt;
+};
+
+map_view_t *
+map_view_create(const airport_db_t *db, size_t ap_index, bool hud) {
+    ASSERT(db != NULL);
+    ASSERT(ap_index < db->airports_size);
+    map_view_t *view;
+
+    view = malloc(sizeof(*view));
+    view->db = db;
+    view->hud = hud;
+    view->on_damage = NULL;
+    view->on_damage_udata = NULL;
+    view->on_frame = NULL;
+    view->on_frame_udata = NULL;
+    view->input = input_queue_create();
+
+    view->ap_map = NULL;
+    view->ap_index = ap_index;
+    view->comp = NULL;
+
+    view->cache = NULL;
+    view->ap_cached.map = NULL;
+    view->ap_surface = NULL;
+    view->ap_surface_index = 0;
+
+    view->mt.mouse_click = false;
+    view->mt.mouse_x = 0.0;
+    view->mt.mouse_y = 0.0;
+    view->mt.mouse_scroll = 0;
+
+    return view;
+}
+
+void
+map_view_set_damage_callback(
+    map_view_t *view, void (*on_damage)(const damage_t *damage, void *), void *udata) {
+    ASSERT(view != NULL);
+    ASSERT(view->comp == NULL);
+    view->on_damage = on_damage;
+    view->on_damage_udata = udata;
+}
+
+void
+map_view_set_frame_callback(map_view_t *view, void (*on_frame)(void *), void *udata) {
+    ASSERT(view != NULL);
+    ASSERT(view->comp == NULL);
+    view->on_frame = on_frame;
+    view->on_frame_udata = udata;
+}
+
+void
+map_view_set_cache(map_view_t *view, render_cache_t *cache) {
+    ASSERT(view != NULL);
+    ASSERT(view->comp == NULL);
+    view->cache = cache;
+}
+
+void
+map_view_push_input(map_view_t *view, const input_event_t *event) {
+    ASSERT(view != NULL);
+    input_queue_push(view->input, event);
+}
+
+bool
+map_view_flush_input(map_view_t *view) {
+    ASSERT(view != NULL);
+    return input_queue_flush(view->input);
+}
+
+void
+map_view_set_airport(map_view_t *view, size_t ap_index) {
+    ASSERT(view != NULL);
+    ASSERT(ap_index < view->db->airports_size);
+
+    if (view->ap_index == ap_index) {
+        return;
+    }
+
+    view->ap_index = ap_index;
+    if (view->comp != NULL) {
+        compositor_invalidate(view->comp, view->ap_layer);
+    }
+}
+
+static void
+map_view_release_airport(map_view_t *view) {
+    if (view->ap_surface != NULL) {
+        cairo_surface_destroy(view->ap_surface);
+        view->ap_surface = NULL;
+    }
+    render_cache_release(&view->ap_cached);
+}
+
+void
+map_view_invalidate(map_view_t *view, bool record) {
+    ASSERT(view != NULL);
+    ASSERT(view->comp != NULL);
+
+    if (record) {
+        ap_map_invalidate(view->ap_map);
+    }
+    map_view_release_airport(view);
+    compositor_invalidate(view->comp, view->ap_layer);
+}
+
+void
+map_view_set_immediate(map_view_t *view, bool immediate) {
+    ASSERT(view != NULL);
+    ASSERT(view->ap_map != NULL);
+
+    ap_map_set_immediate(view->ap_map, immediate);
+    map_view_invalidate(view, false);
+}
+
+/* Applies every input event since the last frame */
+static void
+map_view_handle_input(map_view_t *view) {
+    input_event_t events[INPUT_QUEUE_SIZE];
+    const size_t  events_size = input_queue_drain(view->input, events);
+
+    for (size_t i = 0; i < events_size; ++i) {
+        switch (events[i].type) {
+            case INPUT_EVENT_MOVE:
+                view->mt.mouse_x = events[i].x;
+                view->mt.mouse_y = events[i].y;
+                break;
+            case INPUT_EVENT_BUTTON:
+                view->mt.mouse_click = events[i].down;
+                break;
+            case INPUT_EVENT_SCROLL:
+                view->mt.mouse_scroll += events[i].scroll;
+                break;
+        }
+    }
+}
+
+static void
+layer_background_draw(cairo_t *cr, void *udata) {
+    UNUSED(udata);
+
+    if (!GAM_PERF_STATS) {
+        background_draw(cr);
+        return;
+    }
+
+    long time_start = utils_gettime();
+    background_draw(cr);
+    perf_stats_record(PERF_STAGE_BACKGROUND, utils_gettime() - time_start);
+}
+
+static void
+layer_hud_draw(cairo_t *cr, void *udata) {
+    UNUSED(udata);
+    perf_hud_draw(cr);
+}
+
+static void
+map_view_draw_airport(cairo_t *cr, map_view_t *view) {
+    background_draw_enter(cr);
+    ap_map_draw(cr, view->ap_map, view->ap_index);
+    background_draw_exit(cr);
+}
+
+static void
+map_view_cache_key(const map_view_t *view, render_cache_key_t *key) {
+    render_cache_key_init(key);
+    ap_map_cache_key(view->db, view->ap_index, key);
+    /* The content panel clip */
+    render_cache_key_add_str(key, "map_view");
+    render_cache_key_add_long(key, GAM_UI_GLOBAL_BORDER);
+    render_cache_key_add_double(key, GAM_UI_APT_CONTENT_PANEL_W);
+    render_cache_key_add_double(key, GAM_UI_APT_CONTENT_PANEL_H);
+    render_cache_key_add_double(key, GAM_UI_APT_CONTENT_PANEL_R);
+}
+
+/*
+ * The airport layer as an image, mapped from the cache or rasterized and
+ * stored on a miss. Kept until the airport changes.
+ */
+static cairo_surface_t *
+map_view_airport_surface(map_view_t *view) {
+    render_cache_key_t key;
+    cairo_t           *cr;
+
+    if (view->ap_surface != NULL && view->ap_surface_index == view->ap_index) {
+        return view->ap_surface;
+    }
+
+    map_view_release_airport(view);
+    map_view_cache_key(view, &key);
+    view->ap_surface_index = view->ap_index;
+
+    if (render_cache_get(view->cache, &key, &view->ap_cached)) {
+        if (view->ap_cached.width == GAM_WINDOW_WIDTH &&
+            view->ap_cached.height == GAM_WINDOW_HEIGHT) {
+            /* Only ever a source, the mapping itself is read-only */
+            view->ap_surface = cairo_image_surface_create_for_data(
+                (unsigned char *)view->ap_cached.data, CAIRO_FORMAT_ARGB32, GAM_WINDOW_WIDTH,
+                GAM_WINDOW_HEIGHT, view->ap_cached.stride);
+            return view->ap_surface;
+        }
+        render_cache_release(&view->ap_cached);
+    }
+
+    view->ap_surface =
+        cairo_image_surface_create(CAIRO_FORMAT_ARGB32, GAM_WINDOW_WIDTH, GAM_WINDOW_HEIGHT);
+    cr = cairo_create(view->ap_surface);
+    map_view_draw_airport(cr, view);
+
+    if (cairo_status(cr) == CAIRO_STATUS_SUCCESS) {
+        cairo_surface_flush(view->ap_surface);
+        render_cache_put(view->cache, &key, cairo_image_surface_get_data(view->ap_surface),
+            GAM_WINDOW_WIDTH, GAM_WINDOW_HEIGHT, cairo_image_surface_get_stride(view->ap_surface));
+    }
+    cairo_destroy(cr);
+
+    return view->ap_surface;
+}
+
+/* Only reads the view, whatever it draws was made ready by map_view_prepare */
+static void
+layer_airport_draw(cairo_t *cr, void *udata) {
+    ASSERT(udata != NULL);
+    map_view_t *view = (map_view_t *)udata;
+
+    if (view->cache == NULL) {
+        map_view_draw_airport(cr, view);
+        return;
+    }
+
+    /* Onto the cleared layer, so the same pixels as drawing directly */
+    ASSERT(view->ap_surface != NULL);
+    cairo_set_source_surface(cr, view->ap_surface, 0, 0);
+    cairo_paint(cr);
+}
+
+void
+map_view_start(cairo_t *cr, void *udata) {
+    UNUSED(cr);
+    ASSERT(udata != NULL);
+    map_view_t *view = (map_view_t *)udata;
+    view->ap_map = ap_map_create(view->db);
+
+    view->comp = compositor_create(GAM_WINDOW_WIDTH, GAM_WINDOW_HEIGHT);
+    view->bg_layer = compositor_add_layer(view->comp, layer_background_draw, view);
+    view->ap_layer = compositor_add_layer(view->comp, layer_airport_draw, view);
+    view->hud_layer = -1;
+    if (view->hud) {
+        view->hud_layer = compositor_add_layer(view->comp, layer_hud_draw, view);
+    }
+}
+
+void
+map_view_prepare(cairo_t *cr, void *udata) {
+    ASSERT(udata != NULL);
+    map_view_t *view = (map_view_t *)udata;
+    damage_t    damage;
+
+    damage_clear(&damage);
+    map_view_handle_input(view);
+
+    /* Shows the previous frames, so it changes every frame and needs the next one drawn too */
+    if (view->hud_layer >= 0) {
+        compositor_invalidate_rect(view->comp, view->hud_layer, GAM_UI_PERF_HUD_X,
+            GAM_UI_PERF_HUD_Y, GAM_UI_PERF_HUD_W, GAM_UI_PERF_HUD_H);
+        if (view->on_frame != NULL) {
+            view->on_frame(view->on_frame_udata);
+        }
+    }
+
+    /* Records or fetches the airport layer, so painting it doesn't write the view */
+    if (view->cache != NULL) {
+        map_view_airport_surface(view);
+    } else {
+        ap_map_prepare(cr, view->ap_map, view->ap_index);
+    }
+
+    compositor_update(view->comp, &damage);
+    /* Nothing but the redrawn layers changed, so only that has to be uploaded */
+    if (view->on_damage != NULL) {
+        view->on_damage(&damage, view->on_damage_udata);
+    }
+}
+
+void
+map_view_paint(cairo_t *cr, void *udata) {
+    ASSERT(udata != NULL);
+    map_view_t *view = (map_view_t *)udata;
+
+    compositor_paint(view->comp, cr);
+}
+
+void
+map_view_loop(cairo_t *cr, void *udata) {
+    map_view_prepare(cr, udata);
+    map_view_paint(cr, udata);
+}
+
+void
+map_view_end(cairo_t *cr, void *udata) {
+    UNUSED(cr);
+    ASSERT(udata != NULL);
+    map_view_t *view = (map_view_t *)udata;
+
+    view->comp = compositor_destroy(view->comp);
+    map_view_release_airport(view);
+    view->ap_map = ap_map_destroy(view->ap_map);
+    view->input = input_queue_destroy(view->input);
+    free(view);
+}
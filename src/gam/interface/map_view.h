@@ -0,0 +1,91 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef MAP_VIEW_H_
+#define MAP_VIEW_H_
+
+#include <cairo/cairo.h>
+#include <graphics/damage.h>
+#include <graphics/input_queue.h>
+#include <graphics/render_cache.h>
+#include <parsers/apt_dat.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Everything drawn on a map surface (background, airport, perf HUD), as
+ * start/loop/end callbacks for cairo_mt or cairo_offscreen. Doesn't touch
+ * GL or the window, so it also renders headless.
+ */
+
+typedef struct map_view map_view_t;
+
+map_view_t *
+map_view_create(const airport_db_t *db, size_t ap_index, bool hud);
+/* Called from loop with the area each frame changed, e.g. cairo_mt_add_damage */
+void
+map_view_set_damage_callback(
+    map_view_t *view, void (*on_damage)(const damage_t *damage, void *), void *udata);
+/*
+ * Called from prepare while the view changes without any input (the HUD),
+ * e.g. cairo_mt_request_frame, so frames keep coming. Before start.
+ */
+void
+map_view_set_frame_callback(map_view_t *view, void (*on_frame)(void *), void *udata);
+/*
+ * Optional, before start. The airport layer is then read from the cache
+ * when the airport was drawn before, and stored there otherwise.
+ */
+void
+map_view_set_cache(map_view_t *view, render_cache_t *cache);
+/* Main thread side, events are applied at the start of the next frame */
+void
+map_view_push_input(map_view_t *view, const input_event_t *event);
+/* Returns whether any waiting events were queued, they need a frame then */
+bool
+map_view_flush_input(map_view_t *view);
+/* Render thread only, between frames */
+void
+map_view_set_airport(map_view_t *view, size_t ap_index);
+/*
+ * Render thread only, the airport layer is rasterized again on the next
+ * frame. With record, its paths are also rebuilt, as after switching airports.
+ */
+void
+map_view_invalidate(map_view_t *view, bool record);
+/*
+ * Render thread only, after start. The airport is projected and its paths
+ * built on every draw instead of recorded once, see ap_map_set_immediate.
+ */
+void
+map_view_set_immediate(map_view_t *view, bool immediate);
+
+/*
+ * Callbacks, userdata is the view. end destroys it. loop is prepare and
+ * paint in one; with bands, prepare is set as the prepare callback and paint
+ * as loop, which then only reads the view.
+ */
+void
+map_view_start(cairo_t *cr, void *udata);
+void
+map_view_prepare(cairo_t *cr, void *udata);
+void
+map_view_paint(cairo_t *cr, void *udata);
+void
+map_view_loop(cairo_t *cr, void *udata);
+void
+map_view_end(cairo_t *cr, void *udata);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAP_VIEW_H_ */
@@ -0,0 +1,73 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "perf_hud.h"
+
+#include <gam/gam_defs.h>
+#include <stdio.h>
+#include <utils/hex_to_rgb.h>
+#include <utils/perf_stats.h>
+
+#define PERF_HUD_GRAPH_W    120 /* Pixels, one per sample */
+#define PERF_HUD_FONT_SIZE  11
+/* Frame budget at the render target, the graph tops out at twice that */
+#define PERF_HUD_BUDGET_NS  (1000000000.0 / GAM_WINDOW_RENDER_FPS_TGT)
+
+static void
+perf_hud_draw_graph(cairo_t *cr) {
+    long         samples[PERF_HUD_GRAPH_W];
+    const size_t size = perf_stats_recent(PERF_STAGE_FRAME, samples, PERF_HUD_GRAPH_W);
+    const double scale = GAM_UI_PERF_HUD_H / (PERF_HUD_BUDGET_NS * 2.0);
+
+    cairo_set_line_width(cr, 1.0);
+
+    for (size_t i = 0; i < size; ++i) {
+        double h = samples[i] * scale;
+        double x = GAM_UI_PERF_HUD_X + (PERF_HUD_GRAPH_W - size + i) + 0.5;
+
+        if (h > GAM_UI_PERF_HUD_H) {
+            h = GAM_UI_PERF_HUD_H;
+        }
+
+        if (samples[i] > PERF_HUD_BUDGET_NS) {
+            cairo_set_source_rgb(cr, HEX_TO_RGB_INPLACE(GAM_UI_PERF_HUD_OVER_COLOR));
+        } else {
+            cairo_set_source_rgb(cr, HEX_TO_RGB_INPLACE(GAM_UI_PERF_HUD_COLOR));
+        }
+
+        cairo_move_to(cr, x, GAM_UI_PERF_HUD_Y + GAM_UI_PERF_HUD_H);
+        cairo_rel_line_to(cr, 0, -h);
+        cairo_stroke(cr);
+    }
+}
+
+static void
+perf_hud_draw_text(cairo_t *cr) {
+    char         line[64];
+    const double x = GAM_UI_PERF_HUD_X + PERF_HUD_GRAPH_W + 8;
+
+    cairo_set_source_rgb(cr, HEX_TO_RGB_INPLACE(GAM_UI_MAIN_TEXT_COLOR));
+    cairo_set_font_size(cr, PERF_HUD_FONT_SIZE);
+
+    snprintf(line, sizeof(line), "frame p50 %.2lf ms",
+        perf_stats_percentile(PERF_STAGE_FRAME, 50.0) / 1e6);
+    cairo_move_to(cr, x, GAM_UI_PERF_HUD_Y + PERF_HUD_FONT_SIZE);
+    cairo_show_text(cr, line);
+
+    snprintf(line, sizeof(line), "p95 %.2lf ms  p99 %.2lf ms",
+        perf_stats_percentile(PERF_STAGE_FRAME, 95.0) / 1e6,
+        perf_stats_percentile(PERF_STAGE_FRAME, 99.0) / 1e6);
+    cairo_move_to(cr, x, GAM_UI_PERF_HUD_Y + (PERF_HUD_FONT_SIZE * 2) + 4);
+    cairo_show_text(cr, line);
+}
+
+void
+perf_hud_draw(cairo_t *cr) {
+    perf_hud_draw_graph(cr);
+    perf_hud_draw_text(cr);
+}
@@ -0,0 +1,26 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef PERF_HUD_H_
+#define PERF_HUD_H_
+
+#include <cairo/cairo.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Frame time graph and percentiles, inside the GAM_UI_PERF_HUD_* rectangle */
+void
+perf_hud_draw(cairo_t *cr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERF_HUD_H_ */
@@ -0,0 +1,330 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "cairo_bands.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <utils/log.h>
+#include <utils/trace.h>
+
+/* A band's rows of one target */
+typedef struct cairo_band_target {
+    cairo_surface_t *surface;
+    cairo_t         *cr;
+} cairo_band_target_t;
+
+/* Horizontal slice of every target, rendered by its own thread */
+typedef struct cairo_band {
+    cairo_bands_t       *cb;
+    cairo_band_target_t *targets;
+    unsigned             index;
+    int                  y;
+    int                  h;
+    pthread_t            thread;
+} cairo_band_t;
+
+struct cairo_bands {
+    int             width;
+    int             height;
+    /* Buffer each target's band surfaces wrap, NULL until the first wrap */
+    unsigned char **targets_data;
+    unsigned        targets_size;
+
+    cairo_band_t   *bands;
+    unsigned        size;
+
+    /* What the current frame renders */
+    unsigned        target;
+    void (*loop)(cairo_t *cr, void *);
+    void           *udata;
+    bool            clear;
+
+    unsigned        generation;
+    unsigned        pending;
+    bool            quit;
+    pthread_mutex_t mutex;
+    pthread_cond_t  start_cond;
+    pthread_cond_t  done_cond;
+};
+
+/* Only its address matters, tags the cairo_t of every band */
+static const cairo_user_data_key_t cairo_bands_key;
+
+static void
+cairo_bands_render_band(cairo_bands_t *cb, cairo_band_t *band) {
+    TRACE_SCOPE("cairo_band");
+    cairo_band_target_t *target = &band->targets[cb->target];
+    cairo_t             *cr = target->cr;
+
+    cairo_save(cr);
+
+    if (cb->clear) {
+        cairo_set_source_rgb(cr, 0, 0, 0);
+        cairo_paint(cr);
+    }
+
+    cb->loop(cr, cb->udata);
+    cairo_restore(cr);
+
+    cairo_surface_flush(target->surface);
+}
+
+static void *
+cairo_bands_thread(void *arg) {
+    ASSERT(arg != NULL);
+    cairo_band_t  *band = (cairo_band_t *)arg;
+    cairo_bands_t *cb = band->cb;
+    unsigned       generation = 0;
+
+    TRACE_THREAD_NAME("cairo_band");
+
+    for (;;) {
+        pthread_mutex_lock(&cb->mutex);
+        while (cb->generation == generation && !cb->quit) {
+            pthread_cond_wait(&cb->start_cond, &cb->mutex);
+        }
+        if (cb->quit) {
+            pthread_mutex_unlock(&cb->mutex);
+            break;
+        }
+        generation = cb->generation;
+        pthread_mutex_unlock(&cb->mutex);
+
+        cairo_bands_render_band(cb, band);
+
+        pthread_mutex_lock(&cb->mutex);
+        cb->pending -= 1;
+        if (cb->pending == 0) {
+            pthread_cond_signal(&cb->done_cond);
+        }
+        pthread_mutex_unlock(&cb->mutex);
+    }
+
+    pthread_exit(NULL);
+}
+
+cairo_bands_t *
+cairo_bands_create(int width, int height, unsigned bands, unsigned targets) {
+    ASSERT(width > 0 && height > 0);
+    ASSERT(bands > 0 && bands <= CAIRO_BANDS_MAX && (int)bands <= height);
+    ASSERT(targets > 0);
+    cairo_bands_t *cb;
+    const int      band_h = height / (int)bands;
+
+    cb = malloc(sizeof(*cb));
+    cb->width = width;
+    cb->height = height;
+    cb->targets_data = calloc(targets, sizeof(*cb->targets_data));
+    cb->targets_size = targets;
+    cb->bands = calloc(bands, sizeof(*cb->bands));
+    cb->size = bands;
+    cb->target = 0;
+    cb->loop = NULL;
+    cb->udata = NULL;
+    cb->clear = false;
+    cb->generation = 0;
+    cb->pending = 0;
+    cb->quit = false;
+
+    pthread_mutex_init(&cb->mutex, NULL);
+    pthread_cond_init(&cb->start_cond, NULL);
+    pthread_cond_init(&cb->done_cond, NULL);
+
+    for (unsigned i = 0; i < bands; ++i) {
+        cairo_band_t *band = &cb->bands[i];
+
+        band->cb = cb;
+        band->targets = calloc(targets, sizeof(*band->targets));
+        band->index = i;
+        band->y = band_h * (int)i;
+        band->h = (i == bands - 1) ? (height - band->y) : band_h;
+
+        /* Band 0 is rendered by whoever calls cairo_bands_render */
+        if (i > 0) {
+            pthread_create(&band->thread, NULL, cairo_bands_thread, (void *)band);
+        }
+    }
+
+    return cb;
+}
+
+unsigned
+cairo_bands_get_size(const cairo_bands_t *cb) {
+    ASSERT(cb != NULL);
+    return cb->size;
+}
+
+static void
+cairo_bands_target_free(cairo_band_target_t *target) {
+    if (target->cr != NULL) {
+        cairo_destroy(target->cr);
+        cairo_surface_destroy(target->surface);
+        target->cr = NULL;
+        target->surface = NULL;
+    }
+}
+
+void
+cairo_bands_wrap(
+    cairo_bands_t *cb, unsigned target, unsigned char *data, int stride, cairo_t *state) {
+    ASSERT(cb != NULL);
+    ASSERT(target < cb->targets_size);
+    ASSERT(data != NULL);
+
+    if (data == cb->targets_data[target]) {
+        return;
+    }
+
+    for (unsigned i = 0; i < cb->size; ++i) {
+        cairo_band_t        *band = &cb->bands[i];
+        cairo_band_target_t *bt = &band->targets[target];
+
+        cairo_bands_target_free(bt);
+
+        bt->surface = cairo_image_surface_create_for_data(
+            data + ((size_t)band->y * (size_t)stride), CAIRO_FORMAT_ARGB32, cb->width, band->h,
+            stride);
+        /* Whole pixels, so every band rasterizes exactly like the full surface would */
+        cairo_surface_set_device_offset(bt->surface, 0, -band->y);
+        bt->cr = cairo_create(bt->surface);
+        cairo_set_user_data(bt->cr, &cairo_bands_key, band, NULL);
+
+        if (state != NULL) {
+            cairo_bands_copy_state(bt->cr, state);
+        }
+    }
+
+    cb->targets_data[target] = data;
+}
+
+void
+cairo_bands_render(cairo_bands_t *cb, unsigned target, void (*loop)(cairo_t *cr, void *),
+    void *udata, bool clear) {
+    ASSERT(cb != NULL);
+    ASSERT(loop != NULL);
+    ASSERT(target < cb->targets_size);
+    ASSERT(cb->targets_data[target] != NULL);
+
+    pthread_mutex_lock(&cb->mutex);
+    cb->target = target;
+    cb->loop = loop;
+    cb->udata = udata;
+    cb->clear = clear;
+    cb->pending = cb->size - 1;
+    cb->generation += 1;
+    pthread_cond_broadcast(&cb->start_cond);
+    pthread_mutex_unlock(&cb->mutex);
+
+    cairo_bands_render_band(cb, &cb->bands[0]);
+
+    pthread_mutex_lock(&cb->mutex);
+    while (cb->pending > 0) {
+        pthread_cond_wait(&cb->done_cond, &cb->mutex);
+    }
+    pthread_mutex_unlock(&cb->mutex);
+}
+
+bool
+cairo_bands_get_band(cairo_t *cr, unsigned *index, int *y, int *h) {
+    ASSERT(cr != NULL);
+    const cairo_band_t *band = cairo_get_user_data(cr, &cairo_bands_key);
+
+    if (band == NULL) {
+        return false;
+    }
+
+    *index = band->index;
+    *y = band->y;
+    *h = band->h;
+    return true;
+}
+
+void
+cairo_bands_copy_state(cairo_t *dst, cairo_t *src) {
+    ASSERT(dst != NULL && src != NULL);
+    cairo_matrix_t          matrix;
+    cairo_rectangle_list_t *clip;
+    cairo_font_options_t   *font_options;
+    const int               dashes_size = cairo_get_dash_count(src);
+
+    /* Clip rectangles are in src's user space, so the matrix goes first */
+    cairo_get_matrix(src, &matrix);
+    cairo_set_matrix(dst, &matrix);
+
+    clip = cairo_copy_clip_rectangle_list(src);
+    if (clip->status == CAIRO_STATUS_SUCCESS) {
+        cairo_new_path(dst);
+        for (int i = 0; i < clip->num_rectangles; ++i) {
+            const cairo_rectangle_t *r = &clip->rectangles[i];
+            cairo_rectangle(dst, r->x, r->y, r->width, r->height);
+        }
+        cairo_clip(dst);
+    } else {
+        log_err("Clip can't be copied: %s", cairo_status_to_string(clip->status));
+    }
+    cairo_rectangle_list_destroy(clip);
+
+    cairo_set_source(dst, cairo_get_source(src));
+    cairo_set_operator(dst, cairo_get_operator(src));
+    cairo_set_tolerance(dst, cairo_get_tolerance(src));
+    cairo_set_antialias(dst, cairo_get_antialias(src));
+    cairo_set_fill_rule(dst, cairo_get_fill_rule(src));
+    cairo_set_line_width(dst, cairo_get_line_width(src));
+    cairo_set_line_cap(dst, cairo_get_line_cap(src));
+    cairo_set_line_join(dst, cairo_get_line_join(src));
+    cairo_set_miter_limit(dst, cairo_get_miter_limit(src));
+
+    if (dashes_size > 0) {
+        double *dashes = malloc((size_t)dashes_size * sizeof(*dashes));
+        double  offset;
+
+        cairo_get_dash(src, dashes, &offset);
+        cairo_set_dash(dst, dashes, dashes_size, offset);
+        free(dashes);
+    } else {
+        cairo_set_dash(dst, NULL, 0, 0.0);
+    }
+
+    cairo_set_font_face(dst, cairo_get_font_face(src));
+    cairo_get_font_matrix(src, &matrix);
+    cairo_set_font_matrix(dst, &matrix);
+    font_options = cairo_font_options_create();
+    cairo_get_font_options(src, font_options);
+    cairo_set_font_options(dst, font_options);
+    cairo_font_options_destroy(font_options);
+}
+
+void *
+cairo_bands_destroy(cairo_bands_t *cb) {
+    ASSERT(cb != NULL);
+
+    pthread_mutex_lock(&cb->mutex);
+    cb->quit = true;
+    pthread_cond_broadcast(&cb->start_cond);
+    pthread_mutex_unlock(&cb->mutex);
+
+    for (unsigned i = 0; i < cb->size; ++i) {
+        if (i > 0) {
+            pthread_join(cb->bands[i].thread, NULL);
+        }
+        for (unsigned j = 0; j < cb->targets_size; ++j) {
+            cairo_bands_target_free(&cb->bands[i].targets[j]);
+        }
+        free(cb->bands[i].targets);
+    }
+
+    pthread_cond_destroy(&cb->done_cond);
+    pthread_cond_destroy(&cb->start_cond);
+    pthread_mutex_destroy(&cb->mutex);
+    free(cb->bands);
+    free(cb->targets_data);
+    free(cb);
+
+    return NULL;
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef CAIRO_BANDS_H_
+#define CAIRO_BANDS_H_
+
+#include <cairo/cairo.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Splits a pixel buffer into horizontal bands, each with its own surface and
+ * cairo_t, and renders them concurrently on persistent threads. Band 0 is
+ * rendered by the calling thread. No GL, shared by cairo_mt and
+ * cairo_offscreen. Frames may alternate between several targets (buffers),
+ * each keeps its own band surfaces.
+ *
+ * Band surfaces have a device offset of their first row, so loop draws in
+ * the coordinates of the whole buffer. Bands match a single band render,
+ * except that cairo culls geometry outside each band, which can rarely shift
+ * anti-aliasing by one step in the rows touching a band edge.
+ */
+
+#define CAIRO_BANDS_MAX 64
+
+typedef struct cairo_bands cairo_bands_t;
+
+cairo_bands_t *
+cairo_bands_create(int width, int height, unsigned bands, unsigned targets);
+unsigned
+cairo_bands_get_size(const cairo_bands_t *cb);
+/*
+ * Points target's band surfaces at the rows of data, only re-created when
+ * data moved. New band cairo_ts get state's graphics state, if given.
+ */
+void
+cairo_bands_wrap(cairo_bands_t *cb, unsigned target, unsigned char *data, int stride,
+    cairo_t *state);
+/*
+ * Calls loop once per band of target, concurrently, and returns once every
+ * band is flushed. Whoever owns a surface over the same data has to flush it
+ * before and mark it dirty after.
+ */
+void
+cairo_bands_render(cairo_bands_t *cb, unsigned target, void (*loop)(cairo_t *cr, void *),
+    void *udata, bool clear);
+/* Whether cr belongs to a band, and which rows of the whole buffer it covers */
+bool
+cairo_bands_get_band(cairo_t *cr, unsigned *index, int *y, int *h);
+/*
+ * Gives dst src's matrix, source, clip, line, fill and font settings, for a
+ * cairo_t standing in for src on another surface over the same area. Clips
+ * that aren't a set of rectangles can't be copied and are logged.
+ */
+void
+cairo_bands_copy_state(cairo_t *dst, cairo_t *src);
+void *
+cairo_bands_destroy(cairo_bands_t *cb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAIRO_BANDS_H_ */
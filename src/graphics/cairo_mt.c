@@ -12,34 +12,78 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include <string.h>
-#include <unistd.h>
 #include <utils/log.h>
+#include <utils/perf_stats.h>
+#include <utils/trace.h>
 #include <utils/utils.h>
 
+#include "cairo_bands.h"
 #include "gl_pbo.h"
+#include "render_pool.h"
+
+#define NSEC_PER_SEC                1000000000L
+/* How much earlier than strictly needed a vsync locked frame is started */
+#define CAIRO_MT_VSYNC_MARGIN       1000000L /* Nanoseconds */
+#define CAIRO_MT_SWAP_PERIOD_SMOOTH 8
+/* Frames the frame time peak takes to decay, a slow frame after a fast one still makes the draw */
+#define CAIRO_MT_FRAME_PEAK_DECAY   128
+
+/* Renders straight into one PBO slot's mapped memory */
+typedef struct cairo_mt_slot {
+    cairo_surface_t *surface;
+    cairo_t         *cr;
+    /* Mapping the surface wraps, NULL until the slot is first rendered to */
+    void            *data;
+} cairo_mt_slot_t;
 
 struct cairo_mt {
     int              width;
     int              height;
     unsigned         gl_tex_id;
     unsigned         fps_tgt;
+    cairo_mt_pace_t  pace;
+    /* Absolute time the next frame may start at, render thread only */
+    long             deadline;
+    /* Render thread only, how long vsync locked frames are expected to take */
+    long             frame_peak;
+    /* Written by the main thread on every draw, read by the render thread */
+    long             swap_time;
+    long             swap_period;
 
-    cairo_surface_t *surface;
-    cairo_t         *cr;
     pbo_hdlr_t      *pbo;
+    cairo_mt_slot_t  slots[GL_PBO_SLOTS];
+    /* Render thread only, the back slot of the current frame and the slot start drew on */
+    unsigned         slot;
+    unsigned         start_slot;
 
     void (*start)(cairo_t *cr, void *);
+    void (*prepare)(cairo_t *cr, void *);
     void (*loop)(cairo_t *cr, void *);
     void (*end)(cairo_t *cr, void *);
     bool            callbacks_set;
+    bool            clear_frame;
 
     pthread_t       thread;
     pthread_mutex_t mutex;
+    pthread_cond_t  frame_cond;
     bool            thread_started;
     bool            quit_thread;
-
-    void           *userdata;
+    bool            frame_requested;
+    /* Area changed by the frame being rendered, whole frame if frame_damaged is unset */
+    damage_t        damage;
+    bool            frame_damaged;
+
+    /* Set when frames are rendered by a shared pool instead of our own thread */
+    render_pool_t        *pool;
+    render_pool_client_t *pool_client;
+    int                   priority;
+    bool                  pool_started;
+
+    /* Only with more than one band */
+    cairo_bands_t  *bands;
+    unsigned        bands_size;
+
+    void *userdata;
 };
 
 static GLuint
@@ -67,90 +111,314 @@ cairo_mt_create(int width, int height, unsigned fps_tgt) {
     cmt->width = width;
     cmt->height = height;
     cmt->gl_tex_id = cairo_mt_gen_gl_texture(width, height);
-    cmt->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-    cmt->cr = cairo_create(cmt->surface);
     cmt->pbo = gl_pbo_create(width, height);
+    for (unsigned i = 0; i < GL_PBO_SLOTS; ++i) {
+        cmt->slots[i].surface = NULL;
+        cmt->slots[i].cr = NULL;
+        cmt->slots[i].data = NULL;
+    }
+    cmt->slot = 0;
+    cmt->start_slot = 0;
     cmt->fps_tgt = fps_tgt;
+    cmt->pace = CAIRO_MT_PACE_FIXED;
+    cmt->deadline = 0;
+    cmt->frame_peak = 0;
+    cmt->swap_time = 0;
+    cmt->swap_period = 0;
 
     pthread_mutex_init(&cmt->mutex, NULL);
+    pthread_cond_init(&cmt->frame_cond, NULL);
 
+    cmt->prepare = NULL;
     cmt->callbacks_set = false;
+    cmt->clear_frame = true;
     cmt->thread_started = false;
+    cmt->pool = NULL;
+    cmt->pool_client = NULL;
+    cmt->priority = 0;
+    cmt->pool_started = false;
     cmt->quit_thread = false;
+    /* Always render the first frame */
+    cmt->frame_requested = true;
+
+    cmt->bands = NULL;
+    cmt->bands_size = 1;
 
     return cmt;
 }
 
-static void
-cairo_mt_calc_sleep(cairo_mt_t *cmt, long time_start, long time_end) {
-    UNUSED(cmt);
-    ASSERT(time_end > time_start);
-    double ms_sleep_time;
-    long   diff_time_micros;
+/*
+ * Next frame start that lets the frame finish just before the main thread's
+ * predicted draw, no earlier than earliest.
+ */
+static long
+cairo_mt_vsync_deadline(cairo_mt_t *cmt, long earliest, long frame_time) {
+    const long swap_time = __atomic_load_n(&cmt->swap_time, __ATOMIC_RELAXED);
+    const long swap_period = __atomic_load_n(&cmt->swap_period, __ATOMIC_RELAXED);
+    const long lead = frame_time + CAIRO_MT_VSYNC_MARGIN;
+
+    if (swap_period <= 0 || swap_time <= 0) {
+        return earliest;
+    }
 
-    diff_time_micros = (time_end - time_start) / 1000;
-    ms_sleep_time = (1000.0 / cmt->fps_tgt) * 1000.0;
+    /* First predicted draw we can still make */
+    long swaps = ((earliest + lead - swap_time) / swap_period) + 1;
+    if (swaps < 1) {
+        swaps = 1;
+    }
+
+    return swap_time + (swaps * swap_period) - lead;
+}
 
-    if (diff_time_micros >= ms_sleep_time || diff_time_micros < 0) {
-        diff_time_micros = 0;
+/*
+ * Absolute deadline for the next frame, so time spent rendering and sleep
+ * overshoot don't add up over frames. A frame that ran late restarts the
+ * schedule from now instead of rushing to catch up.
+ */
+static long
+cairo_mt_pace_frame(cairo_mt_t *cmt, long time_start, long time_end) {
+    ASSERT(time_end >= time_start);
+    const unsigned fps_tgt = __atomic_load_n(&cmt->fps_tgt, __ATOMIC_RELAXED);
+    const long     period = NSEC_PER_SEC / (long)fps_tgt;
+    const long     frame_time = time_end - time_start;
+
+    /* Rises at once and falls slowly, predicting from the last frame alone misses draws */
+    if (frame_time > cmt->frame_peak) {
+        cmt->frame_peak = frame_time;
+    } else {
+        cmt->frame_peak -= (cmt->frame_peak - frame_time) / CAIRO_MT_FRAME_PEAK_DECAY;
+    }
+
+    if (cmt->deadline < time_start - period) {
+        cmt->deadline = time_start;
     }
+    cmt->deadline += period;
 
-    usleep((unsigned)(ms_sleep_time - diff_time_micros));
+    if (cmt->deadline < time_end) {
+        cmt->deadline = time_end;
+    }
 
-    // long time_after_sleep = utils_gettime() - time_start;
-    // log_msg("FPS: %lf", 1000000000.0 / (double)time_after_sleep);
+    if (__atomic_load_n(&cmt->pace, __ATOMIC_RELAXED) == CAIRO_MT_PACE_VSYNC) {
+        cmt->deadline = cairo_mt_vsync_deadline(cmt, cmt->deadline, cmt->frame_peak);
+    }
+
+    return cmt->deadline;
 }
 
-static void *
-cairo_mt_thread(void *arg) {
-    ASSERT(arg != NULL);
-    cairo_mt_t *cmt = (cairo_mt_t *)arg;
-    bool        should_render = true;
+/* Sleeps until a frame is requested, returns false when the thread should quit */
+static bool
+cairo_mt_wait_for_frame(cairo_mt_t *cmt) {
+    bool should_render;
+
+    pthread_mutex_lock(&cmt->mutex);
+    while (!cmt->frame_requested && !cmt->quit_thread) {
+        pthread_cond_wait(&cmt->frame_cond, &cmt->mutex);
+    }
+    should_render = !cmt->quit_thread;
+    cmt->frame_requested = false;
+    pthread_mutex_unlock(&cmt->mutex);
 
-    cmt->start(cmt->cr, cmt->userdata);
+    return should_render;
+}
 
-    while (should_render) {
-        long time_start = utils_gettime();
+static void
+cairo_mt_render_frame(cairo_mt_t *cmt) {
+    cairo_mt_slot_t *slot = &cmt->slots[cmt->slot];
 
-        pthread_mutex_lock(&cmt->mutex);
-        should_render = !cmt->quit_thread;
-        pthread_mutex_unlock(&cmt->mutex);
+    if (cmt->prepare != NULL) {
+        TRACE_BEGIN("prepare");
+        cmt->prepare(slot->cr, cmt->userdata);
+        TRACE_END("prepare");
+    }
+
+    if (cmt->bands == NULL) {
+        long time_start = utils_gettime();
 
         /* Clear surface */
-        cairo_set_source_rgb(cmt->cr, 0, 0, 0);
-        cairo_paint(cmt->cr);
+        TRACE_BEGIN("clear");
+        if (cmt->clear_frame) {
+            cairo_set_source_rgb(slot->cr, 0, 0, 0);
+            cairo_paint(slot->cr);
+        }
+        TRACE_END("clear");
+
+        long time_cleared = utils_gettime();
+        TRACE_BEGIN("loop");
+        cmt->loop(slot->cr, cmt->userdata);
+        TRACE_END("loop");
+        long time_drawn = utils_gettime();
+        TRACE_BEGIN("flush");
+        cairo_surface_flush(slot->surface);
+        TRACE_END("flush");
+
+        perf_stats_record(PERF_STAGE_CLEAR, time_cleared - time_start);
+        perf_stats_record(PERF_STAGE_LOOP, time_drawn - time_cleared);
+        perf_stats_record(PERF_STAGE_FLUSH, utils_gettime() - time_drawn);
+        return;
+    }
 
-        cmt->loop(cmt->cr, cmt->userdata);
+    long time_start = utils_gettime();
 
-        cairo_surface_flush(cmt->surface);
-        const int stride = cairo_image_surface_get_stride(cmt->surface);
-        void     *surf_data = cairo_image_surface_get_data(cmt->surface);
-        void     *pbo_buffer = gl_pbo_get_back_buffer(cmt->pbo);
+    /* Band surfaces write behind the back of the full surface */
+    cairo_surface_flush(slot->surface);
+    cairo_bands_render(cmt->bands, cmt->slot, cmt->loop, cmt->userdata, cmt->clear_frame);
+    cairo_surface_mark_dirty(slot->surface);
 
-        if (surf_data != NULL && pbo_buffer != NULL) {
-            memcpy(pbo_buffer, surf_data, (size_t)(stride * cmt->height));
-            gl_pbo_finish_back_buffer(cmt->pbo);
-        }
+    /* Bands clear, draw and flush together */
+    perf_stats_record(PERF_STAGE_LOOP, utils_gettime() - time_start);
+}
+
+/*
+ * Renders straight into mapped PBO memory. Every slot keeps its surface and
+ * cairo_t, made the first time it's the back buffer and only again if its
+ * mapping moved (no persistent mapping). A new cairo_t takes over the state
+ * start set from the one it replaces, or from the one start drew on.
+ */
+static void
+cairo_mt_wrap_slot(cairo_mt_t *cmt, unsigned index, void *buffer) {
+    cairo_mt_slot_t *slot = &cmt->slots[index];
+    const int        stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, cmt->width);
+    cairo_t         *state = (slot->cr != NULL) ? slot->cr : cmt->slots[cmt->start_slot].cr;
+    cairo_surface_t *surface;
+    cairo_t         *cr;
+
+    if (buffer == slot->data) {
+        return;
+    }
+
+    /* PBOs are tightly packed */
+    ASSERT(stride == cmt->width * 4);
+
+    surface = cairo_image_surface_create_for_data(
+        buffer, CAIRO_FORMAT_ARGB32, cmt->width, cmt->height, stride);
+    cr = cairo_create(surface);
+    if (state != NULL) {
+        cairo_bands_copy_state(cr, state);
+    }
+
+    if (slot->cr != NULL) {
+        cairo_destroy(slot->cr);
+        cairo_surface_destroy(slot->surface);
+    }
+    slot->surface = surface;
+    slot->cr = cr;
+    slot->data = buffer;
+
+    if (cmt->bands != NULL) {
+        cairo_bands_wrap(cmt->bands, index, buffer, stride, cr);
+    }
+}
+
+static void
+cairo_mt_begin(cairo_mt_t *cmt) {
+    cmt->slot = gl_pbo_get_back_slot(cmt->pbo);
+    cmt->start_slot = cmt->slot;
+    cairo_mt_wrap_slot(cmt, cmt->slot, gl_pbo_get_back_buffer(cmt->pbo));
+
+    cmt->start(cmt->slots[cmt->slot].cr, cmt->userdata);
+
+    if (cmt->bands_size > 1) {
+        cmt->bands = cairo_bands_create(cmt->width, cmt->height, cmt->bands_size, GL_PBO_SLOTS);
+        cairo_bands_wrap(cmt->bands, cmt->slot, cmt->slots[cmt->slot].data,
+            cairo_image_surface_get_stride(cmt->slots[cmt->slot].surface),
+            cmt->slots[cmt->slot].cr);
+    }
+}
+
+static void
+cairo_mt_finish(cairo_mt_t *cmt) {
+    if (cmt->bands != NULL) {
+        cmt->bands = cairo_bands_destroy(cmt->bands);
+    }
+
+    cmt->end(cmt->slots[cmt->slot].cr, cmt->userdata);
+}
+
+/* Renders one frame, returns the earliest time the next one may start at */
+static long
+cairo_mt_frame(cairo_mt_t *cmt) {
+    TRACE_SCOPE("cairo_mt_frame");
+    long time_start = utils_gettime();
+
+    /* There's always a free back buffer, a frame that isn't shown yet is replaced */
+    pthread_mutex_lock(&cmt->mutex);
+    damage_clear(&cmt->damage);
+    cmt->frame_damaged = false;
+    pthread_mutex_unlock(&cmt->mutex);
+
+    cmt->slot = gl_pbo_get_back_slot(cmt->pbo);
+    cairo_mt_wrap_slot(cmt, cmt->slot, gl_pbo_get_back_buffer(cmt->pbo));
+    cairo_mt_render_frame(cmt);
+    gl_pbo_finish_back_buffer(cmt->pbo, cmt->frame_damaged ? &cmt->damage : NULL);
+    TRACE_COUNTER("damage_rects", cmt->frame_damaged ? cmt->damage.size : 0);
+
+    /* Caps the rate at fps_tgt while frames keep being requested */
+    long time_end = utils_gettime();
+    perf_stats_record(PERF_STAGE_FRAME, time_end - time_start);
+    return cairo_mt_pace_frame(cmt, time_start, time_end);
+}
+
+static void *
+cairo_mt_thread(void *arg) {
+    ASSERT(arg != NULL);
+    cairo_mt_t *cmt = (cairo_mt_t *)arg;
+
+    TRACE_THREAD_NAME("cairo_mt");
+    cairo_mt_begin(cmt);
 
-        long time_end = utils_gettime();
-        cairo_mt_calc_sleep(cmt, time_start, time_end);
+    while (cairo_mt_wait_for_frame(cmt)) {
+        const long deadline = cairo_mt_frame(cmt);
+        TRACE_BEGIN("pace");
+        utils_sleep_until(deadline);
+        TRACE_END("pace");
     }
 
-    cmt->end(cmt->cr, cmt->userdata);
+    cairo_mt_finish(cmt);
 
     pthread_exit(NULL);
 }
 
+/* Pool workers take turns running our frames, never two at once */
+static long
+cairo_mt_pool_frame(void *arg) {
+    ASSERT(arg != NULL);
+    cairo_mt_t *cmt = (cairo_mt_t *)arg;
+
+    if (!cmt->pool_started) {
+        cairo_mt_begin(cmt);
+        cmt->pool_started = true;
+    }
+
+    return cairo_mt_frame(cmt);
+}
+
 void
 cairo_mt_start(cairo_mt_t *cmt, void *userdata) {
     ASSERT(cmt != NULL);
     ASSERT(cmt->callbacks_set);
+    ASSERT(cmt->pool_client == NULL);
+    /* Whatever loop would change has to move to prepare once bands run concurrently */
+    ASSERT(cmt->bands_size == 1 || cmt->prepare != NULL);
     cmt->thread_started = true;
     cmt->userdata = userdata;
 
     pthread_create(&cmt->thread, NULL, cairo_mt_thread, (void *)cmt);
 }
 
+void
+cairo_mt_start_pooled(cairo_mt_t *cmt, render_pool_t *pool, void *userdata) {
+    ASSERT(cmt != NULL);
+    ASSERT(pool != NULL);
+    ASSERT(cmt->callbacks_set);
+    ASSERT(!cmt->thread_started);
+    ASSERT(cmt->bands_size == 1 || cmt->prepare != NULL);
+    cmt->userdata = userdata;
+    cmt->pool = pool;
+
+    /* The first frame is requested on add */
+    cmt->pool_client = render_pool_add(pool, cairo_mt_pool_frame, (void *)cmt, cmt->priority);
+}
+
 void
 cairo_mt_set_callbacks(cairo_mt_t *cmt, void (*start)(cairo_t *cr, void *),
     void (*loop)(cairo_t *cr, void *), void (*end)(cairo_t *cr, void *)) {
@@ -162,17 +430,115 @@ cairo_mt_set_callbacks(cairo_mt_t *cmt, void (*start)(cairo_t *cr, void *),
     cmt->callbacks_set = true;
 }
 
+void
+cairo_mt_set_prepare(cairo_mt_t *cmt, void (*prepare)(cairo_t *cr, void *)) {
+    ASSERT(cmt != NULL);
+    ASSERT(!cmt->thread_started && cmt->pool_client == NULL);
+    cmt->prepare = prepare;
+}
+
+void
+cairo_mt_set_clear(cairo_mt_t *cmt, bool clear) {
+    ASSERT(cmt != NULL);
+    ASSERT(!cmt->thread_started && cmt->pool_client == NULL);
+    cmt->clear_frame = clear;
+}
+
+void
+cairo_mt_set_bands(cairo_mt_t *cmt, unsigned bands) {
+    ASSERT(cmt != NULL);
+    ASSERT(!cmt->thread_started && cmt->pool_client == NULL);
+    ASSERT(bands > 0 && bands <= CAIRO_BANDS_MAX && (int)bands <= cmt->height);
+    cmt->bands_size = bands;
+}
+
+void
+cairo_mt_set_fps_tgt(cairo_mt_t *cmt, unsigned fps_tgt) {
+    ASSERT(cmt != NULL);
+    ASSERT(fps_tgt > 0);
+    __atomic_store_n(&cmt->fps_tgt, fps_tgt, __ATOMIC_RELAXED);
+}
+
+void
+cairo_mt_set_priority(cairo_mt_t *cmt, int priority) {
+    ASSERT(cmt != NULL);
+    cmt->priority = priority;
+
+    if (cmt->pool_client != NULL) {
+        render_pool_set_priority(cmt->pool, cmt->pool_client, priority);
+    }
+}
+
+void
+cairo_mt_set_pacing(cairo_mt_t *cmt, cairo_mt_pace_t pace) {
+    ASSERT(cmt != NULL);
+    __atomic_store_n(&cmt->pace, pace, __ATOMIC_RELAXED);
+}
+
+/* Tracks when, and how often, the main thread draws */
+static void
+cairo_mt_record_swap(cairo_mt_t *cmt) {
+    const long now = utils_gettime();
+    const long last = __atomic_load_n(&cmt->swap_time, __ATOMIC_RELAXED);
+    long       period = __atomic_load_n(&cmt->swap_period, __ATOMIC_RELAXED);
+
+    if (last > 0) {
+        if (period <= 0) {
+            period = now - last;
+        } else {
+            period += ((now - last) - period) / CAIRO_MT_SWAP_PERIOD_SMOOTH;
+        }
+        __atomic_store_n(&cmt->swap_period, period, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&cmt->swap_time, now, __ATOMIC_RELAXED);
+}
+
+void
+cairo_mt_add_damage(cairo_mt_t *cmt, const damage_t *damage) {
+    ASSERT(cmt != NULL);
+    ASSERT(damage != NULL);
+
+    pthread_mutex_lock(&cmt->mutex);
+    damage_union(&cmt->damage, damage);
+    cmt->frame_damaged = true;
+    pthread_mutex_unlock(&cmt->mutex);
+}
+
+void
+cairo_mt_request_frame(cairo_mt_t *cmt) {
+    ASSERT(cmt != NULL);
+
+    if (cmt->pool_client != NULL) {
+        render_pool_request(cmt->pool, cmt->pool_client);
+        return;
+    }
+
+    pthread_mutex_lock(&cmt->mutex);
+    cmt->frame_requested = true;
+    pthread_cond_signal(&cmt->frame_cond);
+    pthread_mutex_unlock(&cmt->mutex);
+}
+
 void
 cairo_mt_draw(cairo_mt_t *cmt) {
     ASSERT(cmt != NULL);
 
+    cairo_mt_record_swap(cmt);
+
     glEnable(GL_BLEND);
     glEnable(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, cmt->gl_tex_id);
     glClearColor(1.0, 0.0, 0.0, 1.0);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    gl_pbo_bind_front_buffer(cmt->pbo);
+    TRACE_BEGIN("gl_pbo_upload");
+    const bool uploaded = gl_pbo_bind_front_buffer(cmt->pbo);
+    TRACE_END("gl_pbo_upload");
+
+    if (uploaded) {
+        perf_stats_record(PERF_STAGE_UPLOAD, gl_pbo_get_upload_time(cmt->pbo));
+    }
 
     glBegin(GL_QUADS);
     glTexCoord2f(0, 0);
@@ -196,15 +562,29 @@ cairo_mt_destroy(cairo_mt_t *cmt) {
 
     pthread_mutex_lock(&cmt->mutex);
     cmt->quit_thread = true;
+    pthread_cond_signal(&cmt->frame_cond);
     pthread_mutex_unlock(&cmt->mutex);
 
     if (cmt->thread_started) {
         pthread_join(cmt->thread, NULL);
     }
 
-    cairo_destroy(cmt->cr);
-    cairo_surface_destroy(cmt->surface);
+    /* No worker touches the surface once removed, end runs on the calling thread */
+    if (cmt->pool_client != NULL) {
+        render_pool_remove(cmt->pool, cmt->pool_client);
+        if (cmt->pool_started) {
+            cairo_mt_finish(cmt);
+        }
+    }
+
+    for (unsigned i = 0; i < GL_PBO_SLOTS; ++i) {
+        if (cmt->slots[i].cr != NULL) {
+            cairo_destroy(cmt->slots[i].cr);
+            cairo_surface_destroy(cmt->slots[i].surface);
+        }
+    }
     gl_pbo_destroy(cmt->pbo);
+    pthread_cond_destroy(&cmt->frame_cond);
     pthread_mutex_destroy(&cmt->mutex);
     free(cmt);
 
@@ -10,6 +10,10 @@
 #define CAIRO_MT_H_
 
 #include <cairo/cairo.h>
+#include <stdbool.h>
+
+#include "damage.h"
+#include "render_pool.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,13 +21,65 @@ extern "C" {
 
 typedef struct cairo_mt cairo_mt_t;
 
+typedef enum cairo_mt_pace {
+    /* Frames start on a fixed fps_tgt schedule */
+    CAIRO_MT_PACE_FIXED,
+    /* Frames are timed to finish just before the main thread draws, at most at fps_tgt */
+    CAIRO_MT_PACE_VSYNC
+} cairo_mt_pace_t;
+
 cairo_mt_t *
 cairo_mt_create(int width, int height, unsigned fps_tgt);
 void
 cairo_mt_set_callbacks(cairo_mt_t *cmt, void (*start)(cairo_t *cr, void *),
     void (*loop)(cairo_t *cr, void *), void (*end)(cairo_t *cr, void *));
+/* Whether the surface is cleared to black before each loop call (default: true) */
+void
+cairo_mt_set_clear(cairo_mt_t *cmt, bool clear);
+/*
+ * Optional, called once per frame before loop and never concurrently with
+ * it. cr is the whole surface, for building paths but not for drawing.
+ */
+void
+cairo_mt_set_prepare(cairo_mt_t *cmt, void (*prepare)(cairo_t *cr, void *));
+/*
+ * Splits each frame into horizontal bands rendered on their own threads
+ * (default: 1), see cairo_bands.h. With more than one band, loop is called
+ * concurrently, once per band, so it must only read shared state: anything
+ * that changes per frame belongs in prepare, which is then required.
+ */
+void
+cairo_mt_set_bands(cairo_mt_t *cmt, unsigned bands);
 void
 cairo_mt_start(cairo_mt_t *cmt, void *userdata);
+/*
+ * Instead of a thread of its own, frames are rendered by a pool shared with
+ * other surfaces. Callbacks are never called concurrently, bands aside, but
+ * may run on any pool worker; end is called by cairo_mt_destroy, on the
+ * calling thread.
+ */
+void
+cairo_mt_start_pooled(cairo_mt_t *cmt, render_pool_t *pool, void *userdata);
+/* Pooled surfaces with a higher priority are rendered first when workers are busy */
+void
+cairo_mt_set_priority(cairo_mt_t *cmt, int priority);
+/* Both can be changed at any time, from any thread */
+void
+cairo_mt_set_fps_tgt(cairo_mt_t *cmt, unsigned fps_tgt);
+void
+cairo_mt_set_pacing(cairo_mt_t *cmt, cairo_mt_pace_t pace);
+/*
+ * The render thread sleeps until a frame is requested, call this whenever
+ * something (input, camera, data) changes what's on screen. Thread-safe.
+ */
+void
+cairo_mt_request_frame(cairo_mt_t *cmt);
+/*
+ * Called from loop, limits the frame's texture upload to the damaged area.
+ * Frames that don't report any damage are uploaded whole.
+ */
+void
+cairo_mt_add_damage(cairo_mt_t *cmt, const damage_t *damage);
 /* Called from MAIN thread, shows texture in front buffer */
 void
 cairo_mt_draw(cairo_mt_t *cmt);
@@ -0,0 +1,194 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "cairo_offscreen.h"
+
+#include <stdlib.h>
+#include <utils/log.h>
+#include <utils/perf_stats.h>
+#include <utils/trace.h>
+#include <utils/utils.h>
+
+#include "cairo_bands.h"
+
+struct cairo_offscreen {
+    cairo_surface_t *surface;
+    cairo_t         *cr;
+    /* Only with more than one band */
+    cairo_bands_t   *bands;
+    unsigned         bands_size;
+
+    void (*start)(cairo_t *cr, void *);
+    void (*prepare)(cairo_t *cr, void *);
+    void (*loop)(cairo_t *cr, void *);
+    void (*end)(cairo_t *cr, void *);
+    bool  callbacks_set;
+    bool  clear_frame;
+    bool  started;
+
+    void *userdata;
+};
+
+cairo_offscreen_t *
+cairo_offscreen_create(int width, int height) {
+    cairo_offscreen_t *cos;
+
+    ASSERT(width > 0 && height > 0);
+
+    cos = malloc(sizeof(*cos));
+    cos->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    cos->cr = cairo_create(cos->surface);
+    cos->bands = NULL;
+    cos->bands_size = 1;
+    cos->prepare = NULL;
+    cos->callbacks_set = false;
+    cos->clear_frame = true;
+    cos->started = false;
+    cos->userdata = NULL;
+
+    return cos;
+}
+
+void
+cairo_offscreen_set_callbacks(cairo_offscreen_t *cos, void (*start)(cairo_t *cr, void *),
+    void (*loop)(cairo_t *cr, void *), void (*end)(cairo_t *cr, void *)) {
+    ASSERT(cos != NULL);
+
+    cos->start = start;
+    cos->loop = loop;
+    cos->end = end;
+    cos->callbacks_set = true;
+}
+
+void
+cairo_offscreen_set_clear(cairo_offscreen_t *cos, bool clear) {
+    ASSERT(cos != NULL);
+    cos->clear_frame = clear;
+}
+
+void
+cairo_offscreen_set_prepare(cairo_offscreen_t *cos, void (*prepare)(cairo_t *cr, void *)) {
+    ASSERT(cos != NULL);
+    cos->prepare = prepare;
+}
+
+/* After start, so whatever it set on cr carries over to the bands */
+static void
+cairo_offscreen_bands_start(cairo_offscreen_t *cos) {
+    if (cos->bands_size == 1) {
+        return;
+    }
+
+    cos->bands = cairo_bands_create(cairo_image_surface_get_width(cos->surface),
+        cairo_image_surface_get_height(cos->surface), cos->bands_size, 1);
+    cairo_bands_wrap(cos->bands, 0, cairo_image_surface_get_data(cos->surface),
+        cairo_image_surface_get_stride(cos->surface), cos->cr);
+}
+
+void
+cairo_offscreen_set_bands(cairo_offscreen_t *cos, unsigned bands) {
+    ASSERT(cos != NULL);
+    ASSERT(bands > 0 && bands <= CAIRO_BANDS_MAX);
+    ASSERT((int)bands <= cairo_image_surface_get_height(cos->surface));
+
+    if (bands == cos->bands_size) {
+        return;
+    }
+
+    if (cos->bands != NULL) {
+        cos->bands = cairo_bands_destroy(cos->bands);
+    }
+    cos->bands_size = bands;
+
+    if (cos->started) {
+        cairo_offscreen_bands_start(cos);
+    }
+}
+
+void
+cairo_offscreen_start(cairo_offscreen_t *cos, void *userdata) {
+    ASSERT(cos != NULL);
+    ASSERT(cos->callbacks_set);
+    ASSERT(!cos->started);
+
+    cos->userdata = userdata;
+    cos->start(cos->cr, cos->userdata);
+    cos->started = true;
+    cairo_offscreen_bands_start(cos);
+}
+
+long
+cairo_offscreen_frame(cairo_offscreen_t *cos) {
+    TRACE_SCOPE("cairo_offscreen_frame");
+    ASSERT(cos != NULL);
+    ASSERT(cos->started);
+    ASSERT(cos->bands == NULL || cos->prepare != NULL);
+    long time_frame = utils_gettime();
+
+    if (cos->prepare != NULL) {
+        cos->prepare(cos->cr, cos->userdata);
+    }
+
+    long time_start = utils_gettime();
+
+    if (cos->bands != NULL) {
+        cairo_surface_flush(cos->surface);
+        cairo_bands_render(cos->bands, 0, cos->loop, cos->userdata, cos->clear_frame);
+        cairo_surface_mark_dirty(cos->surface);
+
+        /* Same stages as a banded cairo_mt frame */
+        long time_end = utils_gettime();
+        perf_stats_record(PERF_STAGE_LOOP, time_end - time_start);
+        perf_stats_record(PERF_STAGE_FRAME, time_end - time_frame);
+
+        return time_end - time_frame;
+    }
+
+    /* Same stages as a single band cairo_mt frame */
+    if (cos->clear_frame) {
+        cairo_set_source_rgb(cos->cr, 0, 0, 0);
+        cairo_paint(cos->cr);
+    }
+
+    long time_cleared = utils_gettime();
+    cos->loop(cos->cr, cos->userdata);
+    long time_drawn = utils_gettime();
+    cairo_surface_flush(cos->surface);
+    long time_end = utils_gettime();
+
+    perf_stats_record(PERF_STAGE_CLEAR, time_cleared - time_start);
+    perf_stats_record(PERF_STAGE_LOOP, time_drawn - time_cleared);
+    perf_stats_record(PERF_STAGE_FLUSH, time_end - time_drawn);
+    perf_stats_record(PERF_STAGE_FRAME, time_end - time_frame);
+
+    return time_end - time_frame;
+}
+
+cairo_surface_t *
+cairo_offscreen_get_surface(cairo_offscreen_t *cos) {
+    ASSERT(cos != NULL);
+    return cos->surface;
+}
+
+void *
+cairo_offscreen_destroy(cairo_offscreen_t *cos) {
+    ASSERT(cos != NULL);
+
+    if (cos->started) {
+        cos->end(cos->cr, cos->userdata);
+    }
+
+    if (cos->bands != NULL) {
+        cairo_bands_destroy(cos->bands);
+    }
+    cairo_destroy(cos->cr);
+    cairo_surface_destroy(cos->surface);
+    free(cos);
+
+    return NULL;
+}
@@ -0,0 +1,61 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef CAIRO_OFFSCREEN_H_
+#define CAIRO_OFFSCREEN_H_
+
+#include <cairo/cairo.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Runs the same start/loop/end callbacks as cairo_mt, but synchronously on
+ * the calling thread, into a plain image surface. No window or GL context is
+ * needed, for benchmarks and image comparisons on headless machines.
+ */
+
+typedef struct cairo_offscreen cairo_offscreen_t;
+
+cairo_offscreen_t *
+cairo_offscreen_create(int width, int height);
+void
+cairo_offscreen_set_callbacks(cairo_offscreen_t *cos, void (*start)(cairo_t *cr, void *),
+    void (*loop)(cairo_t *cr, void *), void (*end)(cairo_t *cr, void *));
+/* Whether the surface is cleared to black before each loop call (default: true) */
+void
+cairo_offscreen_set_clear(cairo_offscreen_t *cos, bool clear);
+/* Same as cairo_mt_set_prepare */
+void
+cairo_offscreen_set_prepare(cairo_offscreen_t *cos, void (*prepare)(cairo_t *cr, void *));
+/*
+ * Same as cairo_mt_set_bands, but may also be changed between frames, e.g.
+ * to compare band counts on one surface.
+ */
+void
+cairo_offscreen_set_bands(cairo_offscreen_t *cos, unsigned bands);
+/* Calls start */
+void
+cairo_offscreen_start(cairo_offscreen_t *cos, void *userdata);
+/* Renders one frame, returns how long it took in nanoseconds */
+long
+cairo_offscreen_frame(cairo_offscreen_t *cos);
+/* Flushed ARGB32 surface holding the last frame, owned by cos */
+cairo_surface_t *
+cairo_offscreen_get_surface(cairo_offscreen_t *cos);
+/* Calls end if started */
+void *
+cairo_offscreen_destroy(cairo_offscreen_t *cos);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAIRO_OFFSCREEN_H_ */
@@ -0,0 +1,247 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "compositor.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <utils/log.h>
+
+#include "cairo_bands.h"
+
+/* The layer's rows under one band, written only by that band's thread */
+typedef struct compositor_band {
+    cairo_surface_t *surface;
+    cairo_t         *cr;
+    int              y;
+    int              h;
+} compositor_band_t;
+
+typedef struct compositor_layer {
+    cairo_surface_t  *surface;
+    cairo_t          *cr;
+    void (*draw)(cairo_t *cr, void *);
+    void             *udata;
+    /* Area to re-rasterize, empty while the layer is clean */
+    damage_t          dirty;
+    /* Area the current frame re-rasterizes, set by compositor_update */
+    damage_t          pending;
+    compositor_band_t bands[CAIRO_BANDS_MAX];
+} compositor_layer_t;
+
+struct compositor {
+    int                width;
+    int                height;
+
+    compositor_layer_t layers[COMPOSITOR_MAX_LAYERS];
+    int                layers_size;
+
+    pthread_mutex_t    mutex;
+};
+
+compositor_t *
+compositor_create(int width, int height) {
+    compositor_t *comp;
+
+    comp = malloc(sizeof(*comp));
+
+    comp->width = width;
+    comp->height = height;
+    comp->layers_size = 0;
+
+    pthread_mutex_init(&comp->mutex, NULL);
+
+    return comp;
+}
+
+int
+compositor_add_layer(compositor_t *comp, void (*draw)(cairo_t *cr, void *), void *udata) {
+    ASSERT(comp != NULL);
+    ASSERT(draw != NULL);
+    ASSERT(comp->layers_size < COMPOSITOR_MAX_LAYERS);
+
+    const int           id = comp->layers_size;
+    compositor_layer_t *layer = &comp->layers[id];
+
+    layer->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, comp->width, comp->height);
+    layer->cr = cairo_create(layer->surface);
+    layer->draw = draw;
+    layer->udata = udata;
+    damage_clear(&layer->dirty);
+    damage_add(&layer->dirty, 0, 0, comp->width, comp->height);
+    damage_clear(&layer->pending);
+    for (unsigned i = 0; i < CAIRO_BANDS_MAX; ++i) {
+        layer->bands[i].surface = NULL;
+        layer->bands[i].cr = NULL;
+    }
+
+    pthread_mutex_lock(&comp->mutex);
+    comp->layers_size += 1;
+    pthread_mutex_unlock(&comp->mutex);
+
+    return id;
+}
+
+void
+compositor_invalidate(compositor_t *comp, int layer) {
+    ASSERT(comp != NULL);
+    compositor_invalidate_rect(comp, layer, 0, 0, comp->width, comp->height);
+}
+
+void
+compositor_invalidate_rect(compositor_t *comp, int layer, int x, int y, int w, int h) {
+    ASSERT(comp != NULL);
+
+    pthread_mutex_lock(&comp->mutex);
+    ASSERT(layer >= 0 && layer < comp->layers_size);
+    damage_add(&comp->layers[layer].dirty, x, y, w, h);
+    pthread_mutex_unlock(&comp->mutex);
+}
+
+void
+compositor_invalidate_all(compositor_t *comp) {
+    ASSERT(comp != NULL);
+
+    for (int i = 0; i < comp->layers_size; ++i) {
+        compositor_invalidate(comp, i);
+    }
+}
+
+/* Redraws the layer, limited to the dirty rectangles */
+static void
+compositor_rasterize_layer(compositor_layer_t *layer, cairo_surface_t *surface, cairo_t *cr) {
+    const damage_t *dirty = &layer->pending;
+
+    /* Other surfaces over the same pixels may have drawn since */
+    cairo_surface_mark_dirty(surface);
+    cairo_save(cr);
+
+    for (unsigned i = 0; i < dirty->size; ++i) {
+        const damage_rect_t *r = &dirty->rects[i];
+        cairo_rectangle(cr, r->x, r->y, r->w, r->h);
+    }
+    cairo_clip(cr);
+
+    /* Start from a fully transparent layer */
+    cairo_save(cr);
+    cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint(cr);
+    cairo_restore(cr);
+
+    layer->draw(cr, layer->udata);
+    cairo_restore(cr);
+
+    cairo_surface_flush(surface);
+}
+
+/* Surface over the layer's rows of a band, made the first time the band paints */
+static compositor_band_t *
+compositor_layer_band(
+    compositor_t *comp, compositor_layer_t *layer, unsigned index, int y, int h) {
+    compositor_band_t *band = &layer->bands[index];
+    const int          stride = cairo_image_surface_get_stride(layer->surface);
+    unsigned char     *data = cairo_image_surface_get_data(layer->surface);
+
+    if (band->surface != NULL && band->y == y && band->h == h) {
+        return band;
+    }
+
+    if (band->surface != NULL) {
+        cairo_destroy(band->cr);
+        cairo_surface_destroy(band->surface);
+    }
+
+    band->surface = cairo_image_surface_create_for_data(
+        data + ((size_t)y * (size_t)stride), CAIRO_FORMAT_ARGB32, comp->width, h, stride);
+    cairo_surface_set_device_offset(band->surface, 0, -y);
+    band->cr = cairo_create(band->surface);
+    band->y = y;
+    band->h = h;
+
+    return band;
+}
+
+void
+compositor_update(compositor_t *comp, damage_t *damage) {
+    ASSERT(comp != NULL);
+
+    pthread_mutex_lock(&comp->mutex);
+    for (int i = 0; i < comp->layers_size; ++i) {
+        compositor_layer_t *layer = &comp->layers[i];
+
+        layer->pending = layer->dirty;
+        damage_clear(&layer->dirty);
+
+        if (damage != NULL) {
+            damage_union(damage, &layer->pending);
+        }
+    }
+    pthread_mutex_unlock(&comp->mutex);
+}
+
+void
+compositor_paint(compositor_t *comp, cairo_t *cr) {
+    ASSERT(comp != NULL);
+    ASSERT(cr != NULL);
+    unsigned band_index;
+    int      band_y, band_h;
+    const bool banded = cairo_bands_get_band(cr, &band_index, &band_y, &band_h);
+
+    for (int i = 0; i < comp->layers_size; ++i) {
+        compositor_layer_t *layer = &comp->layers[i];
+        cairo_surface_t    *surface = layer->surface;
+        cairo_t            *layer_cr = layer->cr;
+
+        if (banded) {
+            compositor_band_t *band =
+                compositor_layer_band(comp, layer, band_index, band_y, band_h);
+            surface = band->surface;
+            layer_cr = band->cr;
+        }
+
+        if (layer->pending.size > 0) {
+            compositor_rasterize_layer(layer, surface, layer_cr);
+        }
+
+        cairo_save(cr);
+        cairo_set_operator(cr, (i == 0) ? CAIRO_OPERATOR_SOURCE : CAIRO_OPERATOR_OVER);
+        cairo_set_source_surface(cr, surface, 0, 0);
+        cairo_paint(cr);
+        cairo_restore(cr);
+    }
+}
+
+void
+compositor_compose(compositor_t *comp, cairo_t *cr, damage_t *damage) {
+    compositor_update(comp, damage);
+    compositor_paint(comp, cr);
+}
+
+void *
+compositor_destroy(compositor_t *comp) {
+    ASSERT(comp != NULL);
+
+    for (int i = 0; i < comp->layers_size; ++i) {
+        compositor_layer_t *layer = &comp->layers[i];
+
+        for (unsigned j = 0; j < CAIRO_BANDS_MAX; ++j) {
+            if (layer->bands[j].surface != NULL) {
+                cairo_destroy(layer->bands[j].cr);
+                cairo_surface_destroy(layer->bands[j].surface);
+            }
+        }
+        cairo_destroy(layer->cr);
+        cairo_surface_destroy(layer->surface);
+    }
+
+    pthread_mutex_destroy(&comp->mutex);
+    free(comp);
+
+    return NULL;
+}
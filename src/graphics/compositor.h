@@ -0,0 +1,62 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef COMPOSITOR_H_
+#define COMPOSITOR_H_
+
+#include <cairo/cairo.h>
+
+#include "damage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define COMPOSITOR_MAX_LAYERS 8
+
+typedef struct compositor compositor_t;
+
+compositor_t *
+compositor_create(int width, int height);
+/*
+ * Layers are composited in the order they're added, the first one replaces
+ * whatever is on the target. Returns the layer id.
+ */
+int
+compositor_add_layer(compositor_t *comp, void (*draw)(cairo_t *cr, void *), void *udata);
+/* Thread-safe, the layer (or part of it) is re-rasterized on the next compose */
+void
+compositor_invalidate(compositor_t *comp, int layer);
+void
+compositor_invalidate_rect(compositor_t *comp, int layer, int x, int y, int w, int h);
+void
+compositor_invalidate_all(compositor_t *comp);
+/*
+ * Takes every layer's dirty area for the following compositor_paint calls
+ * and adds it to damage, if given.
+ */
+void
+compositor_update(compositor_t *comp, damage_t *damage);
+/*
+ * Redraws what the last update took and composites every layer onto cr.
+ * When cr is a cairo_bands band only its rows are redrawn, so bands may
+ * paint concurrently, as long as the draw callbacks only read shared state.
+ */
+void
+compositor_paint(compositor_t *comp, cairo_t *cr);
+/* Update and paint in one, for a single cairo_t */
+void
+compositor_compose(compositor_t *comp, cairo_t *cr, damage_t *damage);
+void *
+compositor_destroy(compositor_t *comp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPOSITOR_H_ */
@@ -0,0 +1,136 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "damage.h"
+
+#include <stdbool.h>
+#include <utils/log.h>
+
+#define DAMAGE_MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define DAMAGE_MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+static damage_rect_t
+damage_rect_bounds(damage_rect_t a, damage_rect_t b) {
+    damage_rect_t r;
+
+    r.x = DAMAGE_MIN(a.x, b.x);
+    r.y = DAMAGE_MIN(a.y, b.y);
+    r.w = DAMAGE_MAX(a.x + a.w, b.x + b.w) - r.x;
+    r.h = DAMAGE_MAX(a.y + a.h, b.y + b.h) - r.y;
+
+    return r;
+}
+
+/* Overlapping or sharing an edge */
+static bool
+damage_rect_touches(damage_rect_t a, damage_rect_t b) {
+    return (a.x <= b.x + b.w) && (b.x <= a.x + a.w) && (a.y <= b.y + b.h) && (b.y <= a.y + a.h);
+}
+
+static long
+damage_rect_area(damage_rect_t r) {
+    return (long)r.w * r.h;
+}
+
+static void
+damage_remove(damage_t *dmg, unsigned index) {
+    ASSERT(index < dmg->size);
+    dmg->size -= 1;
+    dmg->rects[index] = dmg->rects[dmg->size];
+}
+
+void
+damage_clear(damage_t *dmg) {
+    ASSERT(dmg != NULL);
+    dmg->size = 0;
+}
+
+void
+damage_add(damage_t *dmg, int x, int y, int w, int h) {
+    ASSERT(dmg != NULL);
+    damage_rect_t r = {.x = x, .y = y, .w = w, .h = h};
+    bool          merged = true;
+
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+
+    /* Growing r can make it touch rects it missed before, so repeat until stable */
+    while (merged) {
+        merged = false;
+
+        for (unsigned i = 0; i < dmg->size; ++i) {
+            if (damage_rect_touches(r, dmg->rects[i])) {
+                r = damage_rect_bounds(r, dmg->rects[i]);
+                damage_remove(dmg, i);
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    if (dmg->size == DAMAGE_MAX_RECTS) {
+        unsigned best = 0;
+        long     best_growth = -1;
+
+        for (unsigned i = 0; i < dmg->size; ++i) {
+            const long growth = damage_rect_area(damage_rect_bounds(r, dmg->rects[i])) -
+                                damage_rect_area(dmg->rects[i]);
+
+            if (best_growth < 0 || growth < best_growth) {
+                best = i;
+                best_growth = growth;
+            }
+        }
+
+        r = damage_rect_bounds(r, dmg->rects[best]);
+        damage_remove(dmg, best);
+        /* The bigger rect may now touch others */
+        damage_add(dmg, r.x, r.y, r.w, r.h);
+        return;
+    }
+
+    dmg->rects[dmg->size] = r;
+    dmg->size += 1;
+}
+
+void
+damage_union(damage_t *dmg, const damage_t *other) {
+    ASSERT(dmg != NULL);
+    ASSERT(other != NULL);
+
+    for (unsigned i = 0; i < other->size; ++i) {
+        const damage_rect_t *r = &other->rects[i];
+        damage_add(dmg, r->x, r->y, r->w, r->h);
+    }
+}
+
+void
+damage_clip(damage_t *dmg, int w, int h) {
+    ASSERT(dmg != NULL);
+    unsigned i = 0;
+
+    while (i < dmg->size) {
+        damage_rect_t *r = &dmg->rects[i];
+        const int      x1 = DAMAGE_MAX(r->x, 0);
+        const int      y1 = DAMAGE_MAX(r->y, 0);
+        const int      x2 = DAMAGE_MIN(r->x + r->w, w);
+        const int      y2 = DAMAGE_MIN(r->y + r->h, h);
+
+        if (x2 <= x1 || y2 <= y1) {
+            damage_remove(dmg, i);
+            continue;
+        }
+
+        r->x = x1;
+        r->y = y1;
+        r->w = x2 - x1;
+        r->h = y2 - y1;
+        ++i;
+    }
+}
@@ -0,0 +1,49 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef DAMAGE_H_
+#define DAMAGE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DAMAGE_MAX_RECTS 8
+
+typedef struct damage_rect {
+    int x;
+    int y;
+    int w;
+    int h;
+} damage_rect_t;
+
+/*
+ * Set of damaged rectangles, kept disjoint. Overlapping or touching rectangles
+ * are merged into their bounding box, and once DAMAGE_MAX_RECTS is reached
+ * a new rectangle is merged wherever it grows the total area the least.
+ */
+typedef struct damage {
+    damage_rect_t rects[DAMAGE_MAX_RECTS];
+    unsigned      size;
+} damage_t;
+
+void
+damage_clear(damage_t *dmg);
+void
+damage_add(damage_t *dmg, int x, int y, int w, int h);
+void
+damage_union(damage_t *dmg, const damage_t *other);
+/* Clamps every rectangle to [0, w) x [0, h), dropping empty ones */
+void
+damage_clip(damage_t *dmg, int w, int h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DAMAGE_H_ */
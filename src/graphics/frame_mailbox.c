@@ -0,0 +1,95 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "frame_mailbox.h"
+
+#include <utils/log.h>
+
+#define FRAME_MAILBOX_SLOT_MASK 0x3u
+#define FRAME_MAILBOX_FRESH_BIT 0x4u
+
+void
+frame_mailbox_init(frame_mailbox_t *mb, int width, int height) {
+    ASSERT(mb != NULL);
+
+    mb->width = width;
+    mb->height = height;
+    for (unsigned i = 0; i < FRAME_MAILBOX_SLOTS; ++i) {
+        damage_clear(&mb->damage[i]);
+    }
+
+    mb->back = 0;
+    mb->mailbox = 1;
+    mb->front = 2;
+    damage_clear(&mb->published_damage);
+}
+
+unsigned
+frame_mailbox_get_back(const frame_mailbox_t *mb) {
+    ASSERT(mb != NULL);
+    return mb->back;
+}
+
+void
+frame_mailbox_publish(frame_mailbox_t *mb, const damage_t *damage) {
+    ASSERT(mb != NULL);
+    damage_t *slot_damage = &mb->damage[mb->back];
+    unsigned  prev;
+
+    if (damage != NULL) {
+        *slot_damage = *damage;
+    } else {
+        damage_clear(slot_damage);
+        damage_add(slot_damage, 0, 0, mb->width, mb->height);
+    }
+
+    /*
+     * An unseen frame in the mailbox is about to be replaced, so its damage has
+     * to go out with this one. Only this thread sets the fresh bit, if it's
+     * clear the last frame was taken for sure.
+     */
+    if (__atomic_load_n(&mb->mailbox, __ATOMIC_ACQUIRE) & FRAME_MAILBOX_FRESH_BIT) {
+        damage_union(slot_damage, &mb->published_damage);
+    }
+    mb->published_damage = *slot_damage;
+
+    prev = __atomic_exchange_n(
+        &mb->mailbox, mb->back | FRAME_MAILBOX_FRESH_BIT, __ATOMIC_ACQ_REL);
+    mb->back = prev & FRAME_MAILBOX_SLOT_MASK;
+}
+
+bool
+frame_mailbox_pending(const frame_mailbox_t *mb) {
+    ASSERT(mb != NULL);
+    /* Only the consumer clears the fresh bit, so it can't go away before the take */
+    return (__atomic_load_n(&mb->mailbox, __ATOMIC_ACQUIRE) & FRAME_MAILBOX_FRESH_BIT) != 0;
+}
+
+unsigned
+frame_mailbox_take(frame_mailbox_t *mb) {
+    ASSERT(mb != NULL);
+    ASSERT(frame_mailbox_pending(mb));
+    unsigned prev;
+
+    prev = __atomic_exchange_n(&mb->mailbox, mb->front, __ATOMIC_ACQ_REL);
+    mb->front = prev & FRAME_MAILBOX_SLOT_MASK;
+
+    return mb->front;
+}
+
+unsigned
+frame_mailbox_get_front(const frame_mailbox_t *mb) {
+    ASSERT(mb != NULL);
+    return mb->front;
+}
+
+damage_t *
+frame_mailbox_get_front_damage(frame_mailbox_t *mb) {
+    ASSERT(mb != NULL);
+    return &mb->damage[mb->front];
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef FRAME_MAILBOX_H_
+#define FRAME_MAILBOX_H_
+
+#include <stdbool.h>
+
+#include "damage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_MAILBOX_SLOTS 3
+
+/*
+ * Triple buffered mailbox between one producer and one consumer thread,
+ * handing out slot indices only, whatever the slots hold is up to the user.
+ * The producer owns the back slot, the consumer owns the front slot and the
+ * third slot sits in the mailbox. Publishing swaps the back slot into the
+ * mailbox, taking swaps the front slot with it, so neither side ever waits on
+ * the other. An unseen frame in the mailbox is replaced by a newer one, which
+ * then carries the unseen frame's damage too.
+ */
+typedef struct frame_mailbox {
+    int      width;
+    int      height;
+    damage_t damage[FRAME_MAILBOX_SLOTS];
+
+    /* Producer only */
+    unsigned back;
+    damage_t published_damage;
+    /* Consumer only */
+    unsigned front;
+    /* Slot index in the mailbox, with a flag while it holds an unseen frame */
+    unsigned mailbox;
+} frame_mailbox_t;
+
+void
+frame_mailbox_init(frame_mailbox_t *mb, int width, int height);
+/* Producer side */
+unsigned
+frame_mailbox_get_back(const frame_mailbox_t *mb);
+/* Only the damaged area changed since the last frame, NULL means the whole frame */
+void
+frame_mailbox_publish(frame_mailbox_t *mb, const damage_t *damage);
+/* Consumer side, whether there is a frame the consumer hasn't taken yet */
+bool
+frame_mailbox_pending(const frame_mailbox_t *mb);
+/*
+ * Hands the front slot over to the producer and returns the newest frame's
+ * slot, the new front. Only call once frame_mailbox_pending was true, and
+ * after the old front slot is ready to be written again.
+ */
+unsigned
+frame_mailbox_take(frame_mailbox_t *mb);
+unsigned
+frame_mailbox_get_front(const frame_mailbox_t *mb);
+/* Area of the front slot that changed since the last frame taken */
+damage_t *
+frame_mailbox_get_front_damage(frame_mailbox_t *mb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_MAILBOX_H_ */
@@ -8,134 +8,244 @@
 
 #include "gl_pbo.h"
 
-#include <pthread.h>
 #include <stdbool.h>
 #include <utils/log.h>
+#include <utils/utils.h>
+
+/*
+ * Frames rotate through the slots of a frame_mailbox_t, between the render
+ * thread (producer) and the GL thread (consumer).
+ *
+ * With ARB_buffer_storage every slot is mapped once, persistently. A slot
+ * going back to the producer is then guarded by a fence placed after its
+ * upload instead of being orphaned and re-mapped.
+ */
+
+#define GL_PBO_PERSISTENT_FLAGS \
+    (GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+#define GL_PBO_FENCE_TIMEOUT 1000000000 /* Nanoseconds */
+
+typedef struct pbo_slot {
+    GLuint buf;
+    /* Mapped address, NULL while the slot is unmapped */
+    void  *ptr;
+    /* Persistent path, signaled once the GPU is done reading the slot */
+    GLsync fence;
+} pbo_slot_t;
 
 struct pbo_hdlr {
-    GLsizei width;
-    GLsizei height;
-    void   *cur_buffer_handle;
-    GLuint  pbo_bufs[2];
-
-    struct {
-        GLuint back_buf_index;
-        GLuint front_buf_index;
-        bool   back_buffer_ready;
-        bool   back_buffer_done;
-    } mt;
-
-    pthread_mutex_t mutex;
+    GLsizei         width;
+    GLsizei         height;
+    pbo_slot_t      slots[GL_PBO_SLOTS];
+    frame_mailbox_t mailbox;
+    bool            persistent;
+    long            upload_time;
+
+    /* GL thread only */
+    bool            tex_valid;
 };
 
+/* Orphans the slot's storage and maps it, GL thread only */
+static void
+gl_pbo_map_slot(pbo_hdlr_t *pbo, unsigned index) {
+    pbo_slot_t *slot = &pbo->slots[index];
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buf);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, pbo->width * pbo->height * 4, NULL, GL_DYNAMIC_DRAW);
+    /* Cairo renders in place and blends against what it has drawn, so it reads too */
+    slot->ptr = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_READ_WRITE);
+    ASSERT(slot->ptr != NULL);
+}
+
+static void
+gl_pbo_storage_slot(pbo_hdlr_t *pbo, unsigned index) {
+    pbo_slot_t      *slot = &pbo->slots[index];
+    const GLsizeiptr size = (GLsizeiptr)pbo->width * pbo->height * 4;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buf);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_PBO_PERSISTENT_FLAGS);
+    slot->ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_PBO_PERSISTENT_FLAGS);
+    ASSERT(slot->ptr != NULL);
+}
+
+/* Blocks until the GPU has finished uploading from the slot */
+static void
+gl_pbo_wait_slot(pbo_hdlr_t *pbo, unsigned index) {
+    pbo_slot_t *slot = &pbo->slots[index];
+    GLenum      res;
+
+    if (slot->fence == NULL) {
+        return;
+    }
+
+    do {
+        res = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_PBO_FENCE_TIMEOUT);
+    } while (res == GL_TIMEOUT_EXPIRED);
+
+    if (res == GL_WAIT_FAILED) {
+        log_err("glClientWaitSync failed on PBO slot %u", index);
+    }
+
+    glDeleteSync(slot->fence);
+    slot->fence = NULL;
+}
+
+/* Uploads only the damaged parts of the bound PBO, or everything the first time */
+static void
+gl_pbo_upload(pbo_hdlr_t *pbo, damage_t *damage) {
+    if (!pbo->tex_valid) {
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0, 0, 0, pbo->width, pbo->height, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+        pbo->tex_valid = true;
+        return;
+    }
+
+    damage_clip(damage, pbo->width, pbo->height);
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, pbo->width);
+
+    for (unsigned i = 0; i < damage->size; ++i) {
+        const damage_rect_t *r = &damage->rects[i];
+
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, r->x);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, r->y);
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0, r->x, r->y, r->w, r->h, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    }
+
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
 pbo_hdlr_t *
 gl_pbo_create(GLsizei width, GLsizei height) {
     pbo_hdlr_t *pbo;
+    GLuint      bufs[GL_PBO_SLOTS];
 
     pbo = malloc(sizeof(*pbo));
 
     pbo->width = width;
     pbo->height = height;
 
-    glGenBuffers(2, pbo->pbo_bufs);
+    glGenBuffers(GL_PBO_SLOTS, bufs);
 
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->pbo_bufs[0]);
-    glBufferData(GL_PIXEL_UNPACK_BUFFER, width * height * 4, NULL, GL_DYNAMIC_DRAW);
+    for (unsigned i = 0; i < GL_PBO_SLOTS; ++i) {
+        pbo->slots[i].buf = bufs[i];
+        pbo->slots[i].ptr = NULL;
+        pbo->slots[i].fence = NULL;
+    }
 
-    pbo->cur_buffer_handle = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-    pbo->mt.back_buf_index = 0;
-    pbo->mt.front_buf_index = 1;
-    pbo->mt.back_buffer_ready = true;
-    pbo->mt.back_buffer_done = false;
+    frame_mailbox_init(&pbo->mailbox, width, height);
+    pbo->persistent = (GLEW_ARB_buffer_storage && GLEW_ARB_sync);
+    pbo->upload_time = 0;
+    pbo->tex_valid = false;
+
+    if (pbo->persistent) {
+        for (unsigned i = 0; i < GL_PBO_SLOTS; ++i) {
+            gl_pbo_storage_slot(pbo, i);
+        }
+    } else {
+        /* Back and mailbox slots must be writable, the front slot is mapped when swapped out */
+        const unsigned front = frame_mailbox_get_front(&pbo->mailbox);
+
+        for (unsigned i = 0; i < GL_PBO_SLOTS; ++i) {
+            if (i != front) {
+                gl_pbo_map_slot(pbo, i);
+            }
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->slots[front].buf);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, width * height * 4, NULL, GL_DYNAMIC_DRAW);
+    }
 
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->pbo_bufs[1]);
-    glBufferData(GL_PIXEL_UNPACK_BUFFER, width * height * 4, NULL, GL_DYNAMIC_DRAW);
+    log_msg("PBO streaming: %s", pbo->persistent ? "persistent mapped" : "orphan & map");
 
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
 
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-    pthread_mutex_init(&pbo->mutex, NULL);
-
     return pbo;
 }
 
+unsigned
+gl_pbo_get_back_slot(const pbo_hdlr_t *pbo) {
+    ASSERT(pbo != NULL);
+    return frame_mailbox_get_back(&pbo->mailbox);
+}
+
 void *
 gl_pbo_get_back_buffer(pbo_hdlr_t *pbo) {
     ASSERT(pbo != NULL);
-    void *buf_ret = NULL;
-
-    pthread_mutex_lock(&pbo->mutex);
-    if (pbo->mt.back_buffer_ready) {
-        buf_ret = pbo->cur_buffer_handle;
-    }
-    pthread_mutex_unlock(&pbo->mutex);
-
-    return buf_ret;
+    return pbo->slots[frame_mailbox_get_back(&pbo->mailbox)].ptr;
 }
 
 void
-gl_pbo_finish_back_buffer(pbo_hdlr_t *pbo) {
+gl_pbo_finish_back_buffer(pbo_hdlr_t *pbo, const damage_t *damage) {
     ASSERT(pbo != NULL);
-    pthread_mutex_lock(&pbo->mutex);
-    pbo->mt.back_buffer_done = true;
-    pbo->mt.back_buffer_ready = false;
-    pthread_mutex_unlock(&pbo->mutex);
+    frame_mailbox_publish(&pbo->mailbox, damage);
 }
 
-void
+bool
 gl_pbo_bind_front_buffer(pbo_hdlr_t *pbo) {
     ASSERT(pbo != NULL);
+    unsigned front;
 
-    bool   us_back_buf_done;
-    bool   us_back_buf_ready;
-    GLuint us_back_index;
-    GLuint us_front_index;
-
-    pthread_mutex_lock(&pbo->mutex);
-    us_back_buf_done = pbo->mt.back_buffer_done;
-    us_back_buf_ready = pbo->mt.back_buffer_ready;
-    us_back_index = pbo->mt.back_buf_index;
-    us_front_index = pbo->mt.front_buf_index;
-    pthread_mutex_unlock(&pbo->mutex);
+    if (!frame_mailbox_pending(&pbo->mailbox)) {
+        return false;
+    }
 
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->pbo_bufs[us_front_index]);
+    long time_start = utils_gettime();
 
-    if (us_back_buf_done) {
-        glTexSubImage2D(
-            GL_TEXTURE_2D, 0, 0, 0, pbo->width, pbo->height, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+    /* The old front slot must be writable before the producer can get hold of it */
+    front = frame_mailbox_get_front(&pbo->mailbox);
+    if (pbo->persistent) {
+        gl_pbo_wait_slot(pbo, front);
+    } else {
+        gl_pbo_map_slot(pbo, front);
+    }
 
-        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->pbo_bufs[us_back_index]);
-        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    front = frame_mailbox_take(&pbo->mailbox);
 
-        us_back_index = (us_back_index + 1) % 2;
-        us_front_index = (us_front_index + 1) % 2;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->slots[front].buf);
 
-        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->pbo_bufs[us_back_index]);
-        glBufferData(GL_PIXEL_UNPACK_BUFFER, pbo->width * pbo->height * 4, NULL, GL_DYNAMIC_DRAW);
-        pbo->cur_buffer_handle = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (!pbo->persistent) {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        pbo->slots[front].ptr = NULL;
+    }
 
-        us_back_buf_done = false;
-        us_back_buf_ready = true;
+    gl_pbo_upload(pbo, frame_mailbox_get_front_damage(&pbo->mailbox));
 
-        pthread_mutex_lock(&pbo->mutex);
-        pbo->mt.back_buffer_done = us_back_buf_done;
-        pbo->mt.back_buffer_ready = us_back_buf_ready;
-        pbo->mt.back_buf_index = us_back_index;
-        pbo->mt.front_buf_index = us_front_index;
-        pthread_mutex_unlock(&pbo->mutex);
+    if (pbo->persistent) {
+        pbo->slots[front].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
     }
 
     glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    pbo->upload_time = utils_gettime() - time_start;
+
+    return true;
+}
+
+long
+gl_pbo_get_upload_time(const pbo_hdlr_t *pbo) {
+    ASSERT(pbo != NULL);
+    return pbo->upload_time;
 }
 
 void *
 gl_pbo_destroy(pbo_hdlr_t *pbo) {
     ASSERT(pbo != NULL);
-    glDeleteBuffers(2, pbo->pbo_bufs);
-    pbo->cur_buffer_handle = NULL;
-    pthread_mutex_destroy(&pbo->mutex);
+
+    for (unsigned i = 0; i < GL_PBO_SLOTS; ++i) {
+        if (pbo->slots[i].fence != NULL) {
+            glDeleteSync(pbo->slots[i].fence);
+        }
+        glDeleteBuffers(1, &pbo->slots[i].buf);
+        pbo->slots[i].ptr = NULL;
+    }
+
     free(pbo);
 
     return NULL;
-}
\ No newline at end of file
+}
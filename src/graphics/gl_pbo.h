@@ -10,21 +10,39 @@
 #define GL_PBO_H_
 
 #include <GL/glew.h>
+#include <stdbool.h>
+
+#include "damage.h"
+#include "frame_mailbox.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Buffers frames rotate through, see frame_mailbox.h */
+#define GL_PBO_SLOTS FRAME_MAILBOX_SLOTS
+
 typedef struct pbo_hdlr pbo_hdlr_t;
 
 pbo_hdlr_t *
 gl_pbo_create(GLsizei width, GLsizei height);
+/*
+ * Which of the slots the back buffer is. A slot's buffer only moves when
+ * PBOs can't be mapped persistently, then it does every time it comes back.
+ */
+unsigned
+gl_pbo_get_back_slot(const pbo_hdlr_t *pbo);
 void *
 gl_pbo_get_back_buffer(pbo_hdlr_t *pbo);
+/* Only the damaged area is uploaded, NULL means the whole frame */
 void
-gl_pbo_finish_back_buffer(pbo_hdlr_t *pbo);
-void
+gl_pbo_finish_back_buffer(pbo_hdlr_t *pbo, const damage_t *damage);
+/* Uploads the newest finished frame, if any, returns whether there was one */
+bool
 gl_pbo_bind_front_buffer(pbo_hdlr_t *pbo);
+/* CPU time (ns) the last gl_pbo_bind_front_buffer spent taking and uploading a frame */
+long
+gl_pbo_get_upload_time(const pbo_hdlr_t *pbo);
 void *
 gl_pbo_destroy(pbo_hdlr_t *pbo);
 #ifdef __cplusplus
@@ -0,0 +1,126 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "input_queue.h"
+
+#include <utils/log.h>
+#include <utils/ts_queue.h>
+
+struct input_queue {
+    ts_queue_t    *events;
+
+    /* Producer only, events [backlog_head, backlog_size) are waiting for room in the queue */
+    input_event_t *backlog;
+    size_t         backlog_head;
+    size_t         backlog_size;
+    size_t         backlog_capacity;
+};
+
+input_queue_t *
+input_queue_create() {
+    input_queue_t *q;
+
+    q = calloc(1, sizeof(*q));
+    q->events = ts_queue_create(sizeof(input_event_t), INPUT_QUEUE_SIZE, TS_QUEUE_SPSC);
+
+    return q;
+}
+
+/* Merges b into a when a consumer would see no difference */
+static bool
+input_queue_coalesce(input_event_t *a, const input_event_t *b) {
+    if (a->type != b->type) {
+        return false;
+    }
+
+    switch (a->type) {
+        case INPUT_EVENT_MOVE:
+            a->x = b->x;
+            a->y = b->y;
+            return true;
+        case INPUT_EVENT_SCROLL:
+            a->scroll += b->scroll;
+            return true;
+        case INPUT_EVENT_BUTTON:
+            return false;
+    }
+
+    return false;
+}
+
+bool
+input_queue_flush(input_queue_t *q) {
+    ASSERT(q != NULL);
+    const size_t moved = ts_queue_push_n(
+        q->events, q->backlog + q->backlog_head, q->backlog_size - q->backlog_head);
+
+    q->backlog_head += moved;
+    if (q->backlog_head == q->backlog_size) {
+        q->backlog_head = q->backlog_size = 0;
+    }
+
+    return moved > 0;
+}
+
+void
+input_queue_push(input_queue_t *q, const input_event_t *event) {
+    ASSERT(q != NULL);
+    ASSERT(event != NULL);
+
+    /* Older events go first */
+    if (q->backlog_size > 0) {
+        input_queue_flush(q);
+    }
+
+    if (q->backlog_size == 0 && ts_queue_push(q->events, event) == 0) {
+        return;
+    }
+
+    /* Only when the consumer stalls, so the backlog stays off the common path */
+    if (q->backlog_size > q->backlog_head &&
+        input_queue_coalesce(&q->backlog[q->backlog_size - 1], event)) {
+        return;
+    }
+
+    if (q->backlog_size == q->backlog_capacity) {
+        q->backlog_capacity = (q->backlog_capacity == 0) ? 16 : (q->backlog_capacity * 2);
+        q->backlog = realloc(q->backlog, sizeof(*q->backlog) * q->backlog_capacity);
+    }
+
+    q->backlog[q->backlog_size] = *event;
+    q->backlog_size += 1;
+}
+
+size_t
+input_queue_drain(input_queue_t *q, input_event_t *out) {
+    ASSERT(q != NULL);
+    ASSERT(out != NULL);
+    const size_t events_size = ts_queue_pop_n(q->events, out, INPUT_QUEUE_SIZE);
+    size_t       out_size = 0;
+
+    /* Coalesced in place, out_size never passes i */
+    for (size_t i = 0; i < events_size; ++i) {
+        if (out_size > 0 && input_queue_coalesce(&out[out_size - 1], &out[i])) {
+            continue;
+        }
+
+        out[out_size] = out[i];
+        out_size += 1;
+    }
+
+    return out_size;
+}
+
+void *
+input_queue_destroy(input_queue_t *q) {
+    ASSERT(q != NULL);
+    q->events = ts_queue_destroy(q->events);
+    free(q->backlog);
+    free(q);
+    return NULL;
+}
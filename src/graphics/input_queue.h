@@ -0,0 +1,65 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INPUT_QUEUE_H_
+#define INPUT_QUEUE_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Lock-free queue of input events from the window (main) thread to the
+ * render thread. Push from a single producer, drain from a single consumer at
+ * a time.
+ */
+
+#define INPUT_QUEUE_SIZE 256
+
+typedef enum input_event_type {
+    INPUT_EVENT_MOVE,
+    INPUT_EVENT_BUTTON,
+    INPUT_EVENT_SCROLL
+} input_event_type_t;
+
+typedef struct input_event {
+    input_event_type_t type;
+    double             x;      /* INPUT_EVENT_MOVE */
+    double             y;      /* INPUT_EVENT_MOVE */
+    bool               down;   /* INPUT_EVENT_BUTTON */
+    int                scroll; /* INPUT_EVENT_SCROLL */
+} input_event_t;
+
+typedef struct input_queue input_queue_t;
+
+input_queue_t *
+input_queue_create();
+/* Producer only, never blocks or drops, events that don't fit wait for the next push or flush */
+void
+input_queue_push(input_queue_t *q, const input_event_t *event);
+/* Producer only, retries events that didn't fit into the queue, returns whether any moved */
+bool
+input_queue_flush(input_queue_t *q);
+/*
+ * Consumer only, takes every queued event in order, consecutive moves merged
+ * into the last one and consecutive scrolls summed. out must fit
+ * INPUT_QUEUE_SIZE events, returns the number written.
+ */
+size_t
+input_queue_drain(input_queue_t *q, input_event_t *out);
+void *
+input_queue_destroy(input_queue_t *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INPUT_QUEUE_H_ */
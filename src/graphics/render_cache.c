@@ -0,0 +1,446 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "render_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utils/log.h>
+#include <utils/utils.h>
+#include <utils/vec.h>
+
+#define RENDER_CACHE_MAGIC       "GAMRC001"
+/* Header is padded to this, which keeps the mapped rows 16-byte aligned */
+#define RENDER_CACHE_DATA_OFFSET 64
+#define RENDER_CACHE_EXT         ".img"
+#define RENDER_CACHE_TMP         ".tmp."
+/* Temporaries untouched this long were left by a store that died, in seconds */
+#define RENDER_CACHE_TMP_AGE     60
+/* 32 hex digits and the extension */
+#define RENDER_CACHE_NAME_LEN    (32 + sizeof(RENDER_CACHE_EXT) - 1)
+/* Eviction goes down to this share of the budget, so it doesn't run on every store */
+#define RENDER_CACHE_LOW_WATER   0.75
+
+typedef struct render_cache_header {
+    char     magic[8];
+    uint64_t key[2];
+    int32_t  width;
+    int32_t  height;
+    int32_t  stride;
+} render_cache_header_t;
+
+typedef struct render_cache_entry {
+    char   name[RENDER_CACHE_NAME_LEN + 1];
+    size_t size;
+    time_t mtime;
+    long   mtime_ns;
+} render_cache_entry_t;
+
+VECTOR_DEFINE(vector_entry, render_cache_entry_t)
+
+struct render_cache {
+    char  *dir;
+    size_t budget;
+
+    /* Guards total and eviction */
+    pthread_mutex_t lock;
+    size_t          total;
+
+    /* Unique temporary names for concurrent stores */
+    unsigned long tmp_counter;
+};
+
+void
+render_cache_key_init(render_cache_key_t *key) {
+    ASSERT(key != NULL);
+    key->h[0] = 0xcbf29ce484222325ULL;
+    key->h[1] = 0x6a09e667f3bcc909ULL;
+}
+
+/* Two independent lanes, FNV-1a and a multiply-rotate one */
+void
+render_cache_key_add(render_cache_key_t *key, const void *data, size_t size) {
+    ASSERT(key != NULL);
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t             h0 = key->h[0], h1 = key->h[1];
+
+    for (size_t i = 0; i < size; ++i) {
+        h0 = (h0 ^ p[i]) * 0x100000001b3ULL;
+        h1 = (h1 + p[i]) * 0x9e3779b97f4a7c15ULL;
+        h1 = (h1 << 31) | (h1 >> 33);
+    }
+
+    key->h[0] = h0;
+    key->h[1] = h1;
+}
+
+void
+render_cache_key_add_long(render_cache_key_t *key, long value) {
+    render_cache_key_add(key, &value, sizeof(value));
+}
+
+void
+render_cache_key_add_double(render_cache_key_t *key, double value) {
+    /* -0.0 and 0.0 render the same */
+    if (value == 0.0) {
+        value = 0.0;
+    }
+    render_cache_key_add(key, &value, sizeof(value));
+}
+
+void
+render_cache_key_add_str(render_cache_key_t *key, const char *str) {
+    render_cache_key_add(key, str, strlen(str));
+}
+
+/* splitmix64 finalizer, spreads the last bytes over the whole name */
+static uint64_t
+render_cache_mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static void
+render_cache_name(const render_cache_key_t *key, char *buf) {
+    snprintf(buf, RENDER_CACHE_NAME_LEN + 1, "%016llx%016llx" RENDER_CACHE_EXT,
+        (unsigned long long)render_cache_mix(key->h[0]),
+        (unsigned long long)render_cache_mix(key->h[1] ^ key->h[0]));
+}
+
+static bool
+render_cache_is_entry(const char *name) {
+    return strlen(name) == RENDER_CACHE_NAME_LEN &&
+           strcmp(name + RENDER_CACHE_NAME_LEN - strlen(RENDER_CACHE_EXT), RENDER_CACHE_EXT) == 0;
+}
+
+/* An entry's name followed by the temporary suffix render_cache_put writes to */
+static bool
+render_cache_is_tmp(const char *name) {
+    return strlen(name) > RENDER_CACHE_NAME_LEN &&
+           strncmp(name + RENDER_CACHE_NAME_LEN, RENDER_CACHE_TMP, strlen(RENDER_CACHE_TMP)) == 0 &&
+           strncmp(name + RENDER_CACHE_NAME_LEN - strlen(RENDER_CACHE_EXT), RENDER_CACHE_EXT,
+               strlen(RENDER_CACHE_EXT)) == 0;
+}
+
+/*
+ * Every entry in the directory, also sums their sizes into total. Stale
+ * temporaries from crashed stores are removed on the way.
+ */
+static void
+render_cache_scan(const render_cache_t *rc, vector_entry_t *entries, size_t *total) {
+    DIR           *dp;
+    struct dirent *de;
+    char           path[4096];
+    const time_t   now = time(NULL);
+
+    *total = 0;
+    dp = opendir(rc->dir);
+    if (dp == NULL) {
+        return;
+    }
+
+    while ((de = readdir(dp)) != NULL) {
+        render_cache_entry_t entry;
+        struct stat          st;
+        const bool           is_tmp = !render_cache_is_entry(de->d_name);
+
+        if (is_tmp && !render_cache_is_tmp(de->d_name)) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s", rc->dir, de->d_name);
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+
+        /* Younger ones may still be written by another thread or process */
+        if (is_tmp) {
+            if (now - st.st_mtim.tv_sec > RENDER_CACHE_TMP_AGE) {
+                unlink(path);
+            }
+            continue;
+        }
+
+        strcpy(entry.name, de->d_name);
+        entry.size = (size_t)st.st_size;
+        entry.mtime = st.st_mtim.tv_sec;
+        entry.mtime_ns = st.st_mtim.tv_nsec;
+        *total += entry.size;
+
+        if (entries != NULL) {
+            vector_entry_push(entries, entry);
+        }
+    }
+
+    closedir(dp);
+}
+
+static int
+render_cache_entry_cmp(const void *a, const void *b) {
+    const render_cache_entry_t *ea = (const render_cache_entry_t *)a;
+    const render_cache_entry_t *eb = (const render_cache_entry_t *)b;
+
+    if (ea->mtime != eb->mtime) {
+        return ea->mtime < eb->mtime ? -1 : 1;
+    }
+    if (ea->mtime_ns != eb->mtime_ns) {
+        return ea->mtime_ns < eb->mtime_ns ? -1 : 1;
+    }
+    return strcmp(ea->name, eb->name);
+}
+
+/*
+ * Deletes the least recently used entries (hits touch the mtime) until the
+ * directory is under the low water mark. Rescans, so entries stored by
+ * other processes are accounted for too. Called with the lock held.
+ */
+static void
+render_cache_evict(render_cache_t *rc) {
+    const size_t          target = (size_t)((double)rc->budget * RENDER_CACHE_LOW_WATER);
+    vector_entry_t        entries;
+    render_cache_entry_t *span;
+    size_t                size, removed = 0;
+    char                  path[4096];
+
+    vector_entry_init(&entries, 0);
+    render_cache_scan(rc, &entries, &rc->total);
+    span = vector_entry_span(&entries, &size);
+    qsort(span, size, sizeof(*span), render_cache_entry_cmp);
+
+    for (size_t i = 0; i < size && rc->total > target; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", rc->dir, span[i].name);
+        if (unlink(path) == 0 || errno == ENOENT) {
+            rc->total -= span[i].size;
+            removed += 1;
+        }
+    }
+
+    log_msg("Render cache: evicted %zu entries, %zu KiB left", removed, rc->total / 1024);
+    vector_entry_free(&entries);
+}
+
+render_cache_t *
+render_cache_create(const char *dir, size_t budget) {
+    ASSERT(dir != NULL);
+    render_cache_t *rc;
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        log_err("Failed to create render cache %s: %s", dir, strerror(errno));
+        return NULL;
+    }
+
+    rc = malloc(sizeof(*rc));
+    rc->dir = utils_strdup(dir);
+    rc->budget = budget;
+    rc->tmp_counter = 0;
+    pthread_mutex_init(&rc->lock, NULL);
+    render_cache_scan(rc, NULL, &rc->total);
+    /* Left over from a run with a larger budget */
+    if (rc->total > rc->budget) {
+        render_cache_evict(rc);
+    }
+
+    return rc;
+}
+
+static void
+render_cache_path(const render_cache_t *rc, const render_cache_key_t *key, char *buf, size_t size) {
+    char name[RENDER_CACHE_NAME_LEN + 1];
+
+    render_cache_name(key, name);
+    snprintf(buf, size, "%s/%s", rc->dir, name);
+}
+
+/* Drops a bad entry, its size no longer counts towards the budget */
+static void
+render_cache_remove(render_cache_t *rc, const char *path, size_t size) {
+    pthread_mutex_lock(&rc->lock);
+    if (unlink(path) == 0) {
+        rc->total -= (size < rc->total) ? size : rc->total;
+    }
+    pthread_mutex_unlock(&rc->lock);
+}
+
+static bool
+render_cache_valid(const render_cache_header_t *hdr, const render_cache_key_t *key, size_t size) {
+    if (memcmp(hdr->magic, RENDER_CACHE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->key[0] != key->h[0] || hdr->key[1] != key->h[1]) {
+        return false;
+    }
+    if (hdr->width <= 0 || hdr->height <= 0 || hdr->stride <= 0) {
+        return false;
+    }
+
+    return size == RENDER_CACHE_DATA_OFFSET + ((size_t)hdr->stride * (size_t)hdr->height);
+}
+
+bool
+render_cache_get(render_cache_t *rc, const render_cache_key_t *key, render_cache_image_t *image) {
+    ASSERT(rc != NULL);
+    ASSERT(key != NULL && image != NULL);
+    char        path[4096];
+    struct stat st;
+    void       *map;
+    int         fd;
+
+    render_cache_path(rc, key, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    if ((size_t)st.st_size < RENDER_CACHE_DATA_OFFSET) {
+        close(fd);
+        render_cache_remove(rc, path, (size_t)st.st_size);
+        return false;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    /* Marks it as recently used for eviction */
+    futimens(fd, NULL);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        log_err("Failed to map %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    const render_cache_header_t *hdr = (const render_cache_header_t *)map;
+
+    /* Truncated by a crash or from another version, render it again */
+    if (!render_cache_valid(hdr, key, (size_t)st.st_size)) {
+        munmap(map, (size_t)st.st_size);
+        render_cache_remove(rc, path, (size_t)st.st_size);
+        return false;
+    }
+
+    image->data = (const unsigned char *)map + RENDER_CACHE_DATA_OFFSET;
+    image->width = hdr->width;
+    image->height = hdr->height;
+    image->stride = hdr->stride;
+    image->map = map;
+    image->map_size = (size_t)st.st_size;
+
+    return true;
+}
+
+void
+render_cache_release(render_cache_image_t *image) {
+    ASSERT(image != NULL);
+
+    if (image->map != NULL) {
+        munmap(image->map, image->map_size);
+    }
+    image->map = NULL;
+    image->data = NULL;
+}
+
+static bool
+render_cache_write_all(int fd, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *)data;
+
+    while (size > 0) {
+        const ssize_t n = write(fd, p, size);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+
+    return true;
+}
+
+bool
+render_cache_put(render_cache_t *rc, const render_cache_key_t *key, const unsigned char *data,
+    int width, int height, int stride) {
+    ASSERT(rc != NULL);
+    ASSERT(key != NULL && data != NULL);
+    ASSERT(width > 0 && height > 0 && stride > 0);
+    unsigned char         hdr_buf[RENDER_CACHE_DATA_OFFSET];
+    render_cache_header_t hdr;
+    const size_t          data_size = (size_t)stride * (size_t)height;
+    char                  path[4096], tmp[4096 + 64];
+    struct stat           st;
+    size_t                replaced;
+    bool                  ok;
+    int                   fd;
+
+    memcpy(hdr.magic, RENDER_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.key[0] = key->h[0];
+    hdr.key[1] = key->h[1];
+    hdr.width = width;
+    hdr.height = height;
+    hdr.stride = stride;
+    memset(hdr_buf, 0, sizeof(hdr_buf));
+    memcpy(hdr_buf, &hdr, sizeof(hdr));
+
+    /* Written aside and renamed over, readers never map a partial entry */
+    render_cache_path(rc, key, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s" RENDER_CACHE_TMP "%ld.%lu", path, (long)getpid(),
+        __atomic_fetch_add(&rc->tmp_counter, 1, __ATOMIC_RELAXED));
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        log_err("Failed to open %s: %s", tmp, strerror(errno));
+        return false;
+    }
+
+    ok = render_cache_write_all(fd, hdr_buf, sizeof(hdr_buf)) &&
+         render_cache_write_all(fd, data, data_size);
+    ok = (close(fd) == 0) && ok;
+
+    /* Replacing a key frees its old entry's size, locked so stores of one key agree */
+    pthread_mutex_lock(&rc->lock);
+    replaced = (stat(path, &st) == 0) ? (size_t)st.st_size : 0;
+    ok = ok && rename(tmp, path) == 0;
+
+    if (!ok) {
+        pthread_mutex_unlock(&rc->lock);
+        log_err("Failed to store %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return false;
+    }
+
+    rc->total -= (replaced < rc->total) ? replaced : rc->total;
+    rc->total += sizeof(hdr_buf) + data_size;
+    if (rc->total > rc->budget) {
+        render_cache_evict(rc);
+    }
+    pthread_mutex_unlock(&rc->lock);
+
+    return true;
+}
+
+void *
+render_cache_destroy(render_cache_t *rc) {
+    ASSERT(rc != NULL);
+
+    pthread_mutex_destroy(&rc->lock);
+    free(rc->dir);
+    free(rc);
+
+    return NULL;
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef RENDER_CACHE_H_
+#define RENDER_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Content-addressed store of rendered images on disk, kept between runs.
+ * Entries are named after a key hashed from everything the pixels depend on,
+ * so nothing is ever invalidated; the least recently used ones are deleted
+ * once the directory grows past the size budget. Thread-safe, and several
+ * processes may share a directory.
+ */
+
+typedef struct render_cache render_cache_t;
+
+/* 128-bit, built up from the source data, style and render parameters */
+typedef struct render_cache_key {
+    uint64_t h[2];
+} render_cache_key_t;
+
+/* Mapped read-only from the cache file, valid until released */
+typedef struct render_cache_image {
+    const unsigned char *data;
+    int                  width;
+    int                  height;
+    int                  stride;
+    void                *map;
+    size_t               map_size;
+} render_cache_image_t;
+
+void
+render_cache_key_init(render_cache_key_t *key);
+void
+render_cache_key_add(render_cache_key_t *key, const void *data, size_t size);
+void
+render_cache_key_add_long(render_cache_key_t *key, long value);
+void
+render_cache_key_add_double(render_cache_key_t *key, double value);
+/* Without the terminator, e.g. to tell apart what was rendered */
+void
+render_cache_key_add_str(render_cache_key_t *key, const char *str);
+
+/* Creates dir if missing, NULL if that fails. budget is in bytes. */
+render_cache_t *
+render_cache_create(const char *dir, size_t budget);
+/* Maps the entry into image, false on a miss */
+bool
+render_cache_get(render_cache_t *rc, const render_cache_key_t *key, render_cache_image_t *image);
+void
+render_cache_release(render_cache_image_t *image);
+/* Stores height rows of stride bytes, replacing any entry with the same key */
+bool
+render_cache_put(render_cache_t *rc, const render_cache_key_t *key, const unsigned char *data,
+    int width, int height, int stride);
+void *
+render_cache_destroy(render_cache_t *rc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RENDER_CACHE_H_ */
@@ -0,0 +1,227 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "render_pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <utils/log.h>
+#include <utils/trace.h>
+#include <utils/utils.h>
+
+struct render_pool_client {
+    long (*frame)(void *);
+    void                      *udata;
+    int                        priority;
+    long                       deadline;
+    bool                       requested;
+    bool                       busy;
+    struct render_pool_client *next;
+};
+
+struct render_pool {
+    pthread_t            *threads;
+    unsigned              threads_size;
+
+    render_pool_client_t *clients;
+    bool                  quit;
+
+    pthread_mutex_t       mutex;
+    /* Signaled whenever a client may have become runnable or idle */
+    pthread_cond_t        cond;
+};
+
+/* Highest priority runnable client, or when to look again in *wake_at (0 if never) */
+static render_pool_client_t *
+render_pool_pick(render_pool_t *pool, long now, long *wake_at) {
+    render_pool_client_t *best = NULL;
+
+    *wake_at = 0;
+
+    for (render_pool_client_t *c = pool->clients; c != NULL; c = c->next) {
+        if (!c->requested || c->busy) {
+            continue;
+        }
+
+        if (c->deadline > now) {
+            if (*wake_at == 0 || c->deadline < *wake_at) {
+                *wake_at = c->deadline;
+            }
+            continue;
+        }
+
+        if (best == NULL || c->priority > best->priority ||
+            (c->priority == best->priority && c->deadline < best->deadline)) {
+            best = c;
+        }
+    }
+
+    return best;
+}
+
+static void *
+render_pool_thread(void *arg) {
+    ASSERT(arg != NULL);
+    render_pool_t *pool = (render_pool_t *)arg;
+
+    TRACE_THREAD_NAME("render_pool");
+    pthread_mutex_lock(&pool->mutex);
+
+    while (!pool->quit) {
+        long                  wake_at;
+        render_pool_client_t *client = render_pool_pick(pool, utils_gettime(), &wake_at);
+
+        if (client == NULL) {
+            if (wake_at == 0) {
+                pthread_cond_wait(&pool->cond, &pool->mutex);
+            } else {
+                struct timespec ts;
+                ts.tv_sec = wake_at / 1000000000L;
+                ts.tv_nsec = wake_at % 1000000000L;
+                pthread_cond_timedwait(&pool->cond, &pool->mutex, &ts);
+            }
+            continue;
+        }
+
+        client->requested = false;
+        client->busy = true;
+        pthread_mutex_unlock(&pool->mutex);
+
+        long deadline = client->frame(client->udata);
+
+        pthread_mutex_lock(&pool->mutex);
+        client->deadline = deadline;
+        client->busy = false;
+        pthread_cond_broadcast(&pool->cond);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    pthread_exit(NULL);
+}
+
+render_pool_t *
+render_pool_create(unsigned threads) {
+    ASSERT(threads > 0);
+    render_pool_t     *pool;
+    pthread_condattr_t attr;
+
+    pool = malloc(sizeof(*pool));
+
+    pool->threads = malloc(sizeof(*pool->threads) * threads);
+    pool->threads_size = threads;
+    pool->clients = NULL;
+    pool->quit = false;
+
+    /* Deadlines are on the utils_gettime clock */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&pool->mutex, NULL);
+
+    for (unsigned i = 0; i < threads; ++i) {
+        pthread_create(&pool->threads[i], NULL, render_pool_thread, (void *)pool);
+    }
+
+    return pool;
+}
+
+render_pool_client_t *
+render_pool_add(render_pool_t *pool, long (*frame)(void *), void *udata, int priority) {
+    ASSERT(pool != NULL);
+    ASSERT(frame != NULL);
+    render_pool_client_t *client;
+
+    client = malloc(sizeof(*client));
+
+    client->frame = frame;
+    client->udata = udata;
+    client->priority = priority;
+    client->deadline = 0;
+    client->requested = true;
+    client->busy = false;
+
+    pthread_mutex_lock(&pool->mutex);
+    client->next = pool->clients;
+    pool->clients = client;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    return client;
+}
+
+void
+render_pool_request(render_pool_t *pool, render_pool_client_t *client) {
+    ASSERT(pool != NULL);
+    ASSERT(client != NULL);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (!client->requested) {
+        client->requested = true;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void
+render_pool_set_priority(render_pool_t *pool, render_pool_client_t *client, int priority) {
+    ASSERT(pool != NULL);
+    ASSERT(client != NULL);
+
+    pthread_mutex_lock(&pool->mutex);
+    client->priority = priority;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void
+render_pool_remove(render_pool_t *pool, render_pool_client_t *client) {
+    ASSERT(pool != NULL);
+    ASSERT(client != NULL);
+
+    pthread_mutex_lock(&pool->mutex);
+
+    while (client->busy) {
+        pthread_cond_wait(&pool->cond, &pool->mutex);
+    }
+
+    for (render_pool_client_t **c = &pool->clients; *c != NULL; c = &(*c)->next) {
+        if (*c == client) {
+            *c = client->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    free(client);
+}
+
+void *
+render_pool_destroy(render_pool_t *pool) {
+    ASSERT(pool != NULL);
+
+    pthread_mutex_lock(&pool->mutex);
+    ASSERT(pool->clients == NULL);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (unsigned i = 0; i < pool->threads_size; ++i) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool);
+
+    return NULL;
+}
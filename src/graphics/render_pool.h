@@ -0,0 +1,49 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef RENDER_POOL_H_
+#define RENDER_POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fixed set of worker threads shared by any number of render clients. A
+ * client renders a frame when one was requested and its pacing deadline has
+ * passed, higher priority clients first. A client never renders on two
+ * workers at once, but successive frames may run on different workers.
+ */
+
+typedef struct render_pool        render_pool_t;
+typedef struct render_pool_client render_pool_client_t;
+
+render_pool_t *
+render_pool_create(unsigned threads);
+/*
+ * frame renders one frame and returns the earliest time (utils_gettime) the
+ * next one may start at. The first frame is requested on add.
+ */
+render_pool_client_t *
+render_pool_add(render_pool_t *pool, long (*frame)(void *), void *udata, int priority);
+void
+render_pool_request(render_pool_t *pool, render_pool_client_t *client);
+void
+render_pool_set_priority(render_pool_t *pool, render_pool_client_t *client, int priority);
+/* Waits for a frame in progress to finish */
+void
+render_pool_remove(render_pool_t *pool, render_pool_client_t *client);
+/* Every client must have been removed */
+void *
+render_pool_destroy(render_pool_t *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RENDER_POOL_H_ */
@@ -13,6 +13,9 @@
 #include <math.h>
 #include <stdbool.h>
 #include <utils/log.h>
+#include <utils/perf_stats.h>
+#include <utils/trace.h>
+#include <utils/utils.h>
 
 static bool global_init_called = false;
 
@@ -142,6 +145,7 @@ window_loop(window_inst_t *window) {
     ASSERT(window != NULL);
 
     while (!glfwWindowShouldClose(window->glfw_window)) {
+        TRACE_SCOPE("window_loop");
         int win_width, win_height;
         glfwGetFramebufferSize(window->glfw_window, &win_width, &win_height);
 
@@ -155,8 +159,15 @@ window_loop(window_inst_t *window) {
             window->window_loop_cb(window, window->set_window_loop_cb.udata);
         }
 
+        long time_swap = utils_gettime();
+        TRACE_BEGIN("swap");
         glfwSwapBuffers(window->glfw_window);
+        TRACE_END("swap");
+        perf_stats_record(PERF_STAGE_SWAP, utils_gettime() - time_swap);
+
+        TRACE_BEGIN("poll_events");
         glfwPollEvents();
+        TRACE_END("poll_events");
     }
 }
 
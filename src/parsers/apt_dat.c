@@ -11,12 +11,17 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <utils/decomp_reader.h>
 #include <utils/log.h>
 #include <utils/path_hdlr.h>
+#include <utils/trace.h>
+#include <utils/uring_reader.h>
 #include <utils/utils.h>
 
 #define AIRPORT_ROW_CODE 1
 
+VECTOR_DEFINE(vector_char, char)
+
 typedef struct gather_ap_data {
     airport_db_t *ap_db;
     bool          has_airport;
@@ -25,14 +30,157 @@ typedef struct gather_ap_data {
     bool          last_was_pave_open;
 } gather_ap_data_t;
 
+/* Splits a file handed over in chunks into lines, like getline would */
+typedef struct apt_dat_lines {
+    int (*on_line)(const char *line, void *udata);
+    /* Optional, called after each file, also one that couldn't be read */
+    void (*on_file_end)(void *udata);
+    void *user_data;
+    /* Start of a line that continues in the next chunk */
+    vector_char_t carry;
+    /* on_line returned -1, the rest of the file is skipped */
+    bool stopped;
+} apt_dat_lines_t;
+
+static void
+apt_dat_lines_emit(apt_dat_lines_t *lines, const char *line) {
+    if (lines->on_line(line, lines->user_data) == -1) {
+        lines->stopped = true;
+    }
+}
+
+/* data is modified, every newline is replaced with a terminator */
+static void
+apt_dat_lines_feed(apt_dat_lines_t *lines, char *data, size_t size) {
+    char *end = data + size;
+
+    while (data < end && !lines->stopped) {
+        char *nl = memchr(data, '\n', (size_t)(end - data));
+
+        if (nl == NULL) {
+            vector_char_push_n(&lines->carry, data, (size_t)(end - data));
+            return;
+        }
+
+        *nl = '\0';
+        if (vector_char_size(&lines->carry) > 0) {
+            vector_char_push_n(&lines->carry, data, (size_t)(nl - data) + 1);
+            apt_dat_lines_emit(lines, lines->carry.data);
+            vector_char_clear(&lines->carry);
+        } else {
+            apt_dat_lines_emit(lines, data);
+        }
+        data = nl + 1;
+    }
+}
+
+/* The last line may not end with a newline */
+static void
+apt_dat_lines_finish(apt_dat_lines_t *lines) {
+    if (vector_char_size(&lines->carry) > 0 && !lines->stopped) {
+        vector_char_push(&lines->carry, '\0');
+        apt_dat_lines_emit(lines, lines->carry.data);
+    }
+
+    vector_char_clear(&lines->carry);
+    lines->stopped = false;
+
+    if (lines->on_file_end != NULL) {
+        lines->on_file_end(lines->user_data);
+    }
+}
+
+/* Never held whole in memory, the text is decompressed a few chunks ahead on another thread */
+static void
+apt_dat_file_read_compressed(const char *path, decomp_format_t format, apt_dat_lines_t *lines) {
+    decomp_reader_t *dr = decomp_reader_create(path, format);
+    char            *data;
+    size_t           size;
+
+    if (dr == NULL) {
+        return;
+    }
+
+    while (!lines->stopped && decomp_reader_next(dr, &data, &size)) {
+        apt_dat_lines_feed(lines, data, size);
+    }
+
+    /* Whatever came before the damage was parsed */
+    if (!lines->stopped && decomp_reader_failed(dr)) {
+        log_err("Only part of %s could be read", path);
+    }
+
+    decomp_reader_destroy(dr);
+    apt_dat_lines_finish(lines);
+}
+
+/* Opens and reads of the next files overlap with parsing the current one */
+static void
+apt_dat_file_read_uring(uring_reader_t *ur, const char **files, apt_dat_lines_t *lines) {
+    uring_chunk_t   chunk;
+    decomp_format_t format;
+
+    while (uring_reader_next(ur, &chunk)) {
+        if (chunk.error != 0) {
+            log_err("Failed to %s %s: %s", chunk.first ? "open" : "read", files[chunk.file],
+                strerror(chunk.error));
+            if (!chunk.first) {
+                TRACE_END("apt_dat_file_read");
+            }
+            apt_dat_lines_finish(lines);
+            continue;
+        }
+
+        if (chunk.first) {
+            TRACE_BEGIN_DETAIL("apt_dat_file_read", files[chunk.file]);
+
+            /* Decompressed from the start instead, the raw chunks aren't needed */
+            format = decomp_reader_detect(chunk.data, chunk.size);
+            if (format != DECOMP_FORMAT_NONE) {
+                uring_reader_skip(ur);
+                apt_dat_file_read_compressed(files[chunk.file], format, lines);
+                TRACE_END("apt_dat_file_read");
+                continue;
+            }
+        }
+
+        apt_dat_lines_feed(lines, chunk.data, chunk.size);
+
+        if (chunk.last) {
+            apt_dat_lines_finish(lines);
+            TRACE_END("apt_dat_file_read");
+        }
+    }
+}
+
 static void
 apt_dat_file_read(const char **files, size_t files_size, void *user_data,
-    int (*on_line)(const char *line, void *udata)) {
+    int (*on_line)(const char *line, void *udata), void (*on_file_end)(void *udata)) {
+    uring_reader_t *ur = uring_reader_create(files, files_size);
+    apt_dat_lines_t lines = {.on_line = on_line,
+        .on_file_end = on_file_end,
+        .user_data = user_data,
+        .stopped = false};
+
+    vector_char_init(&lines.carry, 0);
+
+    if (ur != NULL) {
+        apt_dat_file_read_uring(ur, files, &lines);
+        uring_reader_destroy(ur);
+        vector_char_free(&lines.carry);
+        return;
+    }
+
+    /* No io_uring here, one file at a time */
     for (size_t i = 0; i < files_size; ++i) {
-        char  *new_file_path;
-        char  *line_buf = NULL;
-        FILE  *fp;
-        size_t line_size;
+        char           *new_file_path;
+        char           *line_buf = NULL;
+        FILE           *fp;
+        size_t          line_size;
+        unsigned char   magic[DECOMP_READER_MAGIC_SIZE];
+        decomp_format_t format;
+
+        TRACE_BEGIN_DETAIL("apt_dat_file_read", files[i]);
 
         new_file_path = path_hdlr_convert_to_native(files[i]);
         fp = fopen(new_file_path, "r");
@@ -40,8 +188,20 @@ apt_dat_file_read(const char **files, size_t files_size, void *user_data,
         if (fp == NULL) {
             log_err("Failed to open %s", new_file_path);
             free(new_file_path);
+            apt_dat_lines_finish(&lines);
+            TRACE_END("apt_dat_file_read");
+            continue;
+        }
+
+        format = decomp_reader_detect(magic, fread(magic, 1, sizeof(magic), fp));
+        if (format != DECOMP_FORMAT_NONE) {
+            fclose(fp);
+            apt_dat_file_read_compressed(new_file_path, format, &lines);
+            free(new_file_path);
+            TRACE_END("apt_dat_file_read");
             continue;
         }
+        rewind(fp);
 
         while (getline(&line_buf, &line_size, fp) != -1) {
             utils_strip_newline(line_buf);
@@ -53,9 +213,30 @@ apt_dat_file_read(const char **files, size_t files_size, void *user_data,
         fclose(fp);
         free(new_file_path);
         free(line_buf);
+
+        /* Nothing carried over, only the end of file callback */
+        apt_dat_lines_finish(&lines);
+        TRACE_END("apt_dat_file_read");
+    }
+
+    vector_char_free(&lines.carry);
+}
+
+/* Every apt_dat_row_t, rows with other codes never reach the handlers */
+static const long apt_dat_rows[] = {APT_DAT_ROW_LAND_AIRPORT, APT_DAT_ROW_SEAPLANE_BASE,
+    APT_DAT_ROW_HELIPORT, APT_DAT_ROW_RUNWAY, APT_DAT_ROW_PAVEMENT, APT_DAT_ROW_NODE,
+    APT_DAT_ROW_NODE_BEZIER, APT_DAT_ROW_NODE_CLOSE, APT_DAT_ROW_NODE_BEZIER_CLOSE,
+    APT_DAT_ROW_BOUNDARY, APT_DAT_ROW_METADATA};
+
+bool
+apt_dat_row_handled(long row_code) {
+    for (size_t i = 0; i < sizeof(apt_dat_rows) / sizeof(apt_dat_rows[0]); ++i) {
+        if (apt_dat_rows[i] == row_code) {
+            return true;
+        }
     }
 
-    return;
+    return false;
 }
 
 /* Row code */
@@ -88,7 +269,7 @@ apt_dat_count_airports(const char *line, void *udata) {
 
     row_code = apt_dat_handle_rowcode(line);
 
-    if (row_code == 1) {
+    if (row_code == APT_DAT_ROW_LAND_AIRPORT) {
         *airport_ctr += 1;
     }
 
@@ -165,14 +346,13 @@ static void
 apt_dat_handle_130(const char *line, airport_info_t *ap_info) {
     double lat_val = apt_dat_str_to_double(line, 1);
     double lon_val = apt_dat_str_to_double(line, 2);
-    vector_push(ap_info->boundaries.latitude, &lat_val);
-    vector_push(ap_info->boundaries.longitude, &lon_val);
+    vector_double_push(&ap_info->boundaries.latitude, lat_val);
+    vector_double_push(&ap_info->boundaries.longitude, lon_val);
 }
 
 static void
 apt_dat_handle_110(const char *line, airport_info_t *ap_info, bool new_node) {
     airport_bounds_t *ap_bnds;
-    size_t            pave_b_index;
 
     double            lat_val = apt_dat_str_to_double(line, 1);
     double            lon_val = apt_dat_str_to_double(line, 2);
@@ -180,20 +360,34 @@ apt_dat_handle_110(const char *line, airport_info_t *ap_info, bool new_node) {
     if (new_node) {
         airport_bounds_t bounds;
 
-        bounds.latitude = vector_create(sizeof(double), 2);
-        bounds.longitude = vector_create(sizeof(double), 2);
+        vector_double_init(&bounds.latitude, 2);
+        vector_double_init(&bounds.longitude, 2);
 
-        vector_push(ap_info->pave_bounds, &bounds);
+        vector_bounds_push(&ap_info->pave_bounds, bounds);
     }
 
-    pave_b_index = vector_size(ap_info->pave_bounds);
-    ASSERT(pave_b_index > 0);
-    pave_b_index -= 1;
+    ap_bnds = vector_bounds_back(&ap_info->pave_bounds);
+
+    vector_double_push(&ap_bnds->latitude, lat_val);
+    vector_double_push(&ap_bnds->longitude, lon_val);
+}
 
-    vector_get_ref(ap_info->pave_bounds, pave_b_index, (void *)&ap_bnds);
+/* Outlines still open from the last airport or file don't carry over into the next one */
+static void
+apt_dat_gather_reset(gather_ap_data_t *gapt) {
+    gapt->airport_bb_open = false;
+    gapt->airport_pavement_open = false;
+    gapt->last_was_pave_open = false;
+}
+
+/* A file may end anywhere (truncated, unreadable), the next one starts clean */
+static void
+apt_dat_gather_file_end(void *udata) {
+    ASSERT(udata != NULL);
+    gather_ap_data_t *gapt = (gather_ap_data_t *)udata;
 
-    vector_push(ap_bnds->latitude, &lat_val);
-    vector_push(ap_bnds->longitude, &lon_val);
+    apt_dat_gather_reset(gapt);
+    gapt->has_airport = false;
 }
 
 static int
@@ -207,34 +401,40 @@ apt_dat_gather_ap_info(const char *line, void *udata) {
     gather_ap_data_t *gapt = (gather_ap_data_t *)udata;
     const long        row_code = apt_dat_handle_rowcode(line);
 
-    if (row_code == 1) {
+    if (!apt_dat_row_handled(row_code)) {
+        return 1;
+    }
+
+    if (row_code == APT_DAT_ROW_LAND_AIRPORT) {
         gapt->ap_db->airports_size += 1;
     }
     const size_t true_apt_index = gapt->ap_db->airports_size - 1;
 
     /* Don't bother continuing if we don't have a valid airport. */
-    if (row_code != 1 && gapt->has_airport == false) {
+    if (row_code != APT_DAT_ROW_LAND_AIRPORT && gapt->has_airport == false) {
         return 1;
     }
 
     switch (row_code) {
-        case 1: /* Land airport*/
+        case APT_DAT_ROW_LAND_AIRPORT:
             apt_dat_handle_1(line, &gapt->ap_db->airports[true_apt_index]);
+            apt_dat_gather_reset(gapt);
             gapt->has_airport = true;
             break;
-        case 16: /* Seaplane base */
-        case 17: /* Heliport */
+        case APT_DAT_ROW_SEAPLANE_BASE:
+        case APT_DAT_ROW_HELIPORT:
+            apt_dat_gather_reset(gapt);
             gapt->has_airport = false;
             break;
-        case 100: /* Runway */
+        case APT_DAT_ROW_RUNWAY:
             apt_dat_handle_100(line, &gapt->ap_db->airports[true_apt_index]);
             break;
-        case 110: /* Pavement (taxiway or ramp) header */
+        case APT_DAT_ROW_PAVEMENT: /* Taxiway or ramp header */
             gapt->airport_pavement_open = true;
             gapt->last_was_pave_open = true;
             break;
-        case 111: /* Node */
-        case 112: /* Node with bezier control point */
+        case APT_DAT_ROW_NODE:
+        case APT_DAT_ROW_NODE_BEZIER:
             if (gapt->airport_bb_open) {
                 apt_dat_handle_130(line, &gapt->ap_db->airports[true_apt_index]);
             } else if (gapt->airport_pavement_open) {
@@ -243,8 +443,8 @@ apt_dat_gather_ap_info(const char *line, void *udata) {
                 gapt->last_was_pave_open = false;
             }
             break;
-        case 113: /* Node with implicit close of loop */
-        case 114: /* Node with Bezier control point, with implicit close of loop */
+        case APT_DAT_ROW_NODE_CLOSE:
+        case APT_DAT_ROW_NODE_BEZIER_CLOSE:
             /* Close airport boundary reading if open */
             if (gapt->airport_bb_open) {
                 apt_dat_handle_130(line, &gapt->ap_db->airports[true_apt_index]);
@@ -256,10 +456,10 @@ apt_dat_gather_ap_info(const char *line, void *udata) {
                 apt_dat_handle_110(line, &gapt->ap_db->airports[true_apt_index], true);
             }
             break;
-        case 130: /* Airport boundary header */
+        case APT_DAT_ROW_BOUNDARY: /* Header */
             gapt->airport_bb_open = true;
             break;
-        case 1302: /* Airport metadata */
+        case APT_DAT_ROW_METADATA:
             apt_dat_handle_1302(line, &gapt->ap_db->airports[true_apt_index]);
             break;
     }
@@ -280,13 +480,29 @@ apt_dat_airport_verify(const airport_info_t *apt) {
         log_err("Airport %s does not contain [name]", apt->icao);
     } else if (apt->state == NULL) {
         log_err("Airport %s does not contain [state]", apt->icao);
-    } else if (apt->pave_bounds == NULL) {
+    } else if (vector_bounds_size(&apt->pave_bounds) == 0) {
         log_err("Airport %s does not contain [pave_bounds]", apt->icao);
     } else if (apt->runways == NULL) {
         log_err("Airport %s does not contain [runways]", apt->icao);
     }
 }
 
+static void
+apt_dat_airport_shrink(airport_info_t *ap_info) {
+    size_t            pave_bnds_size;
+    airport_bounds_t *pave_bnds = vector_bounds_span(&ap_info->pave_bounds, &pave_bnds_size);
+
+    vector_double_shrink_to_fit(&ap_info->boundaries.latitude);
+    vector_double_shrink_to_fit(&ap_info->boundaries.longitude);
+
+    for (size_t i = 0; i < pave_bnds_size; ++i) {
+        vector_double_shrink_to_fit(&pave_bnds[i].latitude);
+        vector_double_shrink_to_fit(&pave_bnds[i].longitude);
+    }
+
+    vector_bounds_shrink_to_fit(&ap_info->pave_bounds);
+}
+
 airport_db_t *
 apt_dat_airport_db_create(size_t num_airports) {
     airport_db_t *adb;
@@ -298,9 +514,10 @@ apt_dat_airport_db_create(size_t num_airports) {
     adb->airports_size = 0;
 
     for (size_t i = 0; i < num_airports; ++i) {
-        adb->airports[i].boundaries.latitude = vector_create(sizeof(double), 2);
-        adb->airports[i].boundaries.longitude = vector_create(sizeof(double), 2);
-        adb->airports[i].pave_bounds = vector_create(sizeof(airport_bounds_t), 0);
+        /* Nothing is allocated until the first node */
+        vector_double_init(&adb->airports[i].boundaries.latitude, 0);
+        vector_double_init(&adb->airports[i].boundaries.longitude, 0);
+        vector_bounds_init(&adb->airports[i].pave_bounds, 0);
     }
 
     return adb;
@@ -310,7 +527,9 @@ airport_db_t *
 apt_dat_parse(const char **files, size_t size) {
     size_t num_airports = 0;
 
-    apt_dat_file_read(files, size, (void *)&num_airports, apt_dat_count_airports);
+    TRACE_BEGIN("apt_dat_count");
+    apt_dat_file_read(files, size, (void *)&num_airports, apt_dat_count_airports, NULL);
+    TRACE_END("apt_dat_count");
 
     if (num_airports == 0) {
         log_err("Couldn't find any airports");
@@ -324,7 +543,18 @@ apt_dat_parse(const char **files, size_t size) {
 
     airport_gather.ap_db = apt_dat_airport_db_create(num_airports);
 
-    apt_dat_file_read(files, size, (void *)&airport_gather.ap_db, apt_dat_gather_ap_info);
+    TRACE_BEGIN("apt_dat_gather");
+    apt_dat_file_read(files, size, (void *)&airport_gather, apt_dat_gather_ap_info,
+        apt_dat_gather_file_end);
+    TRACE_END("apt_dat_gather");
+
+    /* The database is never written after parsing, drop the growth slack */
+    TRACE_BEGIN("apt_dat_shrink");
+    for (size_t i = 0; i < airport_gather.ap_db->airports_size; ++i) {
+        apt_dat_airport_shrink(&airport_gather.ap_db->airports[i]);
+    }
+    TRACE_END("apt_dat_shrink");
+    TRACE_COUNTER("airports", airport_gather.ap_db->airports_size);
 
     for (size_t i = 0; i < airport_gather.ap_db->airports_size; ++i) {
         if (strcmp(airport_gather.ap_db->airports[i].icao, "KLAX") == 0) {
@@ -372,19 +602,19 @@ apt_dat_db_free(airport_db_t *db) {
         free(db->airports[i].state);
         free(db->airports[i].icao);
         free(db->airports[i].runways);
-        db->airports[i].boundaries.latitude = vector_destroy(db->airports[i].boundaries.latitude);
-        db->airports[i].boundaries.longitude = vector_destroy(db->airports[i].boundaries.longitude);
+        vector_double_free(&db->airports[i].boundaries.latitude);
+        vector_double_free(&db->airports[i].boundaries.longitude);
 
-        const size_t pave_bnds_size = vector_size(db->airports[i].pave_bounds);
+        size_t            pave_bnds_size;
+        airport_bounds_t *pave_bnds =
+            vector_bounds_span(&db->airports[i].pave_bounds, &pave_bnds_size);
 
         for (size_t j = 0; j < pave_bnds_size; ++j) {
-            airport_bounds_t *coords_ref;
-            vector_get_ref(db->airports[i].pave_bounds, j, (void *)&coords_ref);
-            vector_destroy(coords_ref->latitude);
-            vector_destroy(coords_ref->longitude);
+            vector_double_free(&pave_bnds[j].latitude);
+            vector_double_free(&pave_bnds[j].longitude);
         }
 
-        db->airports[i].pave_bounds = vector_destroy(db->airports[i].pave_bounds);
+        vector_bounds_free(&db->airports[i].pave_bounds);
     }
 
     free(db->airports);
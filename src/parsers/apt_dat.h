@@ -9,6 +9,7 @@
 #ifndef APT_DAT_H_
 #define APT_DAT_H_
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <utils/vec.h>
 
@@ -16,6 +17,21 @@
 extern "C" {
 #endif
 
+/* Row codes apt_dat_parse handles, every other row is skipped */
+typedef enum apt_dat_row {
+    APT_DAT_ROW_LAND_AIRPORT = 1,
+    APT_DAT_ROW_SEAPLANE_BASE = 16,
+    APT_DAT_ROW_HELIPORT = 17,
+    APT_DAT_ROW_RUNWAY = 100,
+    APT_DAT_ROW_PAVEMENT = 110,
+    APT_DAT_ROW_NODE = 111,
+    APT_DAT_ROW_NODE_BEZIER = 112,
+    APT_DAT_ROW_NODE_CLOSE = 113,
+    APT_DAT_ROW_NODE_BEZIER_CLOSE = 114,
+    APT_DAT_ROW_BOUNDARY = 130,
+    APT_DAT_ROW_METADATA = 1302
+} apt_dat_row_t;
+
 typedef struct runway_info {
     double width;
     char   name[2][4];
@@ -24,10 +40,12 @@ typedef struct runway_info {
 } runway_info_t;
 
 typedef struct airport_bounds {
-    vector_t *latitude;
-    vector_t *longitude;
+    vector_double_t latitude;
+    vector_double_t longitude;
 } airport_bounds_t;
 
+VECTOR_DEFINE(vector_bounds, airport_bounds_t)
+
 typedef struct airport_info {
     char            *name;
     char            *city;
@@ -41,7 +59,7 @@ typedef struct airport_info {
     size_t           runways_size;
 
     airport_bounds_t boundaries;
-    vector_t        *pave_bounds;
+    vector_bounds_t  pave_bounds;
 } airport_info_t;
 
 typedef struct airport_db {
@@ -57,6 +75,9 @@ size_t
 apt_dat_find_by_icao(const airport_db_t *db, const char *icao);
 void
 apt_dat_airport_verify(const airport_info_t *apt);
+/* Whether the parser does anything with rows of this code, also used by gam_bench_parse */
+bool
+apt_dat_row_handled(long row_code);
 
 #ifdef __cplusplus
 }
@@ -8,22 +8,43 @@
 
 #include "scenery_packs.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <utils/log.h>
 #include <utils/path_hdlr.h>
+#include <utils/trace.h>
 #include <utils/utils.h>
 
 #define SCENERY_INI_PATH_EXT "Custom Scenery/scenery_packs.ini"
 #define SCENERY_APT_DAT_EXT  "Earth nav data/apt.dat"
-#define SCENERY_PACK_KEY     "SCENERY_PACK"
+/* With the separator, SCENERY_PACK_DISABLED lines don't match */
+#define SCENERY_PACK_KEY     "SCENERY_PACK "
+/* stat mostly waits on the disk, so more of them than cores */
+#define SCENERY_STAT_THREADS 16
+
+/* Tried in turn where a pack has no plain apt.dat, see utils/decomp_reader.h */
+static const char *const scenery_apt_dat_compressed[] = {".gz", ".zst"};
 
 struct scenery_packs_data {
     char **paths;
     size_t paths_size;
 };
 
+/* Candidate apt.dat files, checked by every probe worker */
+typedef struct scenery_probe {
+    char **paths;
+    /* Bytes, -1 when there is no (or an empty) apt.dat */
+    long  *sizes;
+    size_t size;
+    size_t next;
+} scenery_probe_t;
+
 static scenery_packs_data_t *
 scenery_packs_get_file_data(const char *xp_path, const char *native_path) {
     FILE                 *fp;
@@ -32,20 +53,18 @@ scenery_packs_get_file_data(const char *xp_path, const char *native_path) {
     scenery_packs_data_t *scenery_paths;
     size_t                paths_alloc_sz = 15;
 
-    scenery_paths = malloc(sizeof(*scenery_paths));
-    scenery_paths->paths = malloc(paths_alloc_sz * sizeof(char *));
-    scenery_paths->paths_size = 0;
-
     fp = fopen(native_path, "r");
     if (!fp) {
         log_err("Failed to open file %s", native_path);
         return NULL;
     }
 
+    scenery_paths = malloc(sizeof(*scenery_paths));
+    scenery_paths->paths = malloc(paths_alloc_sz * sizeof(char *));
+    scenery_paths->paths_size = 0;
+
     while (getline(&line_buf, &line_size, fp) != -1) {
         if (strstr(line_buf, SCENERY_PACK_KEY) == line_buf) {
-            ASSERT(strlen(line_buf) > (strlen(SCENERY_PACK_KEY) + 1));
-
             if ((scenery_paths->paths_size + 1) == paths_alloc_sz) {
                 paths_alloc_sz += 10;
                 scenery_paths->paths =
@@ -53,7 +72,7 @@ scenery_packs_get_file_data(const char *xp_path, const char *native_path) {
             }
 
             const size_t offset = strlen(SCENERY_PACK_KEY);
-            char        *path = line_buf + offset + 1;
+            char        *path = line_buf + offset;
             utils_strip_newline(path);
 
             /* Check if path is empty */
@@ -78,15 +97,145 @@ scenery_packs_get_file_data(const char *xp_path, const char *native_path) {
     return scenery_paths;
 }
 
+static bool
+scenery_packs_probe_file(const char *path, long *size) {
+    /* Checks the same file apt_dat_file_read opens later */
+    char       *native_path = path_hdlr_convert_to_native(path);
+    struct stat st;
+    int         fd;
+
+    *size = -1;
+    if (stat(native_path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        free(native_path);
+        return false;
+    }
+    *size = (long)st.st_size;
+
+#ifdef POSIX_FADV_WILLNEED
+    /* Starts reading it in the background, the disk fetch overlaps the parse */
+    fd = open(native_path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+#else
+    UNUSED(fd);
+#endif
+
+    free(native_path);
+    return true;
+}
+
+/* Without a plain apt.dat, a compressed one is used instead (path is replaced then) */
+static void
+scenery_packs_probe_pack(char **path, long *size) {
+    const size_t len = strlen(*path);
+
+    if (scenery_packs_probe_file(*path, size)) {
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(scenery_apt_dat_compressed) / sizeof(char *); ++i) {
+        char *alt = malloc(len + strlen(scenery_apt_dat_compressed[i]) + 1);
+
+        memcpy(alt, *path, len);
+        strcpy(alt + len, scenery_apt_dat_compressed[i]);
+        if (scenery_packs_probe_file(alt, size)) {
+            free(*path);
+            *path = alt;
+            return;
+        }
+        free(alt);
+    }
+}
+
+static void *
+scenery_packs_probe_worker(void *arg) {
+    ASSERT(arg != NULL);
+    scenery_probe_t *probe = (scenery_probe_t *)arg;
+    size_t           i;
+
+    while ((i = __atomic_fetch_add(&probe->next, 1, __ATOMIC_RELAXED)) < probe->size) {
+        scenery_packs_probe_pack(&probe->paths[i], &probe->sizes[i]);
+    }
+
+    return NULL;
+}
+
+/*
+ * Most packs are libraries without an apt.dat. Checks every candidate in
+ * parallel, drops the missing ones (keeping the ini's order) and prefetches
+ * the rest. Each worker only touches its own entries of paths.
+ */
+static void
+scenery_packs_probe(scenery_packs_data_t *data) {
+    TRACE_SCOPE("scenery_packs_probe");
+    scenery_probe_t probe;
+    pthread_t      *threads;
+    size_t          threads_size, started, kept = 0;
+    long            total = 0;
+
+    if (data->paths_size == 0) {
+        return;
+    }
+
+    probe.paths = data->paths;
+    probe.sizes = malloc(data->paths_size * sizeof(*probe.sizes));
+    probe.size = data->paths_size;
+    probe.next = 0;
+
+    threads_size = (data->paths_size < SCENERY_STAT_THREADS) ? data->paths_size
+                                                             : SCENERY_STAT_THREADS;
+    threads = malloc(threads_size * sizeof(*threads));
+    for (started = 0; started < threads_size; ++started) {
+        if (pthread_create(&threads[started], NULL, scenery_packs_probe_worker, (void *)&probe) !=
+            0) {
+            break;
+        }
+    }
+    /* Whatever the started threads don't get to, or all of it without any */
+    scenery_packs_probe_worker(&probe);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < data->paths_size; ++i) {
+        if (probe.sizes[i] < 0) {
+            free(data->paths[i]);
+            continue;
+        }
+
+        data->paths[kept] = data->paths[i];
+        kept += 1;
+        total += probe.sizes[i];
+    }
+
+    log_msg("%zu of %zu scenery packs have an apt.dat, %.1f MiB", kept, data->paths_size,
+        (double)total / (1024.0 * 1024.0));
+    data->paths_size = kept;
+
+    free(threads);
+    free(probe.sizes);
+}
+
 scenery_packs_data_t *
 scenery_packs_parse(const char *xp_path) {
-    char                 *new_path, *native_path;
+    TRACE_SCOPE("scenery_packs_parse");
+    const size_t          len = strlen(xp_path);
+    char                 *root, *new_path, *native_path;
     scenery_packs_data_t *ret;
 
-    new_path = path_hdlr_join_paths(xp_path, SCENERY_INI_PATH_EXT);
+    /* path_hdlr_join_paths adds no separator, so the root has to end in one */
+    root = (len > 0 && xp_path[len - 1] != '/') ? path_hdlr_join_paths(xp_path, "/")
+                                                : utils_strdup(xp_path);
+    new_path = path_hdlr_join_paths(root, SCENERY_INI_PATH_EXT);
     native_path = path_hdlr_convert_to_native(new_path);
-    ret = scenery_packs_get_file_data(xp_path, native_path);
+    ret = scenery_packs_get_file_data(root, native_path);
+    if (ret != NULL) {
+        scenery_packs_probe(ret);
+    }
 
+    free(root);
     free(new_path);
     free(native_path);
 
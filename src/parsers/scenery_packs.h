@@ -17,6 +17,11 @@ extern "C" {
 
 typedef struct scenery_packs_data scenery_packs_data_t;
 
+/*
+ * Enabled packs that have an apt.dat (or an apt.dat.gz / apt.dat.zst), in
+ * scenery_packs.ini order. The files are already being read ahead in the
+ * background when this returns.
+ */
 scenery_packs_data_t *
 scenery_packs_parse(const char *xp_path);
 scenery_packs_data_t *
@@ -0,0 +1,454 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Writes a fake X-Plane tree (Custom Scenery/scenery_packs.ini and one
+ * apt.dat per pack) for parser and renderer benchmarks without an X-Plane
+ * install. The same options and seed always give byte-identical output.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <utils/log.h>
+
+#define GEN_PACK_NAME_FMT   "Synthetic Airports %03u"
+#define GEN_PACKS_INI       "Custom Scenery/scenery_packs.ini"
+#define GEN_APT_DAT         "Earth nav data/apt.dat"
+#define GEN_METERS_PER_DEG  111320.0
+#define GEN_HELIPORT_PERIOD 20 /* Every nth airport entry is a heliport */
+
+typedef struct gen_opts {
+    const char   *root;
+    unsigned      airports;
+    unsigned      packs;
+    unsigned      disabled_packs;
+    unsigned      max_runways;
+    unsigned      max_pave_sections;
+    unsigned      max_pave_nodes;
+    unsigned      max_bounds_nodes;
+    unsigned      line_features;
+    uint64_t      seed;
+} gen_opts_t;
+
+typedef struct gen_stats {
+    unsigned long lines;
+    unsigned long bytes;
+} gen_stats_t;
+
+/* splitmix64, so output doesn't depend on the libc rand() implementation */
+static uint64_t
+gen_rand(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* [lo, hi) */
+static double
+gen_rand_range(uint64_t *state, double lo, double hi) {
+    return lo + ((double)(gen_rand(state) >> 11) / 9007199254740992.0) * (hi - lo);
+}
+
+/* [lo, hi] */
+static unsigned
+gen_rand_uint(uint64_t *state, unsigned lo, unsigned hi) {
+    return lo + (unsigned)(gen_rand(state) % ((uint64_t)(hi - lo) + 1));
+}
+
+static int
+gen_mkdirs(const char *path) {
+    char  *buf = strdup(path);
+    size_t len = strlen(buf);
+
+    for (size_t i = 1; i <= len; ++i) {
+        if (buf[i] != '/' && buf[i] != '\0') {
+            continue;
+        }
+
+        const char c = buf[i];
+        buf[i] = '\0';
+        if (mkdir(buf, 0755) != 0 && errno != EEXIST) {
+            log_err("Failed to create directory %s", buf);
+            free(buf);
+            return -1;
+        }
+        buf[i] = c;
+    }
+
+    free(buf);
+    return 0;
+}
+
+static void
+gen_printf(FILE *fp, gen_stats_t *stats, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void
+gen_printf(FILE *fp, gen_stats_t *stats, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vfprintf(fp, fmt, ap);
+    va_end(ap);
+
+    if (n > 0) {
+        stats->bytes += (unsigned long)n;
+    }
+    stats->lines += 1;
+}
+
+/* Four character ident for an airport number, unique for the first 139968, never KLAX */
+static void
+gen_ident(unsigned long n, char ident[5]) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    /* Real ICAO idents never start with X, Y or Z */
+    ident[0] = "XYZ"[(n / 46656) % 3];
+    for (int i = 3; i >= 1; --i) {
+        ident[i] = digits[n % 36];
+        n /= 36;
+    }
+    ident[4] = '\0';
+}
+
+/* Offsets a point by meters north and east */
+static void
+gen_offset(double lat, double lon, double north, double east, double *out_lat, double *out_lon) {
+    *out_lat = lat + (north / GEN_METERS_PER_DEG);
+    *out_lon = lon + (east / (GEN_METERS_PER_DEG * cos(lat * M_PI / 180.0)));
+}
+
+/*
+ * Irregular ring around a center, as a mix of plain (111) and bezier (112)
+ * nodes closed by a 113 or 114 node.
+ */
+static void
+gen_ring(FILE *fp, gen_stats_t *stats, uint64_t *rng, double lat, double lon, double radius,
+    unsigned nodes) {
+    const double rot = gen_rand_range(rng, 0.0, 2.0 * M_PI);
+
+    for (unsigned i = 0; i < nodes; ++i) {
+        const double angle = rot + (2.0 * M_PI * i) / nodes;
+        const double r = radius * gen_rand_range(rng, 0.7, 1.0);
+        const bool   last = (i == nodes - 1);
+        const bool   bezier = (gen_rand(rng) % 4) == 0;
+        double       p_lat, p_lon;
+
+        gen_offset(lat, lon, r * cos(angle), r * sin(angle), &p_lat, &p_lon);
+
+        if (bezier) {
+            double c_lat, c_lon;
+            gen_offset(p_lat, p_lon, r * 0.1 * sin(angle), -r * 0.1 * cos(angle), &c_lat, &c_lon);
+            gen_printf(fp, stats, "%u %.8f %.8f %.8f %.8f\n", last ? 114U : 112U, p_lat, p_lon,
+                c_lat, c_lon);
+        } else {
+            gen_printf(fp, stats, "%u %.8f %.8f\n", last ? 113U : 111U, p_lat, p_lon);
+        }
+    }
+}
+
+static void
+gen_runway(FILE *fp, gen_stats_t *stats, uint64_t *rng, double lat, double lon) {
+    const double   heading = gen_rand_range(rng, 0.0, 180.0);
+    const double   half_len = gen_rand_range(rng, 500.0, 2000.0);
+    const double   width = gen_rand_range(rng, 18.0, 61.0);
+    const double   h = heading * M_PI / 180.0;
+    const double   north = gen_rand_range(rng, -800.0, 800.0);
+    const double   east = gen_rand_range(rng, -800.0, 800.0);
+    const unsigned num = (unsigned)lround(heading / 10.0) % 18;
+    double         lat1, lon1, lat2, lon2;
+
+    gen_offset(lat, lon, north - (half_len * cos(h)), east - (half_len * sin(h)), &lat1, &lon1);
+    gen_offset(lat, lon, north + (half_len * cos(h)), east + (half_len * sin(h)), &lat2, &lon2);
+
+    gen_printf(fp, stats,
+        "100 %.2f 1 0 0.25 1 3 0 %02u %.8f %.8f 0 0 3 0 0 1 %02u %.8f %.8f 0 0 3 0 0 1\n", width,
+        (num == 0) ? 18U : num, lat1, lon1, num + 18, lat2, lon2);
+}
+
+static void
+gen_airport(FILE *fp, gen_stats_t *stats, const gen_opts_t *opts, uint64_t *rng, unsigned long n) {
+    char         ident[5];
+    const double lat = gen_rand_range(rng, -60.0, 70.0);
+    const double lon = gen_rand_range(rng, -180.0, 180.0);
+
+    if (n == 0) {
+        /* The frontend opens KLAX */
+        strcpy(ident, "KLAX");
+    } else {
+        gen_ident(n, ident);
+    }
+
+    /* Heliports are skipped by the parser, but still have to be read past */
+    if (n > 0 && (n % GEN_HELIPORT_PERIOD) == 0) {
+        gen_printf(fp, stats, "\n17 %u 0 0 H%s Synthetic Heliport %lu\n",
+            gen_rand_uint(rng, 0, 3000), ident + 1, n);
+        gen_printf(fp, stats, "102 H1 %.8f %.8f 0.00 15.00 15.00 1 0 0 0.25 0\n", lat, lon);
+    }
+
+    gen_printf(fp, stats, "\n1 %u 0 0 %s Synthetic Airport %lu\n", gen_rand_uint(rng, 0, 8000),
+        ident, n);
+    gen_printf(fp, stats, "1302 city Synthetic City %lu\n", n % 5000);
+    gen_printf(fp, stats, "1302 country Synthetic Country %lu\n", n % 200);
+    gen_printf(fp, stats, "1302 state Synthetic State %lu\n", n % 50);
+    gen_printf(fp, stats, "1302 datum_lat %.8f\n", lat);
+    gen_printf(fp, stats, "1302 datum_lon %.8f\n", lon);
+    gen_printf(fp, stats, "1302 icao_code %s\n", ident);
+    gen_printf(fp, stats, "1302 transition_alt 18000\n");
+
+    /* The parser logs KLAX's second runway */
+    const unsigned min_runways = (n == 0) ? 2 : 1;
+    const unsigned runways =
+        gen_rand_uint(rng, min_runways, (opts->max_runways > 1) ? opts->max_runways : min_runways);
+    for (unsigned i = 0; i < runways; ++i) {
+        gen_runway(fp, stats, rng, lat, lon);
+    }
+
+    const unsigned sections = gen_rand_uint(rng, 0, opts->max_pave_sections);
+    for (unsigned i = 0; i < sections; ++i) {
+        double c_lat, c_lon;
+        gen_offset(lat, lon, gen_rand_range(rng, -1500.0, 1500.0),
+            gen_rand_range(rng, -1500.0, 1500.0), &c_lat, &c_lon);
+
+        gen_printf(fp, stats, "110 %u 0.25 %.2f Taxiway %u\n", gen_rand_uint(rng, 1, 2),
+            gen_rand_range(rng, 0.0, 360.0), i);
+        gen_ring(fp, stats, rng, c_lat, c_lon, gen_rand_range(rng, 50.0, 400.0),
+            gen_rand_uint(rng, 4, opts->max_pave_nodes));
+    }
+
+    /* Painted lines, 111 nodes ended by a 115 node */
+    for (unsigned i = 0; i < opts->line_features; ++i) {
+        const unsigned nodes = gen_rand_uint(rng, 2, 8);
+        gen_printf(fp, stats, "120 Line %u\n", i);
+        for (unsigned j = 0; j < nodes; ++j) {
+            double p_lat, p_lon;
+            gen_offset(lat, lon, j * 40.0, i * 40.0, &p_lat, &p_lon);
+            gen_printf(fp, stats, "%u %.8f %.8f 1\n", (j == nodes - 1) ? 115U : 111U, p_lat, p_lon);
+        }
+    }
+
+    gen_printf(fp, stats, "1300 %.8f %.8f %.2f gate jets|turboprops Gate %lu\n", lat, lon,
+        gen_rand_range(rng, 0.0, 360.0), n);
+
+    gen_printf(fp, stats, "130 Airport Boundary\n");
+    gen_ring(fp, stats, rng, lat, lon, 3000.0, gen_rand_uint(rng, 4, opts->max_bounds_nodes));
+}
+
+static char *
+gen_path(const char *root, const char *a, const char *b) {
+    const size_t len = strlen(root) + strlen(a) + strlen(b) + 3;
+    char        *path = malloc(len);
+    snprintf(path, len, "%s/%s%s%s", root, a, (b[0] != '\0') ? "/" : "", b);
+    return path;
+}
+
+/* Airports numbered [first, last) */
+static int
+gen_pack(const gen_opts_t *opts, unsigned pack, unsigned long first, unsigned long last,
+    gen_stats_t *stats) {
+    char     pack_name[64];
+    char     pack_dir[128];
+    /* Every pack has its own stream, so packs don't depend on each other */
+    uint64_t rng = opts->seed ^ ((uint64_t)(pack + 1) * 0xD1B54A32D192ED03ULL);
+
+    snprintf(pack_name, sizeof(pack_name), GEN_PACK_NAME_FMT, pack);
+    snprintf(pack_dir, sizeof(pack_dir), "Custom Scenery/%s/Earth nav data", pack_name);
+
+    char *dir = gen_path(opts->root, pack_dir, "");
+    char *file = gen_path(opts->root, pack_dir, "apt.dat");
+
+    if (gen_mkdirs(dir) != 0) {
+        free(dir);
+        free(file);
+        return -1;
+    }
+
+    FILE *fp = fopen(file, "w");
+    if (fp == NULL) {
+        log_err("Failed to open %s", file);
+        free(dir);
+        free(file);
+        return -1;
+    }
+
+    gen_printf(fp, stats, "I\n");
+    gen_printf(fp, stats, "1100 Generated by apt_dat_gen, seed %llu\n",
+        (unsigned long long)opts->seed);
+
+    for (unsigned long n = first; n < last; ++n) {
+        gen_airport(fp, stats, opts, &rng, n);
+    }
+
+    gen_printf(fp, stats, "99\n");
+
+    fclose(fp);
+    free(dir);
+    free(file);
+
+    return 0;
+}
+
+static int
+gen_packs_ini(const gen_opts_t *opts, gen_stats_t *stats) {
+    char *file = gen_path(opts->root, GEN_PACKS_INI, "");
+    FILE *fp = fopen(file, "w");
+
+    if (fp == NULL) {
+        log_err("Failed to open %s", file);
+        free(file);
+        return -1;
+    }
+
+    gen_printf(fp, stats, "I\n1000 Version\nSCENERY\n\n");
+
+    /* Disabled packs are listed, and exist on disk, but must not be read */
+    for (unsigned i = 0; i < opts->packs + opts->disabled_packs; ++i) {
+        char pack_name[64];
+        snprintf(pack_name, sizeof(pack_name), GEN_PACK_NAME_FMT, i);
+        gen_printf(fp, stats, "%s Custom Scenery/%s/\n",
+            (i < opts->packs) ? "SCENERY_PACK" : "SCENERY_PACK_DISABLED", pack_name);
+    }
+
+    fclose(fp);
+    free(file);
+
+    return 0;
+}
+
+static void
+gen_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options] <output X-Plane root>\n"
+        "  -a, --airports N        airports in total (default 1000, ~35000 is global)\n"
+        "  -p, --packs N           scenery packs to spread them over (default 4)\n"
+        "  -d, --disabled N        extra SCENERY_PACK_DISABLED packs (default 0)\n"
+        "  -r, --runways N         max runways per airport (default 4)\n"
+        "  -s, --pave-sections N   max pavement sections per airport (default 12)\n"
+        "  -n, --pave-nodes N      max nodes per pavement section (default 32)\n"
+        "  -b, --bounds-nodes N    max airport boundary nodes (default 48)\n"
+        "  -l, --lines N           painted line features per airport (default 4)\n"
+        "  -S, --seed N            random seed (default 1)\n",
+        argv0);
+}
+
+static bool
+gen_parse_uint(const char *str, unsigned min, unsigned *out) {
+    char               *end;
+    const unsigned long val = strtoul(str, &end, 10);
+
+    if (*end != '\0' || val < min || val > 0xFFFFFFUL) {
+        return false;
+    }
+
+    *out = (unsigned)val;
+    return true;
+}
+
+int
+main(int argc, char **argv) {
+    gen_opts_t          opts = {.airports = 1000,
+                 .packs = 4,
+                 .disabled_packs = 0,
+                 .max_runways = 4,
+                 .max_pave_sections = 12,
+                 .max_pave_nodes = 32,
+                 .max_bounds_nodes = 48,
+                 .line_features = 4,
+                 .seed = 1};
+    gen_stats_t         stats = {0, 0};
+    static struct option long_opts[] = {{"airports", required_argument, NULL, 'a'},
+        {"packs", required_argument, NULL, 'p'}, {"disabled", required_argument, NULL, 'd'},
+        {"runways", required_argument, NULL, 'r'}, {"pave-sections", required_argument, NULL, 's'},
+        {"pave-nodes", required_argument, NULL, 'n'},
+        {"bounds-nodes", required_argument, NULL, 'b'}, {"lines", required_argument, NULL, 'l'},
+        {"seed", required_argument, NULL, 'S'}, {NULL, 0, NULL, 0}};
+    int                 c;
+    bool                ok = true;
+
+    while ((c = getopt_long(argc, argv, "a:p:d:r:s:n:b:l:S:", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'a':
+                ok = ok && gen_parse_uint(optarg, 1, &opts.airports);
+                break;
+            case 'p':
+                ok = ok && gen_parse_uint(optarg, 1, &opts.packs);
+                break;
+            case 'd':
+                ok = ok && gen_parse_uint(optarg, 0, &opts.disabled_packs);
+                break;
+            case 'r':
+                ok = ok && gen_parse_uint(optarg, 1, &opts.max_runways);
+                break;
+            case 's':
+                ok = ok && gen_parse_uint(optarg, 0, &opts.max_pave_sections);
+                break;
+            case 'n':
+                ok = ok && gen_parse_uint(optarg, 4, &opts.max_pave_nodes);
+                break;
+            case 'b':
+                ok = ok && gen_parse_uint(optarg, 4, &opts.max_bounds_nodes);
+                break;
+            case 'l':
+                ok = ok && gen_parse_uint(optarg, 0, &opts.line_features);
+                break;
+            case 'S':
+                opts.seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                ok = false;
+                break;
+        }
+    }
+
+    if (!ok || optind != argc - 1 || opts.packs > opts.airports) {
+        gen_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    opts.root = argv[optind];
+
+    char *scenery_dir = gen_path(opts.root, "Custom Scenery", "");
+    const int dir_ret = gen_mkdirs(scenery_dir);
+    free(scenery_dir);
+
+    if (dir_ret != 0 || gen_packs_ini(&opts, &stats) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    const unsigned long per_pack = opts.airports / opts.packs;
+
+    for (unsigned i = 0; i < opts.packs + opts.disabled_packs; ++i) {
+        unsigned long first, last;
+
+        if (i < opts.packs) {
+            first = ((unsigned long)opts.airports * i) / opts.packs;
+            last = ((unsigned long)opts.airports * (i + 1)) / opts.packs;
+        } else {
+            /* Airports of their own, which must never show up once parsed */
+            first = opts.airports + (per_pack * (i - opts.packs));
+            last = first + per_pack;
+        }
+
+        if (gen_pack(&opts, i, first, last, &stats) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    log_msg("Wrote %u airports in %u packs (+%u disabled), %lu lines, %.1f MB to %s",
+        opts.airports, opts.packs, opts.disabled_packs, stats.lines, (double)stats.bytes / 1e6,
+        opts.root);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,895 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Times each layer of the apt.dat pipeline separately (line reading,
+ * field splitting, number parsing, row dispatch) and then the real
+ * apt_dat_parse / apt_dat_db_free on the same input. Input is either an
+ * X-Plane root (scenery_packs.ini, as gam itself loads it) or a list of
+ * apt.dat files; apt_dat_gen writes synthetic trees of any size. gzip or
+ * zstd compressed files are read the way gam reads them, and MB/s is always
+ * against the plain text.
+ *
+ * Heap calls are counted through the linker's --wrap, so only code built
+ * into this executable is seen (the parser and utils, not libc itself).
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <parsers/apt_dat.h>
+#include <parsers/scenery_packs.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils/decomp_reader.h>
+#include <utils/log.h>
+#include <utils/path_hdlr.h>
+#include <utils/uring_reader.h>
+#include <utils/utils.h>
+#include <utils/vec.h>
+
+#define BENCH_DEFAULT_ITERATIONS 5
+/* Row handlers pull at most this many leading fields by index */
+#define BENCH_SPLIT_FIELDS       4
+
+VECTOR_DEFINE(bench_chars, char)
+VECTOR_DEFINE(bench_offsets, size_t)
+
+typedef struct bench_alloc_stats {
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long bytes;
+} bench_alloc_stats_t;
+
+typedef struct bench_ctx {
+    const char          **files;
+    size_t                files_size;
+
+    /* Every line of every file, newline stripped, NUL separated */
+    bench_chars_t         text;
+    bench_offsets_t       lines;
+    /* Plain text, and what it takes on disk where some files are compressed */
+    unsigned long         input_bytes;
+    unsigned long         disk_bytes;
+    size_t                compressed_files;
+
+    /* Numeric fields of runway and node rows, NUL separated */
+    bench_chars_t         numbers;
+    unsigned long         numbers_size;
+
+    airport_db_t         *db;
+} bench_ctx_t;
+
+typedef struct bench_stage {
+    const char *name;
+    const char *unit;
+    /* Reads the files itself, so it also gets a cold page cache run */
+    bool        file_io;
+    /* Throughput is reported against the raw input size */
+    bool        text_input;
+    void (*setup)(bench_ctx_t *ctx);
+    unsigned long (*run)(bench_ctx_t *ctx);
+    void (*teardown)(bench_ctx_t *ctx);
+} bench_stage_t;
+
+typedef struct bench_result {
+    const bench_stage_t *stage;
+    unsigned long        items;
+    double               best_s;
+    double               median_s;
+    double               cold_s;
+    double               cold_resident_pct;
+    bench_alloc_stats_t  alloc;
+    long                 peak_rss_kb;
+} bench_result_t;
+
+static bench_alloc_stats_t alloc_stats;
+
+/* Linker wrapped heap, see CMakeLists.txt */
+void *
+__real_malloc(size_t size);
+void *
+__real_calloc(size_t nmemb, size_t size);
+void *
+__real_realloc(void *ptr, size_t size);
+void
+__real_free(void *ptr);
+void *
+__wrap_malloc(size_t size);
+void *
+__wrap_calloc(size_t nmemb, size_t size);
+void *
+__wrap_realloc(void *ptr, size_t size);
+void
+__wrap_free(void *ptr);
+
+void *
+__wrap_malloc(size_t size) {
+    __atomic_fetch_add(&alloc_stats.allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_stats.bytes, size, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size) {
+    __atomic_fetch_add(&alloc_stats.allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_stats.bytes, nmemb * size, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&alloc_stats.allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_stats.bytes, size, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+void
+__wrap_free(void *ptr) {
+    if (ptr != NULL) {
+        __atomic_fetch_add(&alloc_stats.frees, 1, __ATOMIC_RELAXED);
+    }
+    __real_free(ptr);
+}
+
+static bench_alloc_stats_t
+bench_alloc_snapshot() {
+    bench_alloc_stats_t s;
+
+    s.allocs = __atomic_load_n(&alloc_stats.allocs, __ATOMIC_RELAXED);
+    s.frees = __atomic_load_n(&alloc_stats.frees, __ATOMIC_RELAXED);
+    s.bytes = __atomic_load_n(&alloc_stats.bytes, __ATOMIC_RELAXED);
+
+    return s;
+}
+
+/* Lowers VmHWM to the current RSS so the next read covers one stage only */
+static void
+bench_rss_reset() {
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+
+    if (fp != NULL) {
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+static long
+bench_rss_peak_kb() {
+    FILE         *fp = fopen("/proc/self/status", "r");
+    char          line[256];
+    long          kb = -1;
+    struct rusage ru;
+
+    if (fp != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) {
+                break;
+            }
+        }
+        fclose(fp);
+    }
+
+    if (kb < 0 && getrusage(RUSAGE_SELF, &ru) == 0) {
+        kb = ru.ru_maxrss;
+    }
+
+    return kb;
+}
+
+/*
+ * Asks the kernel to drop the files' pages and returns how much of them is
+ * still resident afterwards. Needs no privileges, but pages mapped by
+ * someone else stay, so the percentage is part of the result.
+ */
+static double
+bench_drop_cache(const bench_ctx_t *ctx) {
+    const long    page = sysconf(_SC_PAGESIZE);
+    unsigned long pages = 0, resident = 0;
+
+    for (size_t i = 0; i < ctx->files_size; ++i) {
+        char         *path = path_hdlr_convert_to_native(ctx->files[i]);
+        const int     fd = open(path, O_RDONLY);
+        struct stat   st;
+        void         *map;
+        unsigned char vec[4096];
+
+        free(path);
+        if (fd == -1) {
+            continue;
+        }
+
+        /* Dirty pages (e.g. a tree apt_dat_gen just wrote) can't be dropped */
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            const size_t size = (size_t)st.st_size;
+
+            map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                /* mincore() in chunks so the vector stays on the stack */
+                for (size_t off = 0; off < size; off += sizeof(vec) * (size_t)page) {
+                    const size_t len = size - off < sizeof(vec) * (size_t)page
+                                           ? size - off
+                                           : sizeof(vec) * (size_t)page;
+                    const size_t n = (len + (size_t)page - 1) / (size_t)page;
+
+                    if (mincore((char *)map + off, len, vec) != 0) {
+                        break;
+                    }
+                    for (size_t p = 0; p < n; ++p) {
+                        resident += vec[p] & 1;
+                    }
+                    pages += n;
+                }
+                munmap(map, size);
+            }
+        }
+
+        close(fd);
+    }
+
+    return pages ? (100.0 * (double)resident) / (double)pages : 0.0;
+}
+
+static void
+bench_load_line(bench_ctx_t *ctx, char *line_buf) {
+    utils_strip_newline(line_buf);
+
+    bench_offsets_push(&ctx->lines, bench_chars_size(&ctx->text));
+    bench_chars_push_n(&ctx->text, line_buf, strlen(line_buf) + 1);
+
+    const long row_code = strtol(line_buf, NULL, 10);
+    if (row_code != 100 && (row_code < 111 || row_code > 114)) {
+        return;
+    }
+
+    /* Everything after the row code that looks like a number */
+    char *save, *tok = strtok_r(line_buf, " \t", &save);
+    while ((tok = strtok_r(NULL, " \t", &save)) != NULL) {
+        char *end;
+        strtod(tok, &end);
+        if (end != tok && *end == '\0') {
+            bench_chars_push_n(&ctx->numbers, tok, strlen(tok) + 1);
+            ctx->numbers_size += 1;
+        }
+    }
+}
+
+/* gzip or zstd per the first bytes, like apt_dat_file_read tells them apart */
+static decomp_format_t
+bench_detect(const char *path) {
+    unsigned char magic[DECOMP_READER_MAGIC_SIZE];
+    const int     fd = open(path, O_RDONLY);
+    ssize_t       n;
+
+    if (fd == -1) {
+        return DECOMP_FORMAT_NONE;
+    }
+    n = read(fd, magic, sizeof(magic));
+    close(fd);
+
+    return decomp_reader_detect(magic, n > 0 ? (size_t)n : 0);
+}
+
+static void
+bench_load_compressed(bench_ctx_t *ctx, const char *path, decomp_format_t format) {
+    decomp_reader_t *dr = decomp_reader_create(path, format);
+    bench_chars_t    carry;
+    char            *data;
+    size_t           size;
+
+    if (dr == NULL) {
+        return;
+    }
+
+    bench_chars_init(&carry, 0);
+    while (decomp_reader_next(dr, &data, &size)) {
+        char *end = data + size, *nl;
+
+        ctx->input_bytes += size;
+        while ((nl = memchr(data, '\n', (size_t)(end - data))) != NULL) {
+            bench_chars_push_n(&carry, data, (size_t)(nl - data));
+            bench_chars_push(&carry, '\0');
+            bench_load_line(ctx, carry.data);
+            bench_chars_clear(&carry);
+            data = nl + 1;
+        }
+        bench_chars_push_n(&carry, data, (size_t)(end - data));
+    }
+    if (bench_chars_size(&carry) > 0) {
+        bench_chars_push(&carry, '\0');
+        bench_load_line(ctx, carry.data);
+    }
+
+    bench_chars_free(&carry);
+    decomp_reader_destroy(dr);
+}
+
+/* Loads all input once so the in-memory stages don't measure I/O */
+static void
+bench_load(bench_ctx_t *ctx) {
+    bench_chars_init(&ctx->text, 0);
+    bench_offsets_init(&ctx->lines, 0);
+    bench_chars_init(&ctx->numbers, 0);
+    ctx->input_bytes = 0;
+    ctx->disk_bytes = 0;
+    ctx->compressed_files = 0;
+    ctx->numbers_size = 0;
+
+    for (size_t i = 0; i < ctx->files_size; ++i) {
+        char                 *path = path_hdlr_convert_to_native(ctx->files[i]);
+        const decomp_format_t format = bench_detect(path);
+        FILE                 *fp;
+        char                 *line_buf = NULL;
+        size_t                line_size;
+        ssize_t               len;
+        struct stat           st;
+
+        if (stat(path, &st) == 0) {
+            ctx->disk_bytes += (unsigned long)st.st_size;
+        }
+
+        if (format != DECOMP_FORMAT_NONE) {
+            ctx->compressed_files += 1;
+            bench_load_compressed(ctx, path, format);
+            free(path);
+            continue;
+        }
+
+        if ((fp = fopen(path, "r")) == NULL) {
+            log_err("Failed to open %s", path);
+            free(path);
+            continue;
+        }
+
+        while ((len = getline(&line_buf, &line_size, fp)) != -1) {
+            ctx->input_bytes += (unsigned long)len;
+            bench_load_line(ctx, line_buf);
+        }
+
+        free(line_buf);
+        fclose(fp);
+        free(path);
+    }
+}
+
+static void
+bench_unload(bench_ctx_t *ctx) {
+    bench_chars_free(&ctx->text);
+    bench_offsets_free(&ctx->lines);
+    bench_chars_free(&ctx->numbers);
+}
+
+/* Newlines in one chunk of a file, partial tracks a line still open at its end */
+static unsigned long
+bench_count_lines(const char *data, size_t size, bool *partial) {
+    const char   *end = data + size, *nl;
+    unsigned long nlines = 0;
+
+    while ((nl = memchr(data, '\n', (size_t)(end - data))) != NULL) {
+        nlines += 1;
+        data = nl + 1;
+    }
+    *partial = (data != end) || (*partial && size == 0);
+
+    return nlines;
+}
+
+/* Compressed files in every read stage, decompressed on a thread as apt_dat_file_read does */
+static unsigned long
+bench_read_compressed(const char *path, decomp_format_t format) {
+    decomp_reader_t *dr = decomp_reader_create(path, format);
+    unsigned long    nlines = 0;
+    bool             partial = false;
+    char            *data;
+    size_t           size;
+
+    if (dr == NULL) {
+        return 0;
+    }
+
+    while (decomp_reader_next(dr, &data, &size)) {
+        nlines += bench_count_lines(data, size, &partial);
+    }
+
+    decomp_reader_destroy(dr);
+    return nlines + (partial ? 1 : 0);
+}
+
+static unsigned long
+bench_stage_read(bench_ctx_t *ctx) {
+    unsigned long nlines = 0;
+
+    /* Same loop as apt_dat_file_read without io_uring */
+    for (size_t i = 0; i < ctx->files_size; ++i) {
+        char           *path = path_hdlr_convert_to_native(ctx->files[i]);
+        FILE           *fp = fopen(path, "r");
+        char           *line_buf = NULL;
+        size_t          line_size;
+        unsigned char   magic[DECOMP_READER_MAGIC_SIZE];
+        decomp_format_t format;
+
+        if (fp == NULL) {
+            free(path);
+            continue;
+        }
+
+        format = decomp_reader_detect(magic, fread(magic, 1, sizeof(magic), fp));
+        if (format != DECOMP_FORMAT_NONE) {
+            fclose(fp);
+            nlines += bench_read_compressed(path, format);
+            free(path);
+            continue;
+        }
+        rewind(fp);
+        free(path);
+
+        while (getline(&line_buf, &line_size, fp) != -1) {
+            utils_strip_newline(line_buf);
+            nlines += 1;
+        }
+
+        free(line_buf);
+        fclose(fp);
+    }
+
+    return nlines;
+}
+
+/* The io_uring path of apt_dat_file_read, 0 lines where it isn't available */
+static unsigned long
+bench_stage_read_uring(bench_ctx_t *ctx) {
+    uring_reader_t *ur = uring_reader_create(ctx->files, ctx->files_size);
+    unsigned long   nlines = 0;
+    uring_chunk_t   chunk;
+    bool            partial = false;
+    decomp_format_t format;
+
+    if (ur == NULL) {
+        return 0;
+    }
+
+    while (uring_reader_next(ur, &chunk)) {
+        if (chunk.first) {
+            format = decomp_reader_detect(chunk.data, chunk.size);
+            if (format != DECOMP_FORMAT_NONE) {
+                uring_reader_skip(ur);
+                nlines += bench_read_compressed(ctx->files[chunk.file], format);
+                continue;
+            }
+        }
+
+        nlines += bench_count_lines(chunk.data, chunk.size, &partial);
+
+        /* Like getline, a last line without a newline still counts */
+        if (chunk.last && partial) {
+            nlines += 1;
+            partial = false;
+        }
+    }
+
+    uring_reader_destroy(ur);
+    return nlines;
+}
+
+/*
+ * Plain files mapped whole, the baseline for compressed input: run once on a
+ * plain tree and once on a compressed copy and compare read_mmap of the first
+ * with read / read_uring of the second, cold for a slow disk.
+ */
+static unsigned long
+bench_stage_read_mmap(bench_ctx_t *ctx) {
+    unsigned long nlines = 0;
+
+    for (size_t i = 0; i < ctx->files_size; ++i) {
+        char           *path = path_hdlr_convert_to_native(ctx->files[i]);
+        const int       fd = open(path, O_RDONLY);
+        struct stat     st;
+        void           *map;
+        bool            partial = false;
+        decomp_format_t format;
+
+        if (fd == -1) {
+            free(path);
+            continue;
+        }
+
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            free(path);
+            continue;
+        }
+
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            free(path);
+            continue;
+        }
+
+        format = decomp_reader_detect(map, (size_t)st.st_size);
+        if (format != DECOMP_FORMAT_NONE) {
+            munmap(map, (size_t)st.st_size);
+            nlines += bench_read_compressed(path, format);
+            free(path);
+            continue;
+        }
+        free(path);
+
+        madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+        nlines += bench_count_lines(map, (size_t)st.st_size, &partial);
+        nlines += partial ? 1 : 0;
+        munmap(map, (size_t)st.st_size);
+    }
+
+    return nlines;
+}
+
+static unsigned long
+bench_stage_tokenize(bench_ctx_t *ctx) {
+    size_t        nlines, text_size;
+    const size_t *lines = bench_offsets_span(&ctx->lines, &nlines);
+    const char   *text = bench_chars_span(&ctx->text, &text_size);
+    unsigned long fields = 0;
+
+    for (size_t i = 0; i < nlines; ++i) {
+        for (unsigned f = 0; f < BENCH_SPLIT_FIELDS; ++f) {
+            char *field = utils_str_split_at(text + lines[i], f);
+            if (field == NULL) {
+                break;
+            }
+            free(field);
+            fields += 1;
+        }
+    }
+
+    return fields;
+}
+
+static unsigned long
+bench_stage_numbers(bench_ctx_t *ctx) {
+    size_t          size;
+    const char     *num = bench_chars_span(&ctx->numbers, &size);
+    const char     *end = num + size;
+    volatile double sink = 0.0;
+
+    while (num < end) {
+        sink = sink + strtod(num, NULL);
+        num += strlen(num) + 1;
+    }
+    (void)sink;
+
+    return ctx->numbers_size;
+}
+
+static unsigned long
+bench_stage_dispatch(bench_ctx_t *ctx) {
+    size_t        nlines, text_size;
+    const size_t *lines = bench_offsets_span(&ctx->lines, &nlines);
+    const char   *text = bench_chars_span(&ctx->text, &text_size);
+    unsigned long handled = 0, skipped = 0;
+
+    /* Front half of apt_dat_gather_ap_info, without the row handlers */
+    for (size_t i = 0; i < nlines; ++i) {
+        const char *line = text + lines[i];
+        char       *row_code_s;
+        long        row_code;
+
+        if (strlen(line) > 2 && line[0] == '#' && line[1] == '#') {
+            skipped += 1;
+            continue;
+        }
+        if (strlen(line) == 0) {
+            skipped += 1;
+            continue;
+        }
+
+        row_code_s = utils_str_split_at(line, 0);
+        row_code = row_code_s ? strtol(row_code_s, NULL, 10) : -1;
+        free(row_code_s);
+
+        if (apt_dat_row_handled(row_code)) {
+            handled += 1;
+        } else {
+            skipped += 1;
+        }
+    }
+
+    return handled + skipped;
+}
+
+static unsigned long
+bench_stage_parse(bench_ctx_t *ctx) {
+    ctx->db = apt_dat_parse(ctx->files, ctx->files_size);
+    return ctx->db ? ctx->db->airports_size : 0;
+}
+
+static void
+bench_setup_parse(bench_ctx_t *ctx) {
+    bench_stage_parse(ctx);
+}
+
+static unsigned long
+bench_stage_free(bench_ctx_t *ctx) {
+    unsigned long airports;
+
+    if (ctx->db == NULL) {
+        return 0;
+    }
+
+    airports = ctx->db->airports_size;
+    ctx->db = apt_dat_db_free(ctx->db);
+
+    return airports;
+}
+
+static void
+bench_teardown_parse(bench_ctx_t *ctx) {
+    bench_stage_free(ctx);
+}
+
+static const bench_stage_t bench_stages[] = {
+    {"read", "lines", true, true, NULL, bench_stage_read, NULL},
+    {"read_uring", "lines", true, true, NULL, bench_stage_read_uring, NULL},
+    {"read_mmap", "lines", true, true, NULL, bench_stage_read_mmap, NULL},
+    {"tokenize", "fields", false, true, NULL, bench_stage_tokenize, NULL},
+    {"numbers", "numbers", false, false, NULL, bench_stage_numbers, NULL},
+    {"dispatch", "lines", false, true, NULL, bench_stage_dispatch, NULL},
+    {"parse", "airports", true, true, NULL, bench_stage_parse, bench_teardown_parse},
+    {"free", "airports", false, false, bench_setup_parse, bench_stage_free, NULL},
+};
+
+static int
+bench_cmp_double(const void *a, const void *b) {
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double
+bench_time_once(const bench_stage_t *stage, bench_ctx_t *ctx, unsigned long *items) {
+    long start;
+
+    if (stage->setup) {
+        stage->setup(ctx);
+    }
+
+    start = utils_gettime();
+    *items = stage->run(ctx);
+    const double secs = (double)(utils_gettime() - start) / 1e9;
+
+    if (stage->teardown) {
+        stage->teardown(ctx);
+    }
+
+    return secs;
+}
+
+static void
+bench_run_stage(const bench_stage_t *stage, bench_ctx_t *ctx, unsigned iterations,
+    bool cold, bench_result_t *res) {
+    double             *times = malloc(iterations * sizeof(*times));
+    bench_alloc_stats_t before, after;
+
+    memset(res, 0, sizeof(*res));
+    res->stage = stage;
+    res->cold_s = -1.0;
+    res->cold_resident_pct = -1.0;
+
+    if (cold && stage->file_io) {
+        res->cold_resident_pct = bench_drop_cache(ctx);
+        res->cold_s = bench_time_once(stage, ctx, &res->items);
+    }
+
+    /* Untimed warm-up, also the one used for allocation and RSS numbers */
+    if (stage->setup) {
+        stage->setup(ctx);
+    }
+    bench_rss_reset();
+    before = bench_alloc_snapshot();
+    res->items = stage->run(ctx);
+    after = bench_alloc_snapshot();
+    res->peak_rss_kb = bench_rss_peak_kb();
+    if (stage->teardown) {
+        stage->teardown(ctx);
+    }
+
+    res->alloc.allocs = after.allocs - before.allocs;
+    res->alloc.frees = after.frees - before.frees;
+    res->alloc.bytes = after.bytes - before.bytes;
+
+    for (unsigned i = 0; i < iterations; ++i) {
+        times[i] = bench_time_once(stage, ctx, &res->items);
+    }
+
+    qsort(times, iterations, sizeof(*times), bench_cmp_double);
+    res->best_s = times[0];
+    res->median_s = times[iterations / 2];
+
+    free(times);
+}
+
+static double
+bench_rate(double amount, double secs) {
+    return secs > 0.0 ? amount / secs : 0.0;
+}
+
+static double
+bench_stage_bytes(const bench_result_t *res, const bench_ctx_t *ctx) {
+    if (res->stage->text_input) {
+        return (double)ctx->input_bytes;
+    }
+    if (res->stage->run == bench_stage_numbers) {
+        return (double)bench_chars_size(&ctx->numbers);
+    }
+    return 0.0;
+}
+
+static void
+bench_write_json(FILE *fp, const bench_ctx_t *ctx, const bench_result_t *res, size_t res_size,
+    unsigned iterations) {
+    fprintf(fp, "{\n  \"tool\": \"gam_bench_parse\",\n");
+    fprintf(fp, "  \"files\": %zu,\n  \"compressed_files\": %zu,\n", ctx->files_size,
+        ctx->compressed_files);
+    fprintf(fp, "  \"input_bytes\": %lu,\n  \"disk_bytes\": %lu,\n  \"lines\": %zu,\n",
+        ctx->input_bytes, ctx->disk_bytes, bench_offsets_size(&ctx->lines));
+    fprintf(fp, "  \"iterations\": %u,\n  \"peak_rss_kb\": %ld,\n  \"stages\": [\n", iterations,
+        bench_rss_peak_kb());
+
+    for (size_t i = 0; i < res_size; ++i) {
+        const bench_result_t *r = &res[i];
+        const double          bytes = bench_stage_bytes(r, ctx);
+
+        fprintf(fp, "    {\"name\": \"%s\", \"unit\": \"%s\", \"items\": %lu, ", r->stage->name,
+            r->stage->unit, r->items);
+        fprintf(fp, "\"best_s\": %.6f, \"median_s\": %.6f, ", r->best_s, r->median_s);
+        if (r->cold_s >= 0.0) {
+            fprintf(fp, "\"cold_s\": %.6f, \"cold_resident_pct\": %.1f, ", r->cold_s,
+                r->cold_resident_pct);
+        } else {
+            fprintf(fp, "\"cold_s\": null, \"cold_resident_pct\": null, ");
+        }
+        if (bytes > 0.0) {
+            fprintf(fp, "\"mb_per_s\": %.2f, ", bench_rate(bytes / 1e6, r->best_s));
+        } else {
+            fprintf(fp, "\"mb_per_s\": null, ");
+        }
+        fprintf(fp, "\"items_per_s\": %.0f, ", bench_rate((double)r->items, r->best_s));
+        fprintf(fp, "\"allocs\": %lu, \"frees\": %lu, \"alloc_bytes\": %lu, ", r->alloc.allocs,
+            r->alloc.frees, r->alloc.bytes);
+        fprintf(fp, "\"peak_rss_kb\": %ld}%s\n", r->peak_rss_kb, i + 1 < res_size ? "," : "");
+    }
+
+    fprintf(fp, "  ]\n}\n");
+}
+
+static void
+bench_log_results(const bench_ctx_t *ctx, const bench_result_t *res, size_t res_size) {
+    log_msg("%zu files (%zu compressed), %.1f MB, %.1f MB on disk, %zu lines", ctx->files_size,
+        ctx->compressed_files, (double)ctx->input_bytes / 1e6, (double)ctx->disk_bytes / 1e6,
+        bench_offsets_size(&ctx->lines));
+
+    for (size_t i = 0; i < res_size; ++i) {
+        const bench_result_t *r = &res[i];
+        const double          bytes = bench_stage_bytes(r, ctx);
+
+        log_msg("%-10s %9.2f ms (median %9.2f) %12.0f %s/s %9.1f MB/s %10lu allocs %8ld kB peak",
+            r->stage->name, r->best_s * 1e3, r->median_s * 1e3,
+            bench_rate((double)r->items, r->best_s), r->stage->unit,
+            bench_rate(bytes / 1e6, r->best_s), r->alloc.allocs, r->peak_rss_kb);
+        if (r->cold_s >= 0.0) {
+            log_msg("%-10s %9.2f ms cold (%.1f%% still cached)", r->stage->name, r->cold_s * 1e3,
+                r->cold_resident_pct);
+        }
+    }
+}
+
+static void
+bench_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options] (-x <X-Plane root> | <apt.dat>...)\n"
+        "  -x, --xplane DIR      read the apt.dat files listed in DIR's scenery_packs.ini\n"
+        "  -i, --iterations N    timed runs per stage (default %d)\n"
+        "  -o, --json FILE       write results as JSON to FILE\n"
+        "  -w, --warm-only       skip the cold page cache runs\n",
+        argv0, BENCH_DEFAULT_ITERATIONS);
+}
+
+int
+main(int argc, char **argv) {
+    static const struct option long_opts[] = {{"xplane", required_argument, NULL, 'x'},
+        {"iterations", required_argument, NULL, 'i'}, {"json", required_argument, NULL, 'o'},
+        {"warm-only", no_argument, NULL, 'w'}, {NULL, 0, NULL, 0}};
+    const size_t               stages_size = sizeof(bench_stages) / sizeof(bench_stages[0]);
+    bench_result_t             results[sizeof(bench_stages) / sizeof(bench_stages[0])];
+    bench_ctx_t                ctx;
+    scenery_packs_data_t      *packs = NULL;
+    const char                *xp_root = NULL, *json_path = NULL;
+    unsigned                   iterations = BENCH_DEFAULT_ITERATIONS;
+    bool                       cold = true;
+    int                        c;
+
+    while ((c = getopt_long(argc, argv, "x:i:o:w", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'x':
+                xp_root = optarg;
+                break;
+            case 'i':
+                iterations = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                json_path = optarg;
+                break;
+            case 'w':
+                cold = false;
+                break;
+            default:
+                bench_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (iterations == 0 || (xp_root == NULL) == (optind == argc)) {
+        bench_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    if (xp_root != NULL) {
+        char **paths;
+
+        packs = scenery_packs_parse(xp_root);
+        if (packs == NULL) {
+            return EXIT_FAILURE;
+        }
+        ctx.files_size = scenery_packs_get_data(packs, &paths);
+        ctx.files = (const char **)paths;
+    } else {
+        ctx.files = (const char **)(argv + optind);
+        ctx.files_size = (size_t)(argc - optind);
+    }
+
+    bench_load(&ctx);
+    if (bench_offsets_size(&ctx.lines) == 0) {
+        log_err("No input lines");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < stages_size; ++i) {
+        bench_run_stage(&bench_stages[i], &ctx, iterations, cold, &results[i]);
+    }
+
+    bench_log_results(&ctx, results, stages_size);
+
+    if (json_path != NULL) {
+        FILE *fp = fopen(json_path, "w");
+
+        if (fp == NULL) {
+            log_err("Failed to open %s", json_path);
+            return EXIT_FAILURE;
+        }
+
+        bench_write_json(fp, &ctx, results, stages_size, iterations);
+        fclose(fp);
+    }
+
+    bench_unload(&ctx);
+    if (packs != NULL) {
+        scenery_packs_free(packs);
+    }
+
+    return EXIT_SUCCESS;
+}
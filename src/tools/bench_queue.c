@@ -0,0 +1,309 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Stress test and throughput benchmark for ts_queue. Every run moves items
+ * from producer threads to the main thread, which checks that each
+ * producer's items arrive exactly once, in order and intact:
+ *
+ *   spsc        one producer, ts_queue_push / ts_queue_front + ts_queue_pop
+ *   spsc_batch  one producer, push_n / pop_n
+ *   mpsc        several producers, ts_queue_push / ts_queue_pop_n
+ *   mpsc_batch  several producers, push_n / pop_n
+ *
+ * Batch sizes don't divide the capacity, so batches keep landing across the
+ * end of the ring. Exits non-zero if any run fails its check.
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/log.h>
+#include <utils/ts_queue.h>
+#include <utils/utils.h>
+
+#define BENCH_DEFAULT_ITEMS     10000000UL
+#define BENCH_DEFAULT_PRODUCERS 4
+#define BENCH_DEFAULT_CAPACITY  1024
+/* Odd, so batches wrap around the ring at a different offset every time */
+#define BENCH_PUSH_BATCH        37
+#define BENCH_POP_BATCH         53
+
+typedef struct bench_item {
+    uint32_t producer;
+    uint32_t seq;
+    /* Derived from both, catches torn or misplaced copies */
+    uint64_t check;
+} bench_item_t;
+
+typedef struct bench_run {
+    const char     *name;
+    ts_queue_mode_t mode;
+    bool            multi;
+    bool            batch;
+} bench_run_t;
+
+typedef struct bench_result {
+    unsigned long items;
+    double        seconds;
+    /* Times a producer found the queue full, or the consumer found it empty */
+    unsigned long full_spins;
+    unsigned long empty_spins;
+    unsigned long errors;
+} bench_result_t;
+
+typedef struct bench_producer {
+    ts_queue_t   *q;
+    uint32_t      id;
+    unsigned long items;
+    bool          batch;
+    unsigned long full_spins;
+    /* Released together, so the first one doesn't run alone */
+    volatile int *go;
+    pthread_t     thread;
+} bench_producer_t;
+
+static const bench_run_t bench_runs[] = {
+    {"spsc", TS_QUEUE_SPSC, false, false},
+    {"spsc_batch", TS_QUEUE_SPSC, false, true},
+    {"mpsc", TS_QUEUE_MPSC, true, false},
+    {"mpsc_batch", TS_QUEUE_MPSC, true, true},
+};
+
+static uint64_t
+bench_check(uint32_t producer, uint32_t seq) {
+    return (((uint64_t)producer << 32) | seq) * 0x9E3779B97F4A7C15ULL;
+}
+
+static void *
+bench_producer_thread(void *arg) {
+    bench_producer_t *p = (bench_producer_t *)arg;
+    bench_item_t      items[BENCH_PUSH_BATCH];
+    unsigned long     sent = 0;
+
+    while (__atomic_load_n(p->go, __ATOMIC_ACQUIRE) == 0) {
+        sched_yield();
+    }
+
+    while (sent < p->items) {
+        size_t n = p->batch ? BENCH_PUSH_BATCH : 1;
+        size_t pushed = 0;
+
+        if (n > p->items - sent) {
+            n = p->items - sent;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            items[i].producer = p->id;
+            items[i].seq = (uint32_t)(sent + i);
+            items[i].check = bench_check(p->id, items[i].seq);
+        }
+
+        /* Partial batches are fine, the rest goes in the next call */
+        while (pushed < n) {
+            const size_t done = p->batch ? ts_queue_push_n(p->q, items + pushed, n - pushed)
+                                         : (ts_queue_push(p->q, &items[pushed]) == 0);
+            if (done == 0) {
+                p->full_spins += 1;
+                sched_yield();
+            }
+            pushed += done;
+        }
+
+        sent += n;
+    }
+
+    return NULL;
+}
+
+/* Takes the next item for the check, false if it was bad */
+static bool
+bench_consume(const bench_item_t *item, uint32_t *expected, unsigned producers) {
+    if (item->producer >= producers || item->seq != expected[item->producer] ||
+        item->check != bench_check(item->producer, item->seq)) {
+        return false;
+    }
+
+    expected[item->producer] += 1;
+    return true;
+}
+
+static void
+bench_run(const bench_run_t *run, unsigned long items, unsigned producers, size_t capacity,
+    bench_result_t *res) {
+    ts_queue_t       *q = ts_queue_create(sizeof(bench_item_t), capacity, run->mode);
+    bench_producer_t *prod;
+    uint32_t         *expected;
+    bench_item_t      batch[BENCH_POP_BATCH];
+    volatile int      go = 0;
+    unsigned long     received = 0;
+
+    producers = run->multi ? producers : 1;
+    prod = calloc(producers, sizeof(*prod));
+    expected = calloc(producers, sizeof(*expected));
+    memset(res, 0, sizeof(*res));
+
+    for (unsigned i = 0; i < producers; ++i) {
+        prod[i].q = q;
+        prod[i].id = i;
+        /* The first producers take the remainder */
+        prod[i].items = (items / producers) + (i < items % producers ? 1 : 0);
+        prod[i].batch = run->batch;
+        prod[i].go = &go;
+        pthread_create(&prod[i].thread, NULL, bench_producer_thread, (void *)&prod[i]);
+    }
+
+    const long time_start = utils_gettime();
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+
+    while (received < items) {
+        size_t n;
+
+        if (!run->multi && !run->batch) {
+            n = (ts_queue_front(q, &batch[0]) == 0) ? 1 : 0;
+            if (n > 0) {
+                ts_queue_pop(q);
+            }
+        } else {
+            n = ts_queue_pop_n(q, batch, run->batch ? BENCH_POP_BATCH : 1);
+        }
+
+        if (n == 0) {
+            res->empty_spins += 1;
+            sched_yield();
+            continue;
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            if (!bench_consume(&batch[i], expected, producers)) {
+                res->errors += 1;
+            }
+        }
+        received += n;
+    }
+
+    res->seconds = (double)(utils_gettime() - time_start) / 1e9;
+    res->items = received;
+
+    for (unsigned i = 0; i < producers; ++i) {
+        pthread_join(prod[i].thread, NULL);
+        res->full_spins += prod[i].full_spins;
+        if (expected[i] != prod[i].items) {
+            res->errors += 1;
+        }
+    }
+
+    /* Anything left over was never expected */
+    if (ts_queue_size(q) != 0) {
+        res->errors += 1;
+    }
+
+    free(expected);
+    free(prod);
+    ts_queue_destroy(q);
+}
+
+static void
+bench_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -n, --items N         items per run, split between producers (default %lu)\n"
+        "  -p, --producers N     producer threads of the mpsc runs (default %d)\n"
+        "  -c, --capacity N      queue capacity, rounded up to a power of two (default %d)\n"
+        "  -o, --json FILE       write results as JSON to FILE\n",
+        argv0, BENCH_DEFAULT_ITEMS, BENCH_DEFAULT_PRODUCERS, BENCH_DEFAULT_CAPACITY);
+}
+
+int
+main(int argc, char **argv) {
+    static const struct option long_opts[] = {{"items", required_argument, NULL, 'n'},
+        {"producers", required_argument, NULL, 'p'}, {"capacity", required_argument, NULL, 'c'},
+        {"json", required_argument, NULL, 'o'}, {NULL, 0, NULL, 0}};
+    const size_t               runs_size = sizeof(bench_runs) / sizeof(bench_runs[0]);
+    bench_result_t             results[sizeof(bench_runs) / sizeof(bench_runs[0])];
+    unsigned long              items = BENCH_DEFAULT_ITEMS;
+    unsigned                   producers = BENCH_DEFAULT_PRODUCERS;
+    size_t                     capacity = BENCH_DEFAULT_CAPACITY;
+    const char                *json_path = NULL;
+    int                        c, ret = EXIT_SUCCESS;
+
+    while ((c = getopt_long(argc, argv, "n:p:c:o:", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'n':
+                items = strtoul(optarg, NULL, 10);
+                break;
+            case 'p':
+                producers = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                capacity = strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                json_path = optarg;
+                break;
+            default:
+                bench_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* Sequence numbers are 32 bit */
+    if (items == 0 || items > UINT32_MAX || producers == 0 || capacity == 0 || optind != argc) {
+        bench_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < runs_size; ++i) {
+        const bench_run_t *run = &bench_runs[i];
+        bench_result_t    *res = &results[i];
+
+        bench_run(run, items, producers, capacity, res);
+        log_msg("%-10s %2u producer%s  %8.2f M items/s  full %8lu  empty %8lu  %s",
+            run->name, run->multi ? producers : 1, (run->multi && producers > 1) ? "s" : " ",
+            (double)res->items / res->seconds / 1e6, res->full_spins, res->empty_spins,
+            res->errors == 0 ? "ok" : "FAILED");
+
+        if (res->errors != 0) {
+            log_err("%s: %lu items lost, duplicated, reordered or corrupt", run->name,
+                res->errors);
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if (json_path != NULL) {
+        FILE *fp = fopen(json_path, "w");
+
+        if (fp == NULL) {
+            log_err("Failed to open %s", json_path);
+            ret = EXIT_FAILURE;
+        } else {
+            fprintf(fp, "{\n  \"tool\": \"gam_bench_queue\",\n  \"items\": %lu,\n", items);
+            fprintf(fp, "  \"producers\": %u,\n  \"capacity\": %zu,\n  \"runs\": [\n", producers,
+                capacity);
+            for (size_t i = 0; i < runs_size; ++i) {
+                fprintf(fp,
+                    "    {\"name\": \"%s\", \"seconds\": %.6f, \"items_per_s\": %.0f, "
+                    "\"full_spins\": %lu, \"empty_spins\": %lu, \"errors\": %lu}%s\n",
+                    bench_runs[i].name, results[i].seconds,
+                    (double)results[i].items / results[i].seconds, results[i].full_spins,
+                    results[i].empty_spins, results[i].errors, i + 1 < runs_size ? "," : "");
+            }
+            fprintf(fp, "  ]\n}\n");
+            fclose(fp);
+        }
+    }
+
+    log_flush();
+    return ret;
+}
@@ -0,0 +1,643 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Renders the N largest airports of an apt.dat tree through the same
+ * map_view callbacks gam uses, into a cairo_offscreen surface, and reports
+ * per-airport frame times. Each airport gets one frame that records its
+ * paths and then a number of frames that only replay them, the steady state
+ * while panning or with the HUD on.
+ *
+ * With -g, every final frame is compared byte for byte against a golden
+ * image (PAM, cairo is built without PNG), so rendering changes can be shown
+ * to be pixel-exact. -u writes the goldens instead.
+ *
+ * -b repeats the replay frames for each listed band count (cairo_bands.h),
+ * reporting the speedup over the first count and how many pixels differ from
+ * its last frame.
+ *
+ * -i adds the same frames in immediate mode as the baseline, projecting the
+ * airport and building its paths every frame instead of replaying them.
+ */
+
+#include <errno.h>
+#include <gam/gam_defs.h>
+#include <gam/interface/map_view.h>
+#include <getopt.h>
+#include <graphics/cairo_bands.h>
+#include <graphics/cairo_offscreen.h>
+#include <parsers/apt_dat.h>
+#include <parsers/scenery_packs.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <utils/log.h>
+#include <utils/path_hdlr.h>
+#include <utils/utils.h>
+
+#define BENCH_DEFAULT_AIRPORTS 10
+#define BENCH_DEFAULT_FRAMES   50
+#define BENCH_MAX_RUNS         8 /* Band counts per airport */
+#define BENCH_GOLDEN_EXT       ".pam"
+#define BENCH_ACTUAL_EXT       ".actual.pam"
+
+typedef enum bench_golden {
+    BENCH_GOLDEN_NONE,
+    BENCH_GOLDEN_MATCH,
+    BENCH_GOLDEN_MISMATCH,
+    BENCH_GOLDEN_MISSING,
+    BENCH_GOLDEN_UPDATED
+} bench_golden_t;
+
+/* Replay frames at one band count */
+typedef struct bench_run {
+    double        best_ms;
+    double        median_ms;
+    double        p95_ms;
+    /* Against the first run's last frame */
+    unsigned long diff_pixels;
+    unsigned      diff_max;
+} bench_run_t;
+
+typedef struct bench_airport {
+    size_t         index;
+    unsigned long  nodes;
+    double         record_ms;
+    bench_run_t    runs[BENCH_MAX_RUNS];
+    /* At the first band count, against its last frame */
+    bench_run_t    immediate;
+    bench_golden_t golden;
+    unsigned long  diff_pixels;
+    unsigned       diff_max;
+} bench_airport_t;
+
+typedef struct bench_opts {
+    const char *golden_dir;
+    const char *json_path;
+    unsigned    airports;
+    unsigned    frames;
+    unsigned    bands[BENCH_MAX_RUNS];
+    unsigned    bands_size;
+    bool        immediate;
+    bool        update;
+} bench_opts_t;
+
+static const char *
+bench_golden_name(bench_golden_t golden) {
+    switch (golden) {
+        case BENCH_GOLDEN_NONE:
+            return "none";
+        case BENCH_GOLDEN_MATCH:
+            return "match";
+        case BENCH_GOLDEN_MISMATCH:
+            return "mismatch";
+        case BENCH_GOLDEN_MISSING:
+            return "missing";
+        case BENCH_GOLDEN_UPDATED:
+            return "updated";
+    }
+
+    return "unknown";
+}
+
+/* Everything the map draws for an airport, a rough measure of its cost */
+static unsigned long
+bench_airport_nodes(const airport_info_t *apt) {
+    size_t                  pave_size;
+    const airport_bounds_t *pave = vector_bounds_span(&apt->pave_bounds, &pave_size);
+    unsigned long           nodes = apt->runways_size;
+
+    nodes += vector_double_size(&apt->boundaries.latitude);
+    for (size_t i = 0; i < pave_size; ++i) {
+        nodes += vector_double_size(&pave[i].latitude);
+    }
+
+    return nodes;
+}
+
+static int
+bench_cmp_nodes(const void *a, const void *b) {
+    const bench_airport_t *x = (const bench_airport_t *)a, *y = (const bench_airport_t *)b;
+
+    /* Largest first, ties in database order so the selection is stable */
+    if (x->nodes != y->nodes) {
+        return x->nodes < y->nodes ? 1 : -1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static int
+bench_cmp_double(const void *a, const void *b) {
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Straight alpha RGBA rows, as PAM wants them */
+static unsigned char *
+bench_surface_rgba(cairo_surface_t *surface, int *width, int *height) {
+    const int      w = cairo_image_surface_get_width(surface);
+    const int      h = cairo_image_surface_get_height(surface);
+    const int      stride = cairo_image_surface_get_stride(surface);
+    unsigned char *data = cairo_image_surface_get_data(surface);
+    unsigned char *rgba = malloc((size_t)w * (size_t)h * 4);
+
+    cairo_surface_flush(surface);
+
+    for (int y = 0; y < h; ++y) {
+        const uint32_t *row = (const uint32_t *)(void *)(data + ((size_t)y * (size_t)stride));
+        unsigned char  *out = rgba + ((size_t)y * (size_t)w * 4);
+
+        for (int x = 0; x < w; ++x) {
+            const uint32_t px = row[x];
+            const unsigned a = px >> 24;
+            unsigned       c[3] = {(px >> 16) & 0xFF, (px >> 8) & 0xFF, px & 0xFF};
+
+            /* Cairo is premultiplied, exact for the opaque pixels the map draws */
+            for (int i = 0; i < 3; ++i) {
+                c[i] = a ? ((c[i] * 255) + (a / 2)) / a : 0;
+                out[(x * 4) + i] = (unsigned char)c[i];
+            }
+            out[(x * 4) + 3] = (unsigned char)a;
+        }
+    }
+
+    *width = w;
+    *height = h;
+    return rgba;
+}
+
+static bool
+bench_pam_write(const char *path, const unsigned char *rgba, int width, int height) {
+    FILE *fp = fopen(path, "wb");
+    bool  ok;
+
+    if (fp == NULL) {
+        log_err("Failed to open %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    fprintf(fp, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+        width, height);
+    ok = fwrite(rgba, 4, (size_t)width * (size_t)height, fp) == (size_t)width * (size_t)height;
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok) {
+        log_err("Failed to write %s", path);
+    }
+    return ok;
+}
+
+/* Only reads what bench_pam_write writes */
+static unsigned char *
+bench_pam_read(const char *path, int *width, int *height) {
+    FILE          *fp = fopen(path, "rb");
+    char           line[128];
+    int            depth = 0, maxval = 0;
+    unsigned char *rgba;
+    size_t         pixels;
+
+    *width = 0;
+    *height = 0;
+
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    if (fgets(line, sizeof(line), fp) == NULL || strcmp(line, "P7\n") != 0) {
+        fclose(fp);
+        return NULL;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL && strcmp(line, "ENDHDR\n") != 0) {
+        sscanf(line, "WIDTH %d", width);
+        sscanf(line, "HEIGHT %d", height);
+        sscanf(line, "DEPTH %d", &depth);
+        sscanf(line, "MAXVAL %d", &maxval);
+    }
+
+    if (*width <= 0 || *height <= 0 || depth != 4 || maxval != 255) {
+        fclose(fp);
+        return NULL;
+    }
+
+    pixels = (size_t)*width * (size_t)*height;
+    rgba = malloc(pixels * 4);
+    if (fread(rgba, 4, pixels, fp) != pixels) {
+        free(rgba);
+        rgba = NULL;
+    }
+
+    fclose(fp);
+    return rgba;
+}
+
+/* Same naming as gam_thumbs, idents repeat across scenery packs and the index keeps them apart */
+static char *
+bench_golden_path(const char *dir, size_t index, const char *icao, const char *ext) {
+    char ident[32], name[64];
+
+    /* Idents are plain alphanumerics, but they end up in a file name */
+    utils_str_sanitize(ident, sizeof(ident), icao != NULL ? icao : "");
+    /* path_hdlr_join_paths doesn't add a separator, the index alone without an ident */
+    if (ident[0] == '\0') {
+        snprintf(name, sizeof(name), "/%06zu%s", index, ext);
+    } else {
+        snprintf(name, sizeof(name), "/%06zu_%s%s", index, ident, ext);
+    }
+
+    return path_hdlr_join_paths(dir, name);
+}
+
+/* Pixels that differ in any channel, and the largest difference */
+static void
+bench_diff(const unsigned char *a, const unsigned char *b, size_t bytes, unsigned long *pixels,
+    unsigned *max) {
+    *pixels = 0;
+    *max = 0;
+
+    for (size_t i = 0; i < bytes; i += 4) {
+        unsigned px_diff = 0;
+
+        for (size_t c = 0; c < 4; ++c) {
+            const unsigned d = (unsigned)abs((int)a[i + c] - (int)b[i + c]);
+            px_diff = d > px_diff ? d : px_diff;
+        }
+
+        if (px_diff > 0) {
+            *pixels += 1;
+            *max = px_diff > *max ? px_diff : *max;
+        }
+    }
+}
+
+static void
+bench_golden_check(const bench_opts_t *opts, const airport_info_t *apt,
+    const unsigned char *rgba, int width, int height, bench_airport_t *res) {
+    int   g_width, g_height;
+    char *path = bench_golden_path(opts->golden_dir, res->index, apt->icao, BENCH_GOLDEN_EXT);
+
+    if (opts->update) {
+        res->golden = bench_pam_write(path, rgba, width, height) ? BENCH_GOLDEN_UPDATED
+                                                                 : BENCH_GOLDEN_MISSING;
+        free(path);
+        return;
+    }
+
+    unsigned char *golden = bench_pam_read(path, &g_width, &g_height);
+
+    if (golden == NULL || g_width != width || g_height != height) {
+        log_err("%s: no usable golden image at %s", apt->icao, path);
+        res->golden = BENCH_GOLDEN_MISSING;
+    } else {
+        bench_diff(rgba, golden, (size_t)width * (size_t)height * 4, &res->diff_pixels,
+            &res->diff_max);
+        res->golden = res->diff_pixels ? BENCH_GOLDEN_MISMATCH : BENCH_GOLDEN_MATCH;
+    }
+
+    /* Next to the golden, for looking at the difference */
+    if (res->golden == BENCH_GOLDEN_MISMATCH) {
+        char *actual =
+            bench_golden_path(opts->golden_dir, res->index, apt->icao, BENCH_ACTUAL_EXT);
+        bench_pam_write(actual, rgba, width, height);
+        free(actual);
+    }
+
+    free(golden);
+    free(path);
+}
+
+static void
+bench_replay(const bench_opts_t *opts, map_view_t *view, cairo_offscreen_t *cos, bench_run_t *run) {
+    double *times = malloc(opts->frames * sizeof(*times));
+
+    for (unsigned i = 0; i < opts->frames; ++i) {
+        map_view_invalidate(view, false);
+        times[i] = (double)cairo_offscreen_frame(cos) / 1e6;
+    }
+
+    qsort(times, opts->frames, sizeof(*times), bench_cmp_double);
+    run->best_ms = times[0];
+    run->median_ms = times[opts->frames / 2];
+    run->p95_ms = times[((opts->frames - 1) * 95) / 100];
+    run->diff_pixels = 0;
+    run->diff_max = 0;
+    free(times);
+}
+
+static void
+bench_render_airport(const bench_opts_t *opts, const airport_db_t *db, map_view_t *view,
+    cairo_offscreen_t *cos, bench_airport_t *res) {
+    unsigned char *rgba;
+    int            width, height;
+
+    /* Paths are recorded once, then every frame only replays them */
+    map_view_set_airport(view, res->index);
+    map_view_invalidate(view, true);
+    cairo_offscreen_set_bands(cos, opts->bands[0]);
+    res->record_ms = (double)cairo_offscreen_frame(cos) / 1e6;
+
+    bench_replay(opts, view, cos, &res->runs[0]);
+    rgba = bench_surface_rgba(cairo_offscreen_get_surface(cos), &width, &height);
+
+    for (unsigned i = 1; i < opts->bands_size; ++i) {
+        bench_run_t   *run = &res->runs[i];
+        unsigned char *banded;
+
+        cairo_offscreen_set_bands(cos, opts->bands[i]);
+        bench_replay(opts, view, cos, run);
+
+        banded = bench_surface_rgba(cairo_offscreen_get_surface(cos), &width, &height);
+        bench_diff(rgba, banded, (size_t)width * (size_t)height * 4, &run->diff_pixels,
+            &run->diff_max);
+        free(banded);
+    }
+
+    if (opts->immediate) {
+        unsigned char *immediate;
+
+        cairo_offscreen_set_bands(cos, opts->bands[0]);
+        map_view_set_immediate(view, true);
+        bench_replay(opts, view, cos, &res->immediate);
+        map_view_set_immediate(view, false);
+
+        immediate = bench_surface_rgba(cairo_offscreen_get_surface(cos), &width, &height);
+        bench_diff(rgba, immediate, (size_t)width * (size_t)height * 4,
+            &res->immediate.diff_pixels, &res->immediate.diff_max);
+        free(immediate);
+    }
+
+    res->golden = BENCH_GOLDEN_NONE;
+    res->diff_pixels = 0;
+    res->diff_max = 0;
+    if (opts->golden_dir != NULL) {
+        bench_golden_check(opts, &db->airports[res->index], rgba, width, height, res);
+    }
+
+    free(rgba);
+}
+
+static void
+bench_write_json(FILE *fp, const bench_opts_t *opts, const airport_db_t *db,
+    const bench_airport_t *res, size_t res_size) {
+    fprintf(fp, "{\n  \"tool\": \"gam_bench_render\",\n");
+    fprintf(fp, "  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %u,\n  \"airports\": [\n",
+        GAM_WINDOW_WIDTH, GAM_WINDOW_HEIGHT, opts->frames);
+
+    for (size_t i = 0; i < res_size; ++i) {
+        const bench_airport_t *r = &res[i];
+
+        fprintf(fp, "    {\"icao\": \"%s\", \"nodes\": %lu, ", db->airports[r->index].icao,
+            r->nodes);
+        fprintf(fp, "\"record_ms\": %.4f, \"best_ms\": %.4f, \"median_ms\": %.4f, ",
+            r->record_ms, r->runs[0].best_ms, r->runs[0].median_ms);
+        fprintf(fp, "\"p95_ms\": %.4f, \"golden\": \"%s\", \"diff_pixels\": %lu, ",
+            r->runs[0].p95_ms, bench_golden_name(r->golden), r->diff_pixels);
+        fprintf(fp, "\"diff_max\": %u, \"bands\": [", r->diff_max);
+
+        for (unsigned j = 0; j < opts->bands_size; ++j) {
+            const bench_run_t *run = &r->runs[j];
+
+            fprintf(fp, "{\"bands\": %u, \"best_ms\": %.4f, \"median_ms\": %.4f, ",
+                opts->bands[j], run->best_ms, run->median_ms);
+            fprintf(fp, "\"p95_ms\": %.4f, \"diff_pixels\": %lu, \"diff_max\": %u}%s",
+                run->p95_ms, run->diff_pixels, run->diff_max, j + 1 < opts->bands_size ? ", " : "");
+        }
+        fprintf(fp, "]");
+
+        if (opts->immediate) {
+            fprintf(fp, ", \"immediate\": {\"best_ms\": %.4f, \"median_ms\": %.4f, ",
+                r->immediate.best_ms, r->immediate.median_ms);
+            fprintf(fp, "\"p95_ms\": %.4f, \"diff_pixels\": %lu, \"diff_max\": %u}",
+                r->immediate.p95_ms, r->immediate.diff_pixels, r->immediate.diff_max);
+        }
+        fprintf(fp, "}%s\n", i + 1 < res_size ? "," : "");
+    }
+
+    fprintf(fp, "  ]\n}\n");
+}
+
+/* Comma separated band counts, each within what cairo_bands can split the surface into */
+static bool
+bench_parse_bands(const char *arg, bench_opts_t *opts) {
+    const char *p = arg;
+
+    opts->bands_size = 0;
+
+    for (;;) {
+        char         *end;
+        unsigned long bands = strtoul(p, &end, 10);
+
+        if (end == p || bands == 0 || bands > CAIRO_BANDS_MAX || bands > GAM_WINDOW_HEIGHT ||
+            opts->bands_size == BENCH_MAX_RUNS) {
+            return false;
+        }
+        opts->bands[opts->bands_size++] = (unsigned)bands;
+
+        if (*end == '\0') {
+            return true;
+        }
+        if (*end != ',') {
+            return false;
+        }
+        p = end + 1;
+    }
+}
+
+static void
+bench_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options] (-x <X-Plane root> | <apt.dat>...)\n"
+        "  -x, --xplane DIR      read the apt.dat files listed in DIR's scenery_packs.ini\n"
+        "  -n, --airports N      render the N largest airports (default %d)\n"
+        "  -f, --frames N        timed replay frames per airport (default %d)\n"
+        "  -b, --bands N,...     repeat the replay frames with each band count (default 1)\n"
+        "  -i, --immediate       also time the frames building every path, without replay\n"
+        "  -g, --golden DIR      compare each airport's last frame against DIR/<index>_<icao>.pam\n"
+        "  -u, --update          write the golden images instead of comparing\n"
+        "  -o, --json FILE       write results as JSON to FILE\n",
+        argv0, BENCH_DEFAULT_AIRPORTS, BENCH_DEFAULT_FRAMES);
+}
+
+int
+main(int argc, char **argv) {
+    static const struct option long_opts[] = {{"xplane", required_argument, NULL, 'x'},
+        {"airports", required_argument, NULL, 'n'}, {"frames", required_argument, NULL, 'f'},
+        {"golden", required_argument, NULL, 'g'}, {"update", no_argument, NULL, 'u'},
+        {"json", required_argument, NULL, 'o'}, {"bands", required_argument, NULL, 'b'},
+        {"immediate", no_argument, NULL, 'i'}, {NULL, 0, NULL, 0}};
+    bench_opts_t               opts = {.golden_dir = NULL,
+                      .json_path = NULL,
+                      .airports = BENCH_DEFAULT_AIRPORTS,
+                      .frames = BENCH_DEFAULT_FRAMES,
+                      .bands = {1},
+                      .bands_size = 1,
+                      .immediate = false,
+                      .update = false};
+    scenery_packs_data_t      *packs = NULL;
+    const char                *xp_root = NULL;
+    const char               **files;
+    size_t                     files_size;
+    airport_db_t              *db;
+    bench_airport_t           *ranked;
+    map_view_t                *view;
+    cairo_offscreen_t         *cos;
+    size_t                     ranked_size;
+    int                        c, ret = EXIT_SUCCESS;
+
+    while ((c = getopt_long(argc, argv, "x:n:f:g:uo:b:i", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'x':
+                xp_root = optarg;
+                break;
+            case 'n':
+                opts.airports = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                opts.frames = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'g':
+                opts.golden_dir = optarg;
+                break;
+            case 'u':
+                opts.update = true;
+                break;
+            case 'o':
+                opts.json_path = optarg;
+                break;
+            case 'b':
+                if (!bench_parse_bands(optarg, &opts)) {
+                    bench_usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'i':
+                opts.immediate = true;
+                break;
+            default:
+                bench_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (opts.airports == 0 || opts.frames == 0 || (xp_root == NULL) == (optind == argc) ||
+        (opts.update && opts.golden_dir == NULL)) {
+        bench_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (xp_root != NULL) {
+        char **paths;
+
+        packs = scenery_packs_parse(xp_root);
+        if (packs == NULL) {
+            return EXIT_FAILURE;
+        }
+        files_size = scenery_packs_get_data(packs, &paths);
+        files = (const char **)paths;
+    } else {
+        files = (const char **)(argv + optind);
+        files_size = (size_t)(argc - optind);
+    }
+
+    db = apt_dat_parse(files, files_size);
+    if (db == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    if (db->airports_size == 0) {
+        log_err("No airports in the given apt.dat files");
+        apt_dat_db_free(db);
+        return EXIT_FAILURE;
+    }
+
+    if (opts.update && mkdir(opts.golden_dir, 0755) != 0 && errno != EEXIST) {
+        log_err("Failed to create %s: %s", opts.golden_dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    ranked = calloc(db->airports_size, sizeof(*ranked));
+    for (size_t i = 0; i < db->airports_size; ++i) {
+        ranked[i].index = i;
+        ranked[i].nodes = bench_airport_nodes(&db->airports[i]);
+    }
+    qsort(ranked, db->airports_size, sizeof(*ranked), bench_cmp_nodes);
+    ranked_size = opts.airports < db->airports_size ? opts.airports : db->airports_size;
+
+    /* No HUD, it shows frame times and would never match a golden image */
+    view = map_view_create(db, ranked[0].index, false);
+    cos = cairo_offscreen_create(GAM_WINDOW_WIDTH, GAM_WINDOW_HEIGHT);
+    cairo_offscreen_set_callbacks(cos, map_view_start, map_view_paint, map_view_end);
+    cairo_offscreen_set_prepare(cos, map_view_prepare);
+    cairo_offscreen_set_clear(cos, false);
+    cairo_offscreen_start(cos, view);
+
+    /* Rasterizes the background, which never changes after this */
+    cairo_offscreen_frame(cos);
+
+    for (size_t i = 0; i < ranked_size; ++i) {
+        bench_airport_t *r = &ranked[i];
+
+        bench_render_airport(&opts, db, view, cos, r);
+        log_msg("%-8s %7lu nodes  record %8.3f ms  replay best %8.3f median %8.3f p95 %8.3f ms%s%s",
+            db->airports[r->index].icao, r->nodes, r->record_ms, r->runs[0].best_ms,
+            r->runs[0].median_ms, r->runs[0].p95_ms,
+            r->golden == BENCH_GOLDEN_NONE ? "" : "  golden ",
+            r->golden == BENCH_GOLDEN_NONE ? "" : bench_golden_name(r->golden));
+
+        for (unsigned j = 1; j < opts.bands_size; ++j) {
+            const bench_run_t *run = &r->runs[j];
+
+            log_msg("%-8s %2u bands  replay best %8.3f median %8.3f p95 %8.3f ms  x%.2f  "
+                    "%lu pixels differ from %u bands, by up to %u",
+                "", opts.bands[j], run->best_ms, run->median_ms, run->p95_ms,
+                r->runs[0].median_ms / run->median_ms, run->diff_pixels, opts.bands[0],
+                run->diff_max);
+        }
+
+        if (opts.immediate) {
+            log_msg("%-8s immediate  best %8.3f median %8.3f p95 %8.3f ms  replay x%.2f  "
+                    "%lu pixels differ from replay, by up to %u",
+                "", r->immediate.best_ms, r->immediate.median_ms, r->immediate.p95_ms,
+                r->immediate.median_ms / r->runs[0].median_ms, r->immediate.diff_pixels,
+                r->immediate.diff_max);
+        }
+
+        if (r->golden == BENCH_GOLDEN_MISMATCH || r->golden == BENCH_GOLDEN_MISSING) {
+            ret = EXIT_FAILURE;
+        }
+        if (r->golden == BENCH_GOLDEN_MISMATCH) {
+            log_err("%s: %lu pixels differ, by up to %u", db->airports[r->index].icao,
+                r->diff_pixels, r->diff_max);
+        }
+    }
+
+    if (opts.json_path != NULL) {
+        FILE *fp = fopen(opts.json_path, "w");
+
+        if (fp == NULL) {
+            log_err("Failed to open %s", opts.json_path);
+            ret = EXIT_FAILURE;
+        } else {
+            bench_write_json(fp, &opts, db, ranked, ranked_size);
+            fclose(fp);
+        }
+    }
+
+    /* Calls map_view_end, which frees the view */
+    cos = cairo_offscreen_destroy(cos);
+    free(ranked);
+    apt_dat_db_free(db);
+    if (packs != NULL) {
+        scenery_packs_free(packs);
+    }
+
+    return ret;
+}
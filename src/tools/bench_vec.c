@@ -0,0 +1,336 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Times vec.h's typed vectors against the untyped vector_t they replaced
+ * (bench_vec_legacy.c), on the access patterns gam has:
+ *
+ *   doubles  push N doubles, then sum them, as one big coordinate array
+ *   rings    many short rings of doubles, built, summed and freed, as the
+ *            parser does with airport boundaries and pavement outlines
+ *   structs  push N 32 byte records, then read them back in order, as the
+ *            display list does
+ *
+ * Both sides compute the same checksum, exits non-zero if they differ.
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utils/log.h>
+#include <utils/utils.h>
+#include <utils/vec.h>
+
+#include "bench_vec_legacy.h"
+
+#define BENCH_DEFAULT_ITEMS      20000000UL
+#define BENCH_DEFAULT_ITERATIONS 5
+#define BENCH_RING_MIN           8
+#define BENCH_RING_MAX           40
+
+typedef struct bench_record {
+    double   x;
+    double   y;
+    uint32_t kind;
+    uint32_t flags;
+    double   width;
+} bench_record_t;
+
+VECTOR_DEFINE(bench_records, bench_record_t)
+
+typedef struct bench_case {
+    const char *name;
+    double (*legacy)(unsigned long items);
+    double (*typed)(unsigned long items);
+} bench_case_t;
+
+typedef struct bench_result {
+    double legacy_best_s;
+    double legacy_median_s;
+    double typed_best_s;
+    double typed_median_s;
+    bool   checksum_ok;
+} bench_result_t;
+
+/* Varies from one ring to the next, the modulo runs once per ring rather than per element */
+static size_t
+bench_ring_size(unsigned long ring) {
+    return BENCH_RING_MIN + (ring * 7) % (BENCH_RING_MAX - BENCH_RING_MIN);
+}
+
+static double
+bench_doubles_legacy(unsigned long items) {
+    legacy_vector_t *vec = legacy_vector_create(sizeof(double), VECTOR_INIT_CAPACITY);
+    double           sum = 0.0;
+
+    for (unsigned long i = 0; i < items; ++i) {
+        double d = (double)i * 0.5;
+        legacy_vector_push(vec, &d);
+    }
+    for (size_t i = 0; i < legacy_vector_size(vec); ++i) {
+        double d;
+        legacy_vector_get(vec, i, &d);
+        sum += d;
+    }
+
+    legacy_vector_destroy(vec);
+    return sum;
+}
+
+static double
+bench_doubles_typed(unsigned long items) {
+    vector_double_t vec;
+    const double   *data;
+    size_t          size;
+    double          sum = 0.0;
+
+    vector_double_init(&vec, VECTOR_INIT_CAPACITY);
+    for (unsigned long i = 0; i < items; ++i) {
+        vector_double_push(&vec, (double)i * 0.5);
+    }
+    data = vector_double_span(&vec, &size);
+    for (size_t i = 0; i < size; ++i) {
+        sum += data[i];
+    }
+
+    vector_double_free(&vec);
+    return sum;
+}
+
+static double
+bench_rings_legacy(unsigned long items) {
+    double        sum = 0.0;
+    unsigned long done = 0;
+
+    for (unsigned long ring = 0; done < items; ++ring) {
+        const size_t     size = bench_ring_size(ring);
+        legacy_vector_t *vec = legacy_vector_create(sizeof(double), VECTOR_INIT_CAPACITY);
+
+        for (size_t i = 0; i < size; ++i) {
+            double d = (double)(done + i);
+            legacy_vector_push(vec, &d);
+        }
+        for (size_t i = 0; i < legacy_vector_size(vec); ++i) {
+            double d;
+            legacy_vector_get(vec, i, &d);
+            sum += d;
+        }
+
+        legacy_vector_destroy(vec);
+        done += size;
+    }
+
+    return sum;
+}
+
+static double
+bench_rings_typed(unsigned long items) {
+    double        sum = 0.0;
+    unsigned long done = 0;
+
+    for (unsigned long ring = 0; done < items; ++ring) {
+        const size_t    size = bench_ring_size(ring);
+        vector_double_t vec;
+        const double   *data;
+        size_t          data_size;
+
+        vector_double_init(&vec, VECTOR_INIT_CAPACITY);
+        for (size_t i = 0; i < size; ++i) {
+            vector_double_push(&vec, (double)(done + i));
+        }
+        data = vector_double_span(&vec, &data_size);
+        for (size_t i = 0; i < data_size; ++i) {
+            sum += data[i];
+        }
+
+        vector_double_free(&vec);
+        done += size;
+    }
+
+    return sum;
+}
+
+static bench_record_t
+bench_record(unsigned long i) {
+    bench_record_t r = {(double)i, (double)i * 2.0, (uint32_t)(i & 0xf), (uint32_t)i, 0.25};
+    return r;
+}
+
+static double
+bench_record_sum(const bench_record_t *r) {
+    return r->x + r->y + r->width + (double)(r->kind ^ (r->flags & 0xff));
+}
+
+static double
+bench_structs_legacy(unsigned long items) {
+    legacy_vector_t *vec = legacy_vector_create(sizeof(bench_record_t), VECTOR_INIT_CAPACITY);
+    double           sum = 0.0;
+
+    for (unsigned long i = 0; i < items; ++i) {
+        bench_record_t r = bench_record(i);
+        legacy_vector_push(vec, &r);
+    }
+    for (size_t i = 0; i < legacy_vector_size(vec); ++i) {
+        void *r;
+        legacy_vector_get_ref(vec, i, &r);
+        sum += bench_record_sum((const bench_record_t *)r);
+    }
+
+    legacy_vector_destroy(vec);
+    return sum;
+}
+
+static double
+bench_structs_typed(unsigned long items) {
+    bench_records_t       vec;
+    const bench_record_t *data;
+    size_t                size;
+    double                sum = 0.0;
+
+    bench_records_init(&vec, VECTOR_INIT_CAPACITY);
+    for (unsigned long i = 0; i < items; ++i) {
+        bench_records_push(&vec, bench_record(i));
+    }
+    data = bench_records_span(&vec, &size);
+    for (size_t i = 0; i < size; ++i) {
+        sum += bench_record_sum(&data[i]);
+    }
+
+    bench_records_free(&vec);
+    return sum;
+}
+
+static const bench_case_t bench_cases[] = {
+    {"doubles", bench_doubles_legacy, bench_doubles_typed},
+    {"rings", bench_rings_legacy, bench_rings_typed},
+    {"structs", bench_structs_legacy, bench_structs_typed},
+};
+
+static int
+bench_cmp_double(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Best and median of several timed runs, checksum of the last one */
+static double
+bench_time(double (*run)(unsigned long), unsigned long items, unsigned iterations,
+    double *best_s, double *median_s) {
+    double *times = malloc(iterations * sizeof(*times));
+    double  sum = 0.0;
+
+    for (unsigned i = 0; i < iterations; ++i) {
+        const long time_start = utils_gettime();
+        sum = run(items);
+        times[i] = (double)(utils_gettime() - time_start) / 1e9;
+    }
+
+    qsort(times, iterations, sizeof(*times), bench_cmp_double);
+    *best_s = times[0];
+    *median_s = times[iterations / 2];
+
+    free(times);
+    return sum;
+}
+
+static void
+bench_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -n, --items N         elements per case (default %lu)\n"
+        "  -i, --iterations N    timed runs per case and vector (default %d)\n"
+        "  -o, --json FILE       write results as JSON to FILE\n",
+        argv0, BENCH_DEFAULT_ITEMS, BENCH_DEFAULT_ITERATIONS);
+}
+
+int
+main(int argc, char **argv) {
+    static const struct option long_opts[] = {{"items", required_argument, NULL, 'n'},
+        {"iterations", required_argument, NULL, 'i'}, {"json", required_argument, NULL, 'o'},
+        {NULL, 0, NULL, 0}};
+    const size_t               cases_size = sizeof(bench_cases) / sizeof(bench_cases[0]);
+    bench_result_t             results[sizeof(bench_cases) / sizeof(bench_cases[0])];
+    unsigned long              items = BENCH_DEFAULT_ITEMS;
+    unsigned                   iterations = BENCH_DEFAULT_ITERATIONS;
+    const char                *json_path = NULL;
+    int                        c, ret = EXIT_SUCCESS;
+
+    while ((c = getopt_long(argc, argv, "n:i:o:", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'n':
+                items = strtoul(optarg, NULL, 10);
+                break;
+            case 'i':
+                iterations = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                json_path = optarg;
+                break;
+            default:
+                bench_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (items == 0 || iterations == 0 || optind != argc) {
+        bench_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < cases_size; ++i) {
+        const bench_case_t *bc = &bench_cases[i];
+        bench_result_t     *res = &results[i];
+        double              legacy_sum, typed_sum;
+
+        legacy_sum = bench_time(
+            bc->legacy, items, iterations, &res->legacy_best_s, &res->legacy_median_s);
+        typed_sum =
+            bench_time(bc->typed, items, iterations, &res->typed_best_s, &res->typed_median_s);
+        res->checksum_ok = legacy_sum == typed_sum;
+
+        log_msg("%-8s vector_t %8.1f ms (median %8.1f)  typed %8.1f ms (median %8.1f)  %.2fx",
+            bc->name, res->legacy_best_s * 1e3, res->legacy_median_s * 1e3,
+            res->typed_best_s * 1e3, res->typed_median_s * 1e3,
+            res->typed_best_s > 0.0 ? res->legacy_best_s / res->typed_best_s : 0.0);
+
+        if (!res->checksum_ok) {
+            log_err("%s: checksums differ, %f vs %f", bc->name, legacy_sum, typed_sum);
+            ret = EXIT_FAILURE;
+        }
+    }
+
+    if (json_path != NULL) {
+        FILE *fp = fopen(json_path, "w");
+
+        if (fp == NULL) {
+            log_err("Failed to open %s", json_path);
+            ret = EXIT_FAILURE;
+        } else {
+            fprintf(fp, "{\n  \"tool\": \"gam_bench_vec\",\n  \"items\": %lu,\n", items);
+            fprintf(fp, "  \"iterations\": %u,\n  \"cases\": [\n", iterations);
+            for (size_t i = 0; i < cases_size; ++i) {
+                fprintf(fp,
+                    "    {\"name\": \"%s\", \"legacy_best_s\": %.6f, \"legacy_median_s\": %.6f, "
+                    "\"typed_best_s\": %.6f, \"typed_median_s\": %.6f, \"checksum_ok\": %s}%s\n",
+                    bench_cases[i].name, results[i].legacy_best_s, results[i].legacy_median_s,
+                    results[i].typed_best_s, results[i].typed_median_s,
+                    results[i].checksum_ok ? "true" : "false", i + 1 < cases_size ? "," : "");
+            }
+            fprintf(fp, "  ]\n}\n");
+            fclose(fp);
+        }
+    }
+
+    log_flush();
+    return ret;
+}
@@ -6,23 +6,23 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
-#include "vec.h"
+#include "bench_vec_legacy.h"
 
 #include <stdint.h>
 #include <stdlib.h>
 
-#include "log.h"
+#include <utils/log.h>
 
-struct vector {
+struct legacy_vector {
     size_t size;
     size_t capacity;
     size_t data_size;
     void  *data;
 };
 
-vector_t *
-vector_create(size_t data_size, size_t init_size) {
-    vector_t *vec;
+legacy_vector_t *
+legacy_vector_create(size_t data_size, size_t init_size) {
+    legacy_vector_t *vec;
 
     vec = malloc(sizeof(*vec));
 
@@ -35,7 +35,7 @@ vector_create(size_t data_size, size_t init_size) {
 }
 
 static void
-vector_check_reallocate(vector_t *vec) {
+legacy_vector_check_reallocate(legacy_vector_t *vec) {
     ASSERT(vec != NULL);
 
     if ((vec->size + 1) < vec->capacity) {
@@ -51,35 +51,35 @@ vector_check_reallocate(vector_t *vec) {
 }
 
 void *
-vector_begin(const vector_t *vec) {
+legacy_vector_begin(const legacy_vector_t *vec) {
     ASSERT(vec != NULL);
     return vec->data;
 }
 
 void *
-vector_end(const vector_t *vec) {
+legacy_vector_end(const legacy_vector_t *vec) {
     ASSERT(vec != NULL);
     void *end = (uint8_t *)vec->data + (vec->size * vec->data_size);
     return end;
 }
 
 void
-vector_push(vector_t *vec, void *elem) {
+legacy_vector_push(legacy_vector_t *vec, void *elem) {
     ASSERT(vec != NULL);
     ASSERT(elem != NULL);
     void *vec_end;
 
     /* Reallocate if necessary */
-    vector_check_reallocate(vec);
+    legacy_vector_check_reallocate(vec);
 
-    vec_end = vector_end(vec);
+    vec_end = legacy_vector_end(vec);
     memcpy(vec_end, elem, vec->data_size);
 
     vec->size += 1;
 }
 
 void
-vector_get_ref(const vector_t *vec, size_t index, void **data_out) {
+legacy_vector_get_ref(const legacy_vector_t *vec, size_t index, void **data_out) {
     ASSERT(vec != NULL);
     ASSERT(index < vec->size);
     void *index_pos = (uint8_t *)vec->data + (index * vec->data_size);
@@ -87,7 +87,7 @@ vector_get_ref(const vector_t *vec, size_t index, void **data_out) {
 }
 
 void
-vector_get(const vector_t *vec, size_t index, void *data_out) {
+legacy_vector_get(const legacy_vector_t *vec, size_t index, void *data_out) {
     ASSERT(vec != NULL);
     ASSERT(index < vec->size);
     void *index_pos = (uint8_t *)vec->data + (index * vec->data_size);
@@ -95,13 +95,13 @@ vector_get(const vector_t *vec, size_t index, void *data_out) {
 }
 
 size_t
-vector_size(const vector_t *vec) {
+legacy_vector_size(const legacy_vector_t *vec) {
     ASSERT(vec != NULL);
     return vec->size;
 }
 
 void *
-vector_destroy(vector_t *vec) {
+legacy_vector_destroy(legacy_vector_t *vec) {
     ASSERT(vec != NULL);
     free(vec->data);
     free(vec);
@@ -0,0 +1,46 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef BENCH_VEC_LEGACY_H_
+#define BENCH_VEC_LEGACY_H_
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The untyped vector_t that vec.h's VECTOR_DEFINE replaced, kept only as
+ * gam_bench_vec's baseline. Same code, renamed, in its own translation unit
+ * like the old vec.c.
+ */
+typedef struct legacy_vector legacy_vector_t;
+
+legacy_vector_t *
+legacy_vector_create(size_t data_size, size_t init_size);
+void *
+legacy_vector_begin(const legacy_vector_t *vec);
+void *
+legacy_vector_end(const legacy_vector_t *vec);
+void
+legacy_vector_push(legacy_vector_t *vec, void *elem);
+void
+legacy_vector_get(const legacy_vector_t *vec, size_t index, void *data_out);
+void
+legacy_vector_get_ref(const legacy_vector_t *vec, size_t index, void **data_out);
+size_t
+legacy_vector_size(const legacy_vector_t *vec);
+void *
+legacy_vector_destroy(legacy_vector_t *vec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BENCH_VEC_LEGACY_H_ */
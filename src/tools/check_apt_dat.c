@@ -0,0 +1,179 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Regression runs for apt_dat_parse across file boundaries: a file that
+ * ends inside an open pavement outline (truncated, compressed or not) or
+ * can't be read at all must not leak that state into the next file's
+ * airport. Writes its inputs to a temporary directory, exits non-zero if
+ * any run doesn't match.
+ */
+
+#include <parsers/apt_dat.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utils/log.h>
+
+#ifdef GAM_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* Cut off after the second node of a pavement outline, 113 never comes */
+static const char check_open_pavement[] = "I\n"
+                                          "1100 Version\n"
+                                          "\n"
+                                          "1 100 0 0 KAAA First Airport\n"
+                                          "1302 city A\n"
+                                          "100 30.00 1 0 0.25 0 2 1 09 10.000 20.000 0 0 3 2 1 0 "
+                                          "27 10.000 20.010 0 0 3 2 1 0\n"
+                                          "110 1 0.25 0.00 Ramp\n"
+                                          "111 10.001 20.001\n"
+                                          "111 10.001 20.002\n";
+
+/* Linear feature nodes (120 isn't handled) come before the airport's first 110 */
+static const char check_next_file[] = "I\n"
+                                      "1100 Version\n"
+                                      "\n"
+                                      "1 100 0 0 KBBB Second Airport\n"
+                                      "1302 city B\n"
+                                      "100 30.00 1 0 0.25 0 2 1 18 11.000 21.000 0 0 3 2 1 0 "
+                                      "36 11.010 21.000 0 0 3 2 1 0\n"
+                                      "120 Taxi line\n"
+                                      "111 11.001 21.001 51\n"
+                                      "112 11.002 21.002 11.003 21.003 51\n"
+                                      "115 11.004 21.004\n"
+                                      "110 1 0.25 0.00 Apron\n"
+                                      "111 11.001 21.001\n"
+                                      "111 11.002 21.001\n"
+                                      "113 11.002 21.002\n"
+                                      "130 Boundary\n"
+                                      "111 11.000 21.000\n"
+                                      "111 11.010 21.000\n"
+                                      "113 11.010 21.010\n"
+                                      "99\n";
+
+static bool
+check_write(const char *path, const void *data, size_t size) {
+    FILE *fp = fopen(path, "wb");
+    bool  ok;
+
+    if (fp == NULL) {
+        log_err("Failed to create %s", path);
+        return false;
+    }
+    ok = fwrite(data, 1, size, fp) == size;
+    ok = (fclose(fp) == 0) && ok;
+
+    return ok;
+}
+
+#ifdef GAM_HAVE_ZLIB
+/* gzip stream that stops where the text does, without the final block or trailer */
+static bool
+check_write_truncated_gz(const char *path, const char *text) {
+    unsigned char out[4096];
+    z_stream      zs;
+    bool          ok;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) !=
+        Z_OK) {
+        return false;
+    }
+
+    zs.next_in = (Bytef *)text;
+    zs.avail_in = (uInt)strlen(text);
+    zs.next_out = out;
+    zs.avail_out = sizeof(out);
+    ok = deflate(&zs, Z_SYNC_FLUSH) == Z_OK && zs.avail_in == 0;
+    ok = ok && check_write(path, out, sizeof(out) - zs.avail_out);
+    deflateEnd(&zs);
+
+    return ok;
+}
+#endif
+
+/* KBBB from check_next_file must come out whole, whatever came before it */
+static bool
+check_run(const char *name, const char **files, size_t files_size) {
+    airport_db_t *db = apt_dat_parse(files, files_size);
+    bool          ok = false;
+
+    if (db == NULL) {
+        log_err("%s: nothing parsed", name);
+        return false;
+    }
+
+    const size_t idx = db->airports_size > 0 ? db->airports_size - 1 : 0;
+
+    if (db->airports_size == 0 || strcmp(db->airports[idx].icao, "KBBB") != 0) {
+        log_err("%s: KBBB missing", name);
+    } else if (vector_bounds_size(&db->airports[idx].pave_bounds) != 1 ||
+               db->airports[idx].pave_bounds.data[0].latitude.size != 3) {
+        log_err("%s: KBBB has %zu pavement outlines, expected 1 of 3 nodes", name,
+            vector_bounds_size(&db->airports[idx].pave_bounds));
+    } else if (db->airports[idx].boundaries.latitude.size != 3) {
+        log_err("%s: KBBB boundary has %zu nodes, expected 3", name,
+            db->airports[idx].boundaries.latitude.size);
+    } else {
+        log_msg("%s: ok", name);
+        ok = true;
+    }
+
+    apt_dat_db_free(db);
+    return ok;
+}
+
+int
+main() {
+    char dir[] = "/tmp/gam_check_apt_dat_XXXXXX";
+    char open_path[64], next_path[64], missing_path[64], gz_path[64];
+    bool ok = true;
+
+    if (mkdtemp(dir) == NULL) {
+        log_err("Failed to create a temporary directory");
+        return EXIT_FAILURE;
+    }
+
+    snprintf(open_path, sizeof(open_path), "%s/open.dat", dir);
+    snprintf(next_path, sizeof(next_path), "%s/next.dat", dir);
+    snprintf(missing_path, sizeof(missing_path), "%s/missing.dat", dir);
+    snprintf(gz_path, sizeof(gz_path), "%s/open.dat.gz", dir);
+
+    if (!check_write(open_path, check_open_pavement, strlen(check_open_pavement)) ||
+        !check_write(next_path, check_next_file, strlen(check_next_file))) {
+        return EXIT_FAILURE;
+    }
+
+    const char *plain[] = {open_path, next_path};
+    const char *missing[] = {open_path, missing_path, next_path};
+    ok = check_run("plain file ending in a pavement", plain, 2) && ok;
+    ok = check_run("missing file in between", missing, 3) && ok;
+#ifdef GAM_HAVE_ZLIB
+    const char *gz[] = {gz_path, next_path};
+    if (!check_write_truncated_gz(gz_path, check_open_pavement)) {
+        log_err("Failed to write %s", gz_path);
+        ok = false;
+    } else {
+        ok = check_run("truncated gzip", gz, 2) && ok;
+    }
+#else
+    log_msg("truncated gzip: skipped, built without zlib");
+#endif
+
+    unlink(open_path);
+    unlink(next_path);
+    unlink(gz_path);
+    rmdir(dir);
+
+    log_flush();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
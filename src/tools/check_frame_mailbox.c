@@ -0,0 +1,296 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Regression runs for frame_mailbox, the slot exchange behind gl_pbo: a
+ * producer faster than the consumer, a consumer faster than the producer,
+ * damage of a frame that was replaced before anyone saw it, and both sides
+ * on their own threads never holding the same slot. Exits non-zero if any
+ * run doesn't match.
+ */
+
+#define _GNU_SOURCE
+
+#include <graphics/frame_mailbox.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utils/log.h>
+
+#define CHECK_WIDTH         640
+#define CHECK_HEIGHT        480
+#define CHECK_THREAD_FRAMES 200000
+
+typedef struct check_threads {
+    frame_mailbox_t mb;
+    /* Frame number rendered into each slot */
+    unsigned        frames[FRAME_MAILBOX_SLOTS];
+    /* Which side holds a slot right now, 0 for nobody */
+    int             owner[FRAME_MAILBOX_SLOTS];
+    bool            done;
+    unsigned long   collisions;
+} check_threads_t;
+
+/* Whether some rectangle of dmg covers all of x, y, w, h */
+static bool
+check_covers(const damage_t *dmg, int x, int y, int w, int h) {
+    for (unsigned i = 0; i < dmg->size; ++i) {
+        const damage_rect_t *r = &dmg->rects[i];
+
+        if (r->x <= x && r->y <= y && r->x + r->w >= x + w && r->y + r->h >= y + h) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+check_publish_rect(frame_mailbox_t *mb, int x, int y, int w, int h) {
+    damage_t dmg;
+
+    damage_clear(&dmg);
+    damage_add(&dmg, x, y, w, h);
+    frame_mailbox_publish(mb, &dmg);
+}
+
+/* Every slot is held by exactly one of back, front and mailbox */
+static bool
+check_slots_distinct(const frame_mailbox_t *mb) {
+    const unsigned back = frame_mailbox_get_back(mb);
+    const unsigned front = frame_mailbox_get_front(mb);
+    const unsigned mailbox = mb->mailbox & 0x3u;
+
+    return back != front && back != mailbox && front != mailbox &&
+           back < FRAME_MAILBOX_SLOTS && front < FRAME_MAILBOX_SLOTS &&
+           mailbox < FRAME_MAILBOX_SLOTS;
+}
+
+static bool
+check_producer_faster(void) {
+    frame_mailbox_t mb;
+    unsigned        last;
+
+    frame_mailbox_init(&mb, CHECK_WIDTH, CHECK_HEIGHT);
+
+    /* Three frames before the consumer looks, only the newest is taken */
+    for (int i = 0; i < 3; ++i) {
+        last = frame_mailbox_get_back(&mb);
+        check_publish_rect(&mb, i * 100, 0, 10, 10);
+        if (!check_slots_distinct(&mb)) {
+            log_err("producer faster: back and front share a slot");
+            return false;
+        }
+    }
+
+    if (!frame_mailbox_pending(&mb) || frame_mailbox_take(&mb) != last) {
+        log_err("producer faster: newest frame wasn't taken");
+        return false;
+    }
+    if (frame_mailbox_pending(&mb)) {
+        log_err("producer faster: replaced frames still pending");
+        return false;
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        if (!check_covers(frame_mailbox_get_front_damage(&mb), i * 100, 0, 10, 10)) {
+            log_err("producer faster: damage of frame %d lost", i);
+            return false;
+        }
+    }
+
+    log_msg("producer faster: ok");
+    return true;
+}
+
+static bool
+check_consumer_faster(void) {
+    frame_mailbox_t mb;
+    const damage_t *dmg;
+
+    frame_mailbox_init(&mb, CHECK_WIDTH, CHECK_HEIGHT);
+
+    if (frame_mailbox_pending(&mb)) {
+        log_err("consumer faster: frame pending before any was published");
+        return false;
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        const unsigned back = frame_mailbox_get_back(&mb);
+
+        check_publish_rect(&mb, 0, i * 100, 10, 10);
+        if (!frame_mailbox_pending(&mb) || frame_mailbox_take(&mb) != back) {
+            log_err("consumer faster: frame %d wasn't taken", i);
+            return false;
+        }
+        if (frame_mailbox_pending(&mb) || !check_slots_distinct(&mb)) {
+            log_err("consumer faster: frame %d taken twice", i);
+            return false;
+        }
+
+        /* Taken frames don't carry over */
+        dmg = frame_mailbox_get_front_damage(&mb);
+        if (dmg->size != 1 || !check_covers(dmg, 0, i * 100, 10, 10) ||
+            (i > 0 && check_covers(dmg, 0, (i - 1) * 100, 10, 10))) {
+            log_err("consumer faster: frame %d has the wrong damage", i);
+            return false;
+        }
+    }
+
+    /* NULL damage is the whole frame */
+    frame_mailbox_publish(&mb, NULL);
+    frame_mailbox_take(&mb);
+    if (!check_covers(frame_mailbox_get_front_damage(&mb), 0, 0, CHECK_WIDTH, CHECK_HEIGHT)) {
+        log_err("consumer faster: full frame damage is partial");
+        return false;
+    }
+
+    log_msg("consumer faster: ok");
+    return true;
+}
+
+static bool
+check_unseen_damage(void) {
+    frame_mailbox_t mb;
+    const damage_t *dmg;
+
+    frame_mailbox_init(&mb, CHECK_WIDTH, CHECK_HEIGHT);
+
+    check_publish_rect(&mb, 0, 0, 10, 10);
+    frame_mailbox_take(&mb);
+
+    /* The second frame is replaced before anyone sees it */
+    check_publish_rect(&mb, 200, 200, 10, 10);
+    check_publish_rect(&mb, 400, 400, 10, 10);
+    frame_mailbox_take(&mb);
+
+    dmg = frame_mailbox_get_front_damage(&mb);
+    if (!check_covers(dmg, 200, 200, 10, 10) || !check_covers(dmg, 400, 400, 10, 10)) {
+        log_err("unseen frame: damage wasn't carried over");
+        return false;
+    }
+    if (check_covers(dmg, 0, 0, 10, 10)) {
+        log_err("unseen frame: damage of a taken frame was carried over");
+        return false;
+    }
+
+    /* Carried damage is gone once a frame was taken */
+    check_publish_rect(&mb, 600, 0, 10, 10);
+    frame_mailbox_take(&mb);
+    dmg = frame_mailbox_get_front_damage(&mb);
+    if (dmg->size != 1 || check_covers(dmg, 400, 400, 10, 10)) {
+        log_err("unseen frame: damage carried over twice");
+        return false;
+    }
+
+    log_msg("unseen frame: ok");
+    return true;
+}
+
+static void
+check_acquire(check_threads_t *ct, unsigned slot, int side) {
+    int expected = 0;
+
+    if (!__atomic_compare_exchange_n(
+            &ct->owner[slot], &expected, side, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        __atomic_add_fetch(&ct->collisions, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void
+check_release(check_threads_t *ct, unsigned slot) {
+    __atomic_store_n(&ct->owner[slot], 0, __ATOMIC_RELEASE);
+}
+
+static void *
+check_producer_thread(void *arg) {
+    check_threads_t *ct = (check_threads_t *)arg;
+
+    for (unsigned i = 1; i <= CHECK_THREAD_FRAMES; ++i) {
+        const unsigned slot = frame_mailbox_get_back(&ct->mb);
+
+        check_acquire(ct, slot, 1);
+        ct->frames[slot] = i;
+        check_release(ct, slot);
+        check_publish_rect(&ct->mb, (int)(i % CHECK_WIDTH), 0, 1, 1);
+
+        if (i % 64 == 0) {
+            sched_yield();
+        }
+    }
+
+    __atomic_store_n(&ct->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static bool
+check_threads(void) {
+    check_threads_t *ct = calloc(1, sizeof(*ct));
+    pthread_t        producer;
+    unsigned         last = 0, taken = 0;
+    bool             ok = true;
+
+    frame_mailbox_init(&ct->mb, CHECK_WIDTH, CHECK_HEIGHT);
+    pthread_create(&producer, NULL, check_producer_thread, (void *)ct);
+
+    for (;;) {
+        /* Read before pending, so the last frame can't slip through */
+        const bool done = __atomic_load_n(&ct->done, __ATOMIC_ACQUIRE);
+
+        if (!frame_mailbox_pending(&ct->mb)) {
+            if (done) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+
+        const unsigned slot = frame_mailbox_take(&ct->mb);
+
+        check_acquire(ct, slot, 2);
+        if (ct->frames[slot] <= last) {
+            log_err("threads: frame %u came after %u", ct->frames[slot], last);
+            ok = false;
+        }
+        last = ct->frames[slot];
+        taken += 1;
+        check_release(ct, slot);
+    }
+
+    pthread_join(producer, NULL);
+
+    if (last != CHECK_THREAD_FRAMES) {
+        log_err("threads: last frame taken was %u of %u", last, CHECK_THREAD_FRAMES);
+        ok = false;
+    }
+    if (ct->collisions != 0) {
+        log_err("threads: producer and consumer held the same slot %lu times", ct->collisions);
+        ok = false;
+    }
+    if (ok) {
+        log_msg("threads: ok, %u of %u frames taken", taken, CHECK_THREAD_FRAMES);
+    }
+
+    free(ct);
+    return ok;
+}
+
+int
+main() {
+    bool ok = true;
+
+    ok = check_producer_faster() && ok;
+    ok = check_consumer_faster() && ok;
+    ok = check_unseen_damage() && ok;
+    ok = check_threads() && ok;
+
+    log_flush();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
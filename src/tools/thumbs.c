@@ -0,0 +1,545 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+/*
+ * Renders a preview of every airport in the database with ap_thumb, on all
+ * cores, and writes them as one PNG per airport or packed into fixed-grid
+ * texture atlases. index.json maps every airport to its file and position.
+ *
+ * Workers take chunks of airports (or whole atlas pages) from a shared
+ * counter, so slow airports don't hold up a static shard. Slots only depend
+ * on the airport's index, so the output is the same for any thread count.
+ * With a render cache, airports rendered by an earlier run are mapped from
+ * it instead of drawn again.
+ */
+
+#include <errno.h>
+#include <gam/gam_defs.h>
+#include <gam/interface/ap_thumb.h>
+#include <getopt.h>
+#include <parsers/apt_dat.h>
+#include <parsers/scenery_packs.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils/log.h>
+#include <utils/utils.h>
+#include <zlib.h>
+
+#define THUMBS_DEFAULT_SIZE 256
+/* Airports a worker takes at once without atlases */
+#define THUMBS_CHUNK        32
+#define THUMBS_INDEX_FILE   "index.json"
+
+typedef struct thumbs_opts {
+    const char *out_dir;
+    int         width;
+    int         height;
+    /* Atlas side in pixels, 0 writes one file per airport */
+    int         atlas;
+    unsigned    threads;
+    size_t      limit;
+    int         level;
+    const char *cache_dir;
+    size_t      cache_budget;
+} thumbs_opts_t;
+
+typedef struct thumbs_job {
+    const thumbs_opts_t *opts;
+    const airport_db_t  *db;
+    render_cache_t      *cache;
+    size_t               airports;
+    /* Next chunk (or atlas page) to render, shared by every worker */
+    size_t               next;
+    size_t               per_page;
+    size_t               pages;
+    int                  cols;
+    bool                 failed;
+} thumbs_job_t;
+
+typedef struct thumbs_worker {
+    thumbs_job_t *job;
+    pthread_t     thread;
+    unsigned long rendered;
+    double        busy_s;
+} thumbs_worker_t;
+
+/* Straight alpha RGBA from a premultiplied ARGB32 row */
+static void
+thumbs_row_rgba(const uint32_t *src, unsigned char *dst, int width) {
+    for (int x = 0; x < width; ++x) {
+        const uint32_t px = src[x];
+        const unsigned a = px >> 24;
+        const unsigned c[3] = {(px >> 16) & 0xFF, (px >> 8) & 0xFF, px & 0xFF};
+
+        for (int i = 0; i < 3; ++i) {
+            dst[(x * 4) + i] = (unsigned char)(a ? ((c[i] * 255) + (a / 2)) / a : 0);
+        }
+        dst[(x * 4) + 3] = (unsigned char)a;
+    }
+}
+
+static void
+thumbs_png_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static bool
+thumbs_png_chunk(FILE *fp, const char *type, const unsigned char *data, size_t size) {
+    unsigned char hdr[8], crc_buf[4];
+    uLong         crc = crc32(0L, (const Bytef *)type, 4);
+
+    thumbs_png_u32(hdr, (uint32_t)size);
+    memcpy(hdr + 4, type, 4);
+    if (size > 0) {
+        crc = crc32(crc, data, (uInt)size);
+    }
+    thumbs_png_u32(crc_buf, (uint32_t)crc);
+
+    return fwrite(hdr, 1, 8, fp) == 8 && fwrite(data, 1, size, fp) == size &&
+           fwrite(crc_buf, 1, 4, fp) == 4;
+}
+
+/*
+ * Minimal RGBA8 PNG encoder, the bundled cairo is built without PNG. scratch
+ * holds the filtered rows and their deflated copy, grown as needed.
+ */
+static bool
+thumbs_png_write(const char *path, const unsigned char *argb, int stride, int width, int height,
+    int level, unsigned char **scratch, size_t *scratch_size) {
+    static const unsigned char sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    const size_t               raw_size = ((size_t)width * 4 + 1) * (size_t)height;
+    uLongf                     z_size = compressBound((uLong)raw_size);
+    unsigned char              ihdr[13];
+    FILE                      *fp;
+    bool                       ok;
+
+    if (*scratch_size < raw_size + z_size) {
+        *scratch_size = raw_size + z_size;
+        *scratch = realloc(*scratch, *scratch_size);
+    }
+
+    unsigned char *raw = *scratch;
+    unsigned char *z = *scratch + raw_size;
+
+    /* Filter type 0 on every row, the maps are mostly flat colour */
+    for (int y = 0; y < height; ++y) {
+        unsigned char *row = raw + ((size_t)y * ((size_t)width * 4 + 1));
+        row[0] = 0;
+        thumbs_row_rgba(
+            (const uint32_t *)(const void *)(argb + ((size_t)y * (size_t)stride)), row + 1, width);
+    }
+
+    if (compress2(z, &z_size, raw, (uLong)raw_size, level) != Z_OK) {
+        log_err("Failed to compress %s", path);
+        return false;
+    }
+
+    thumbs_png_u32(ihdr, (uint32_t)width);
+    thumbs_png_u32(ihdr + 4, (uint32_t)height);
+    ihdr[8] = 8; /* Bit depth */
+    ihdr[9] = 6; /* RGBA */
+    ihdr[10] = 0;
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+
+    fp = fopen(path, "wb");
+    if (fp == NULL) {
+        log_err("Failed to open %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    ok = fwrite(sig, 1, sizeof(sig), fp) == sizeof(sig);
+    ok = ok && thumbs_png_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+    ok = ok && thumbs_png_chunk(fp, "IDAT", z, z_size);
+    ok = ok && thumbs_png_chunk(fp, "IEND", NULL, 0);
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok) {
+        log_err("Failed to write %s", path);
+    }
+    return ok;
+}
+
+static void
+thumbs_airport_file(char *buf, size_t size, const thumbs_opts_t *opts, const airport_db_t *db,
+    size_t index) {
+    const char *icao = db->airports[index].icao;
+    char        ident[32];
+
+    /* Idents repeat across scenery packs, the index keeps names unique and stands in for none */
+    utils_str_sanitize(ident, sizeof(ident), icao != NULL ? icao : "");
+    if (ident[0] == '\0') {
+        snprintf(buf, size, "%s/%06zu.png", opts->out_dir, index);
+    } else {
+        snprintf(buf, size, "%s/%06zu_%s.png", opts->out_dir, index, ident);
+    }
+}
+
+static void
+thumbs_atlas_file(char *buf, size_t size, const thumbs_opts_t *opts, size_t page) {
+    snprintf(buf, size, "%s/atlas_%04zu.png", opts->out_dir, page);
+}
+
+/* Takes the next chunk, returns false once everything is handed out */
+static bool
+thumbs_take(thumbs_job_t *job, size_t total, size_t *out) {
+    *out = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+    return *out < total;
+}
+
+static void
+thumbs_fail(thumbs_job_t *job) {
+    __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+}
+
+static void
+thumbs_run_files(thumbs_worker_t *w, ap_thumb_t *th) {
+    thumbs_job_t        *job = w->job;
+    const thumbs_opts_t *opts = job->opts;
+    const size_t         chunks = (job->airports + THUMBS_CHUNK - 1) / THUMBS_CHUNK;
+    unsigned char       *scratch = NULL;
+    size_t               scratch_size = 0, chunk;
+    char                 path[4096];
+
+    while (thumbs_take(job, chunks, &chunk)) {
+        const size_t last = (chunk + 1) * THUMBS_CHUNK;
+
+        for (size_t i = chunk * THUMBS_CHUNK; i < last && i < job->airports; ++i) {
+            cairo_surface_t *s = ap_thumb_render(th, i);
+
+            thumbs_airport_file(path, sizeof(path), opts, job->db, i);
+            if (!thumbs_png_write(path, cairo_image_surface_get_data(s),
+                    cairo_image_surface_get_stride(s), opts->width, opts->height, opts->level,
+                    &scratch, &scratch_size)) {
+                thumbs_fail(job);
+            }
+            w->rendered += 1;
+        }
+    }
+
+    free(scratch);
+}
+
+static void
+thumbs_run_atlases(thumbs_worker_t *w, ap_thumb_t *th) {
+    thumbs_job_t        *job = w->job;
+    const thumbs_opts_t *opts = job->opts;
+    const size_t         row_bytes = (size_t)opts->width * 4;
+    const size_t         atlas_stride = (size_t)opts->atlas * 4;
+    /* Reused for every page this worker packs */
+    unsigned char       *atlas = malloc(atlas_stride * (size_t)opts->atlas);
+    unsigned char       *scratch = NULL;
+    size_t               scratch_size = 0, page;
+    char                 path[4096];
+
+    while (thumbs_take(job, job->pages, &page)) {
+        const size_t first = page * job->per_page;
+
+        /* Unused slots of the last page stay transparent */
+        memset(atlas, 0, atlas_stride * (size_t)opts->atlas);
+
+        for (size_t slot = 0; slot < job->per_page && first + slot < job->airports; ++slot) {
+            cairo_surface_t     *s = ap_thumb_render(th, first + slot);
+            const unsigned char *src = cairo_image_surface_get_data(s);
+            const size_t         src_stride = (size_t)cairo_image_surface_get_stride(s);
+            const size_t         x = (slot % (size_t)job->cols) * (size_t)opts->width;
+            const size_t         y = (slot / (size_t)job->cols) * (size_t)opts->height;
+
+            for (int r = 0; r < opts->height; ++r) {
+                memcpy(atlas + ((y + (size_t)r) * atlas_stride) + (x * 4),
+                    src + ((size_t)r * src_stride), row_bytes);
+            }
+            w->rendered += 1;
+        }
+
+        thumbs_atlas_file(path, sizeof(path), opts, page);
+        if (!thumbs_png_write(path, atlas, (int)atlas_stride, opts->atlas, opts->atlas,
+                opts->level, &scratch, &scratch_size)) {
+            thumbs_fail(job);
+        }
+    }
+
+    free(scratch);
+    free(atlas);
+}
+
+static void *
+thumbs_worker(void *arg) {
+    ASSERT(arg != NULL);
+    thumbs_worker_t *w = (thumbs_worker_t *)arg;
+    ap_thumb_t      *th = ap_thumb_create(w->job->db, w->job->opts->width, w->job->opts->height);
+    const long       time_start = utils_gettime();
+
+    ap_thumb_set_cache(th, w->job->cache);
+
+    if (w->job->opts->atlas > 0) {
+        thumbs_run_atlases(w, th);
+    } else {
+        thumbs_run_files(w, th);
+    }
+
+    w->busy_s = (double)(utils_gettime() - time_start) / 1e9;
+    ap_thumb_destroy(th);
+
+    pthread_exit(NULL);
+}
+
+static void
+thumbs_json_string(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (; *str != '\0'; ++str) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', fp);
+        }
+        if ((unsigned char)*str >= 0x20) {
+            fputc(*str, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static bool
+thumbs_write_index(const thumbs_job_t *job) {
+    const thumbs_opts_t *opts = job->opts;
+    char                 path[4096];
+    FILE                *fp;
+
+    snprintf(path, sizeof(path), "%s/%s", opts->out_dir, THUMBS_INDEX_FILE);
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        log_err("Failed to open %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    fprintf(fp, "{\n  \"width\": %d,\n  \"height\": %d,\n  \"atlas_size\": %d,\n", opts->width,
+        opts->height, opts->atlas);
+    fprintf(fp, "  \"airports\": [\n");
+
+    for (size_t i = 0; i < job->airports; ++i) {
+        const airport_info_t *apt = &job->db->airports[i];
+        char                  file[4096];
+        size_t                x = 0, y = 0;
+
+        if (opts->atlas > 0) {
+            const size_t slot = i % job->per_page;
+            thumbs_atlas_file(file, sizeof(file), opts, i / job->per_page);
+            x = (slot % (size_t)job->cols) * (size_t)opts->width;
+            y = (slot / (size_t)job->cols) * (size_t)opts->height;
+        } else {
+            thumbs_airport_file(file, sizeof(file), opts, job->db, i);
+        }
+
+        fprintf(fp, "    {\"index\": %zu, \"icao\": ", i);
+        thumbs_json_string(fp, apt->icao ? apt->icao : "");
+        fprintf(fp, ", \"name\": ");
+        thumbs_json_string(fp, apt->name ? apt->name : "");
+        /* Relative to the index */
+        fprintf(fp, ", \"file\": ");
+        thumbs_json_string(fp, file + strlen(opts->out_dir) + 1);
+        fprintf(fp, ", \"x\": %zu, \"y\": %zu}%s\n", x, y, i + 1 < job->airports ? "," : "");
+    }
+
+    fprintf(fp, "  ]\n}\n");
+    return fclose(fp) == 0;
+}
+
+static bool
+thumbs_parse_size(const char *str, int *width, int *height) {
+    char         *end;
+    unsigned long w = strtoul(str, &end, 10), h = w;
+
+    if (*end == 'x') {
+        h = strtoul(end + 1, &end, 10);
+    }
+    if (*end != '\0' || w == 0 || h == 0 || w > 16384 || h > 16384) {
+        return false;
+    }
+
+    *width = (int)w;
+    *height = (int)h;
+    return true;
+}
+
+static void
+thumbs_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [options] -o <dir> (-x <X-Plane root> | <apt.dat>...)\n"
+        "  -x, --xplane DIR      read the apt.dat files listed in DIR's scenery_packs.ini\n"
+        "  -o, --out DIR         output directory, created if missing\n"
+        "  -s, --size WxH        thumbnail size, or one number for squares (default %d)\n"
+        "  -a, --atlas N         pack into N x N pixel atlases instead of one PNG each\n"
+        "  -j, --threads N       worker threads (default: online CPUs)\n"
+        "  -n, --limit N         only the first N airports\n"
+        "  -z, --level N         zlib level 0-9 (default 6)\n"
+        "  -c, --cache DIR       reuse and store renders in this render cache\n"
+        "  -b, --cache-mb N      render cache size budget in MiB (default %lu)\n",
+        argv0, THUMBS_DEFAULT_SIZE, GAM_RENDER_CACHE_BUDGET / (1024 * 1024));
+}
+
+int
+main(int argc, char **argv) {
+    static const struct option long_opts[] = {{"xplane", required_argument, NULL, 'x'},
+        {"out", required_argument, NULL, 'o'}, {"size", required_argument, NULL, 's'},
+        {"atlas", required_argument, NULL, 'a'}, {"threads", required_argument, NULL, 'j'},
+        {"limit", required_argument, NULL, 'n'}, {"level", required_argument, NULL, 'z'},
+        {"cache", required_argument, NULL, 'c'}, {"cache-mb", required_argument, NULL, 'b'},
+        {NULL, 0, NULL, 0}};
+    const long                 cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    thumbs_opts_t              opts = {.out_dir = NULL,
+                     .width = THUMBS_DEFAULT_SIZE,
+                     .height = THUMBS_DEFAULT_SIZE,
+                     .atlas = 0,
+                     .threads = cpus > 0 ? (unsigned)cpus : 1,
+                     .limit = 0,
+                     .level = 6,
+                     .cache_dir = NULL,
+                     .cache_budget = GAM_RENDER_CACHE_BUDGET};
+    thumbs_job_t               job;
+    thumbs_worker_t           *workers;
+    scenery_packs_data_t      *packs = NULL;
+    const char                *xp_root = NULL;
+    const char               **files;
+    size_t                     files_size;
+    airport_db_t              *db;
+    unsigned                   started;
+    bool                       ok = true;
+    int                        c;
+
+    while ((c = getopt_long(argc, argv, "x:o:s:a:j:n:z:c:b:", long_opts, NULL)) != -1) {
+        switch (c) {
+            case 'x':
+                xp_root = optarg;
+                break;
+            case 'o':
+                opts.out_dir = optarg;
+                break;
+            case 's':
+                ok = ok && thumbs_parse_size(optarg, &opts.width, &opts.height);
+                break;
+            case 'a':
+                opts.atlas = atoi(optarg);
+                break;
+            case 'j':
+                opts.threads = (unsigned)strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                opts.limit = strtoul(optarg, NULL, 10);
+                break;
+            case 'z':
+                opts.level = atoi(optarg);
+                break;
+            case 'c':
+                opts.cache_dir = optarg;
+                break;
+            case 'b':
+                opts.cache_budget = strtoul(optarg, NULL, 10) * 1024 * 1024;
+                break;
+            default:
+                ok = false;
+                break;
+        }
+    }
+
+    if (!ok || opts.out_dir == NULL || opts.threads == 0 || opts.level < 0 || opts.level > 9 ||
+        (xp_root == NULL) == (optind == argc) ||
+        (opts.atlas != 0 && (opts.atlas < opts.width || opts.atlas < opts.height))) {
+        thumbs_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (mkdir(opts.out_dir, 0755) != 0 && errno != EEXIST) {
+        log_err("Failed to create %s: %s", opts.out_dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (xp_root != NULL) {
+        char **paths;
+
+        packs = scenery_packs_parse(xp_root);
+        if (packs == NULL) {
+            return EXIT_FAILURE;
+        }
+        files_size = scenery_packs_get_data(packs, &paths);
+        files = (const char **)paths;
+    } else {
+        files = (const char **)(argv + optind);
+        files_size = (size_t)(argc - optind);
+    }
+
+    db = apt_dat_parse(files, files_size);
+    if (db == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.opts = &opts;
+    job.db = db;
+    if (opts.cache_dir != NULL) {
+        job.cache = render_cache_create(opts.cache_dir, opts.cache_budget);
+        if (job.cache == NULL) {
+            return EXIT_FAILURE;
+        }
+    }
+    job.airports = opts.limit && opts.limit < db->airports_size ? opts.limit : db->airports_size;
+    if (opts.atlas > 0) {
+        job.cols = opts.atlas / opts.width;
+        job.per_page = (size_t)job.cols * (size_t)(opts.atlas / opts.height);
+        job.pages = (job.airports + job.per_page - 1) / job.per_page;
+    }
+
+    workers = calloc(opts.threads, sizeof(*workers));
+    const long time_start = utils_gettime();
+
+    for (started = 0; started < opts.threads; ++started) {
+        workers[started].job = &job;
+        if (pthread_create(
+                &workers[started].thread, NULL, thumbs_worker, (void *)&workers[started]) != 0) {
+            log_err("Failed to start worker %u of %u", started, opts.threads);
+            break;
+        }
+    }
+    /* Workers take chunks until none are left, so fewer of them still get everything done */
+    if (started == 0) {
+        thumbs_worker(&workers[0]);
+    }
+    for (unsigned i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    const double secs = (double)(utils_gettime() - time_start) / 1e9;
+
+    for (unsigned i = 0; i < opts.threads; ++i) {
+        log_msg("worker %2u: %6lu airports, %8.1f airports/s", i, workers[i].rendered,
+            workers[i].busy_s > 0.0 ? (double)workers[i].rendered / workers[i].busy_s : 0.0);
+    }
+    log_msg("%zu airports at %dx%d in %.2f s on %u threads: %.1f airports/s%s", job.airports,
+        opts.width, opts.height, secs, opts.threads,
+        secs > 0.0 ? (double)job.airports / secs : 0.0, opts.atlas > 0 ? " (atlases)" : "");
+
+    ok = !job.failed && thumbs_write_index(&job);
+
+    free(workers);
+    if (job.cache != NULL) {
+        render_cache_destroy(job.cache);
+    }
+    apt_dat_db_free(db);
+    if (packs != NULL) {
+        scenery_packs_free(packs);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,448 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "decomp_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#ifdef GAM_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef GAM_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define DECOMP_READER_IN_CHUNK (128 << 10)
+
+struct decomp_reader {
+    decomp_format_t format;
+    char           *path;
+    int             fd;
+    pthread_t       thread;
+
+    /* Compressed input and codec state, only touched by the thread */
+    unsigned char  *in;
+    size_t          in_size;
+    size_t          in_pos;
+    bool            in_eof;
+    /* Between gzip members or zstd frames, the input may end here */
+    bool            at_boundary;
+    bool            finished;
+#ifdef GAM_HAVE_ZLIB
+    z_stream        zs;
+#endif
+#ifdef GAM_HAVE_ZSTD
+    ZSTD_DStream   *zds;
+#endif
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    /* Chunk n is in bufs[n % DECOMP_READER_BUFFERS] */
+    char           *bufs[DECOMP_READER_BUFFERS];
+    size_t          sizes[DECOMP_READER_BUFFERS];
+    size_t          produced;
+    size_t          consumed;
+    /* The consumer still holds chunk consumed, the thread can't reuse it */
+    bool            handed_out;
+    bool            done;
+    bool            failed;
+    bool            cancel;
+};
+
+decomp_format_t
+decomp_reader_detect(const void *data, size_t size) {
+    static const unsigned char gzip_magic[] = {0x1f, 0x8b};
+    static const unsigned char zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+    if (size >= sizeof(zstd_magic) && memcmp(data, zstd_magic, sizeof(zstd_magic)) == 0) {
+        return DECOMP_FORMAT_ZSTD;
+    }
+    if (size >= sizeof(gzip_magic) && memcmp(data, gzip_magic, sizeof(gzip_magic)) == 0) {
+        return DECOMP_FORMAT_GZIP;
+    }
+
+    return DECOMP_FORMAT_NONE;
+}
+
+const char *
+decomp_reader_format_name(decomp_format_t format) {
+    switch (format) {
+        case DECOMP_FORMAT_GZIP:
+            return "gzip";
+        case DECOMP_FORMAT_ZSTD:
+            return "zstd";
+        default:
+            return "plain";
+    }
+}
+
+bool
+decomp_reader_supported(decomp_format_t format) {
+    switch (format) {
+#ifdef GAM_HAVE_ZLIB
+        case DECOMP_FORMAT_GZIP:
+            return true;
+#endif
+#ifdef GAM_HAVE_ZSTD
+        case DECOMP_FORMAT_ZSTD:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+/* Refills the compressed input once it's used up, false on a read error */
+static bool
+decomp_reader_read_input(decomp_reader_t *dr) {
+    ssize_t n;
+
+    if (dr->in_pos < dr->in_size || dr->in_eof) {
+        return true;
+    }
+
+    do {
+        n = read(dr->fd, dr->in, DECOMP_READER_IN_CHUNK);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        log_err("Failed to read %s: %s", dr->path, strerror(errno));
+        return false;
+    }
+
+    dr->in_size = (size_t)n;
+    dr->in_pos = 0;
+    dr->in_eof = (n == 0);
+
+    return true;
+}
+
+/* The input ran out, false if that was in the middle of a member or frame */
+static bool
+decomp_reader_end_input(decomp_reader_t *dr) {
+    if (!dr->at_boundary) {
+        log_err("%s is truncated", dr->path);
+        return false;
+    }
+
+    dr->finished = true;
+    return true;
+}
+
+#ifdef GAM_HAVE_ZLIB
+static bool
+decomp_reader_fill_gzip(decomp_reader_t *dr, char *out, size_t *size) {
+    z_stream *zs = &dr->zs;
+    int       ret;
+
+    zs->next_out = (Bytef *)out;
+    zs->avail_out = DECOMP_READER_CHUNK;
+
+    while (zs->avail_out > 0) {
+        if (!decomp_reader_read_input(dr)) {
+            return false;
+        }
+        if (dr->in_eof) {
+            if (!decomp_reader_end_input(dr)) {
+                return false;
+            }
+            break;
+        }
+
+        zs->next_in = dr->in + dr->in_pos;
+        zs->avail_in = (uInt)(dr->in_size - dr->in_pos);
+        ret = inflate(zs, Z_NO_FLUSH);
+        dr->in_pos = dr->in_size - zs->avail_in;
+        *size = DECOMP_READER_CHUNK - zs->avail_out;
+
+        if (ret == Z_STREAM_END) {
+            /* Concatenated members (pigz, cat a.gz b.gz) carry on after a reset */
+            inflateReset(zs);
+            dr->at_boundary = true;
+        } else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+            dr->at_boundary = false;
+        } else {
+            log_err("Failed to decompress %s: %s", dr->path,
+                zs->msg != NULL ? zs->msg : "corrupt data");
+            return false;
+        }
+    }
+
+    *size = DECOMP_READER_CHUNK - zs->avail_out;
+    return true;
+}
+#endif
+
+#ifdef GAM_HAVE_ZSTD
+static bool
+decomp_reader_fill_zstd(decomp_reader_t *dr, char *out, size_t *size) {
+    ZSTD_outBuffer ob = {.dst = out, .size = DECOMP_READER_CHUNK, .pos = 0};
+
+    while (ob.pos < ob.size) {
+        if (!decomp_reader_read_input(dr)) {
+            return false;
+        }
+
+        /* Also called at the end of the input, to flush what the stream still holds */
+        ZSTD_inBuffer ib = {.src = dr->in, .size = dr->in_size, .pos = dr->in_pos};
+        const size_t  before = ob.pos;
+        const size_t  ret = ZSTD_decompressStream(dr->zds, &ob, &ib);
+        const bool    progress = (ib.pos != dr->in_pos || ob.pos != before);
+
+        dr->in_pos = ib.pos;
+        *size = ob.pos;
+
+        if (ZSTD_isError(ret)) {
+            log_err("Failed to decompress %s: %s", dr->path, ZSTD_getErrorName(ret));
+            return false;
+        }
+
+        /*
+         * 0 once a frame is decoded and flushed. A call without progress
+         * returns the next frame's header size instead.
+         */
+        if (progress) {
+            dr->at_boundary = (ret == 0);
+        } else if (dr->in_eof) {
+            if (!decomp_reader_end_input(dr)) {
+                return false;
+            }
+            break;
+        }
+    }
+
+    *size = ob.pos;
+    return true;
+}
+#endif
+
+static bool
+decomp_reader_fill(decomp_reader_t *dr, char *out, size_t *size) {
+    switch (dr->format) {
+#ifdef GAM_HAVE_ZLIB
+        case DECOMP_FORMAT_GZIP:
+            return decomp_reader_fill_gzip(dr, out, size);
+#endif
+#ifdef GAM_HAVE_ZSTD
+        case DECOMP_FORMAT_ZSTD:
+            return decomp_reader_fill_zstd(dr, out, size);
+#endif
+        default:
+            UNUSED(out);
+            UNUSED(size);
+            return false;
+    }
+}
+
+static bool
+decomp_reader_codec_init(decomp_reader_t *dr) {
+    switch (dr->format) {
+#ifdef GAM_HAVE_ZLIB
+        case DECOMP_FORMAT_GZIP:
+            memset(&dr->zs, 0, sizeof(dr->zs));
+            /* 32: gzip or zlib header, whichever is there */
+            return inflateInit2(&dr->zs, 15 + 32) == Z_OK;
+#endif
+#ifdef GAM_HAVE_ZSTD
+        case DECOMP_FORMAT_ZSTD:
+            dr->zds = ZSTD_createDStream();
+            return dr->zds != NULL && !ZSTD_isError(ZSTD_initDStream(dr->zds));
+#endif
+        default:
+            return false;
+    }
+}
+
+static void
+decomp_reader_codec_end(decomp_reader_t *dr) {
+    switch (dr->format) {
+#ifdef GAM_HAVE_ZLIB
+        case DECOMP_FORMAT_GZIP:
+            inflateEnd(&dr->zs);
+            break;
+#endif
+#ifdef GAM_HAVE_ZSTD
+        case DECOMP_FORMAT_ZSTD:
+            ZSTD_freeDStream(dr->zds);
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+static void *
+decomp_reader_thread(void *arg) {
+    decomp_reader_t *dr = (decomp_reader_t *)arg;
+    bool             ok = true;
+
+    while (ok && !dr->finished) {
+        size_t slot, size = 0;
+        bool   cancel;
+
+        pthread_mutex_lock(&dr->mutex);
+        while (dr->produced - dr->consumed == DECOMP_READER_BUFFERS && !dr->cancel) {
+            pthread_cond_wait(&dr->cond, &dr->mutex);
+        }
+        slot = dr->produced % DECOMP_READER_BUFFERS;
+        cancel = dr->cancel;
+        pthread_mutex_unlock(&dr->mutex);
+
+        if (cancel) {
+            break;
+        }
+
+        ok = decomp_reader_fill(dr, dr->bufs[slot], &size);
+
+        /* What came before an error is still handed out */
+        if (size > 0) {
+            pthread_mutex_lock(&dr->mutex);
+            dr->sizes[slot] = size;
+            dr->produced += 1;
+            pthread_cond_signal(&dr->cond);
+            pthread_mutex_unlock(&dr->mutex);
+        }
+    }
+
+    pthread_mutex_lock(&dr->mutex);
+    dr->done = true;
+    dr->failed = !ok;
+    pthread_cond_signal(&dr->cond);
+    pthread_mutex_unlock(&dr->mutex);
+
+    return NULL;
+}
+
+static void
+decomp_reader_free(decomp_reader_t *dr) {
+    for (size_t i = 0; i < DECOMP_READER_BUFFERS; ++i) {
+        free(dr->bufs[i]);
+    }
+    free(dr->in);
+    free(dr->path);
+    free(dr);
+}
+
+decomp_reader_t *
+decomp_reader_create(const char *path, decomp_format_t format) {
+    ASSERT(path != NULL);
+    decomp_reader_t *dr;
+    int              fd;
+
+    if (!decomp_reader_supported(format)) {
+        log_err("%s is %s compressed, but gam was built without %s support", path,
+            decomp_reader_format_name(format), decomp_reader_format_name(format));
+        return NULL;
+    }
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        log_err("Failed to open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    dr = calloc(1, sizeof(*dr));
+    ASSERT(dr != NULL);
+    dr->format = format;
+    dr->path = strdup(path);
+    dr->fd = fd;
+    dr->in = malloc(DECOMP_READER_IN_CHUNK);
+    ASSERT(dr->path != NULL && dr->in != NULL);
+    for (size_t i = 0; i < DECOMP_READER_BUFFERS; ++i) {
+        dr->bufs[i] = malloc(DECOMP_READER_CHUNK);
+        ASSERT(dr->bufs[i] != NULL);
+    }
+
+    if (!decomp_reader_codec_init(dr)) {
+        log_err("Failed to set up %s decompression for %s", decomp_reader_format_name(format),
+            path);
+        decomp_reader_codec_end(dr);
+        close(fd);
+        decomp_reader_free(dr);
+        return NULL;
+    }
+
+    pthread_mutex_init(&dr->mutex, NULL);
+    pthread_cond_init(&dr->cond, NULL);
+
+    if (pthread_create(&dr->thread, NULL, decomp_reader_thread, (void *)dr) != 0) {
+        log_err("Failed to start the decompression thread for %s", path);
+        pthread_cond_destroy(&dr->cond);
+        pthread_mutex_destroy(&dr->mutex);
+        decomp_reader_codec_end(dr);
+        close(fd);
+        decomp_reader_free(dr);
+        return NULL;
+    }
+
+    return dr;
+}
+
+bool
+decomp_reader_next(decomp_reader_t *dr, char **data, size_t *size) {
+    ASSERT(dr != NULL && data != NULL && size != NULL);
+    bool have;
+
+    pthread_mutex_lock(&dr->mutex);
+
+    if (dr->handed_out) {
+        dr->consumed += 1;
+        dr->handed_out = false;
+        pthread_cond_signal(&dr->cond);
+    }
+
+    while (dr->produced == dr->consumed && !dr->done) {
+        pthread_cond_wait(&dr->cond, &dr->mutex);
+    }
+
+    have = (dr->produced != dr->consumed);
+    if (have) {
+        const size_t slot = dr->consumed % DECOMP_READER_BUFFERS;
+
+        *data = dr->bufs[slot];
+        *size = dr->sizes[slot];
+        dr->handed_out = true;
+    }
+
+    pthread_mutex_unlock(&dr->mutex);
+
+    return have;
+}
+
+bool
+decomp_reader_failed(const decomp_reader_t *dr) {
+    ASSERT(dr != NULL);
+    return dr->failed;
+}
+
+void *
+decomp_reader_destroy(decomp_reader_t *dr) {
+    ASSERT(dr != NULL);
+
+    pthread_mutex_lock(&dr->mutex);
+    dr->cancel = true;
+    pthread_cond_signal(&dr->cond);
+    pthread_mutex_unlock(&dr->mutex);
+    pthread_join(dr->thread, NULL);
+
+    pthread_cond_destroy(&dr->cond);
+    pthread_mutex_destroy(&dr->mutex);
+    decomp_reader_codec_end(dr);
+    close(dr->fd);
+    decomp_reader_free(dr);
+
+    return NULL;
+}
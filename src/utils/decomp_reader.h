@@ -0,0 +1,70 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef DECOMP_READER_H_
+#define DECOMP_READER_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Streams a gzip or zstd compressed file as plain chunks. Decompression runs
+ * on its own thread, at most DECOMP_READER_BUFFERS chunks ahead of the
+ * consumer, so the whole file is never held in memory. Each format is only
+ * available when gam was built with its library (GAM_HAVE_ZLIB,
+ * GAM_HAVE_ZSTD).
+ */
+
+#define DECOMP_READER_BUFFERS 4            /* Chunks decompressed ahead */
+#define DECOMP_READER_CHUNK   (256 << 10)  /* Plain bytes per chunk */
+
+/* Enough of the file start to detect any format */
+#define DECOMP_READER_MAGIC_SIZE 4
+
+typedef enum decomp_format {
+    DECOMP_FORMAT_NONE,
+    DECOMP_FORMAT_GZIP,
+    DECOMP_FORMAT_ZSTD
+} decomp_format_t;
+
+typedef struct decomp_reader decomp_reader_t;
+
+/* From the magic bytes, NONE for plain text or anything too short */
+decomp_format_t
+decomp_reader_detect(const void *data, size_t size);
+const char *
+decomp_reader_format_name(decomp_format_t format);
+/* Whether this build can decompress format */
+bool
+decomp_reader_supported(decomp_format_t format);
+
+/* NULL if path can't be opened or format isn't supported */
+decomp_reader_t *
+decomp_reader_create(const char *path, decomp_format_t format);
+/*
+ * Blocks until the next chunk is decompressed, false at the end of the file
+ * or on an error. The chunk is writable and valid until the next call.
+ */
+bool
+decomp_reader_next(decomp_reader_t *dr, char **data, size_t *size);
+/* Once next returned false: whether the file was corrupt, truncated or unreadable */
+bool
+decomp_reader_failed(const decomp_reader_t *dr);
+/* May be called before the end, stops the thread */
+void *
+decomp_reader_destroy(decomp_reader_t *dr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DECOMP_READER_H_ */
@@ -8,51 +8,337 @@
 
 #include "log.h"
 
-#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#define LOG_STATS_FMT "%i:%i:%i [%s:%i]: "
+#include "ts_queue.h"
 
+#define LOG_STATS_FMT       "%i:%i:%i [%s:%i]: "
+#define LOG_RECORD_MSG_LEN  224
+#define LOG_QUEUE_RECORDS   512 /* Per thread */
+#define LOG_WRITE_BATCH     32
+
+typedef struct log_record {
+    time_t      time;
+    const char *file;
+    int         line;
+    int         level;
+    char        msg[LOG_RECORD_MSG_LEN];
+} log_record_t;
+
+/* One per logging thread, only that thread pushes and only the writer pops */
+typedef struct log_queue {
+    ts_queue_t       *records;
+    /* Set once the owning thread exits, the writer frees it after draining */
+    bool              closed;
+    struct log_queue *next;
+} log_queue_t;
+
+static struct {
+    pthread_once_t  once;
+    pthread_key_t   key;
+    pthread_t       thread;
+    bool            running;
+    bool            quit;
+    /* Set by the writer, under mutex, once every queue is empty */
+    bool            asleep;
+    /* Threads between checking running and being done with their queue */
+    unsigned        pushers;
+
+    /* Prepended to by registering threads, unlinked only by the writer */
+    log_queue_t    *queues;
+
+    /* Registration, unlinking, flush handshakes and waking an idle writer */
+    pthread_mutex_t mutex;
+    pthread_cond_t  wake_cond;
+    pthread_cond_t  flush_cond;
+    unsigned long   flush_requested;
+    unsigned long   flush_done;
+
+    /* Writer only, localtime only runs when the second changes */
+    time_t          cached_sec;
+    struct tm       cached_tm;
+} log_state = {.once = PTHREAD_ONCE_INIT,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake_cond = PTHREAD_COND_INITIALIZER,
+    .flush_cond = PTHREAD_COND_INITIALIZER};
+
+static __thread log_queue_t *log_thread_queue = NULL;
+
+static void
+log_write_record(const log_record_t *rec) {
+    FILE *loc = (rec->level == LOG_LEVEL_ERROR) ? stderr : stdout;
+
+    if (rec->time != log_state.cached_sec) {
+        log_state.cached_sec = rec->time;
+        localtime_r(&rec->time, &log_state.cached_tm);
+    }
+
+    fprintf(loc, LOG_STATS_FMT "%s\n", log_state.cached_tm.tm_hour, log_state.cached_tm.tm_min,
+        log_state.cached_tm.tm_sec, rec->file, rec->line, rec->msg);
+}
+
+/* Writes everything queued so far, returns whether anything was */
+static bool
+log_drain() {
+    log_record_t recs[LOG_WRITE_BATCH];
+    bool         wrote = false;
+
+    for (log_queue_t *q = __atomic_load_n(&log_state.queues, __ATOMIC_ACQUIRE); q != NULL;) {
+        const bool closed = __atomic_load_n(&q->closed, __ATOMIC_ACQUIRE);
+        size_t     n;
+
+        while ((n = ts_queue_pop_n(q->records, recs, LOG_WRITE_BATCH)) > 0) {
+            for (size_t i = 0; i < n; ++i) {
+                log_write_record(&recs[i]);
+            }
+            wrote = true;
+        }
+
+        log_queue_t *next = q->next;
+
+        if (closed) {
+            pthread_mutex_lock(&log_state.mutex);
+            /* Threads may have registered in front of it since */
+            log_queue_t **link = &log_state.queues;
+            while (*link != q) {
+                link = &(*link)->next;
+            }
+            *link = next;
+            pthread_mutex_unlock(&log_state.mutex);
+
+            q->records = ts_queue_destroy(q->records);
+            free(q);
+        }
+
+        q = next;
+    }
+
+    if (wrote) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+
+    return wrote;
+}
+
+/* Whether any queue holds records, writer only */
+static bool
+log_pending() {
+    for (log_queue_t *q = __atomic_load_n(&log_state.queues, __ATOMIC_ACQUIRE); q != NULL;
+         q = q->next) {
+        if (ts_queue_size(q->records) > 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* The writer only sleeps with every queue empty, so this is a queue's first record */
 static void
-log_out(FILE *loc, int line, const char *file, char *fmt, va_list ap) {
-    va_list    ap2;
-    int        msg_len, info_len;
-    char      *buf = NULL;
-    time_t     rtime;
-    struct tm *timeinfo;
-
-    va_copy(ap2, ap);
-
-    time(&rtime);
-    timeinfo = localtime(&rtime);
-    info_len = snprintf(
-        NULL, 0, LOG_STATS_FMT, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec, file, line);
-    assert(info_len > 0);
-    msg_len = vsnprintf(NULL, 0, fmt, ap);
-    assert(msg_len > 0);
-    buf = malloc((sizeof(char) * (unsigned)(info_len + msg_len)) + 1);
-
-    int wbytes = snprintf(buf, (size_t)info_len + 1, LOG_STATS_FMT, timeinfo->tm_hour,
-        timeinfo->tm_min, timeinfo->tm_sec, file, line);
-    assert(wbytes > 0);
-    char *end_buf = buf + wbytes;
-    vsnprintf(end_buf, (size_t)msg_len + 1, fmt, ap2);
-
-    fprintf(loc, "%s\n", buf);
-
-    free(buf);
-    va_end(ap2);
+log_wake() {
+    pthread_mutex_lock(&log_state.mutex);
+    if (log_state.asleep) {
+        log_state.asleep = false;
+        pthread_cond_signal(&log_state.wake_cond);
+    }
+    pthread_mutex_unlock(&log_state.mutex);
+}
+
+static void *
+log_writer_thread(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&log_state.mutex);
+
+    while (!log_state.quit) {
+        const unsigned long flush_requested = log_state.flush_requested;
+
+        pthread_mutex_unlock(&log_state.mutex);
+        log_drain();
+        pthread_mutex_lock(&log_state.mutex);
+
+        log_state.flush_done = flush_requested;
+        pthread_cond_broadcast(&log_state.flush_cond);
+
+        if (log_state.flush_requested != flush_requested || log_state.quit) {
+            continue;
+        }
+
+        /*
+         * Pairs with the fence in log_out: either a record pushed since the
+         * drain is seen here, or its thread sees asleep and wakes us.
+         */
+        __atomic_store_n(&log_state.asleep, true, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (log_pending()) {
+            log_state.asleep = false;
+            continue;
+        }
+
+        while (log_state.asleep) {
+            pthread_cond_wait(&log_state.wake_cond, &log_state.mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&log_state.mutex);
+
+    log_drain();
+
+    return NULL;
+}
+
+static void
+log_thread_exit(void *arg) {
+    log_queue_t *q = (log_queue_t *)arg;
+    __atomic_store_n(&q->closed, true, __ATOMIC_RELEASE);
+}
+
+/* Runs at exit, anything logged after it is written synchronously */
+static void
+log_shutdown() {
+    pthread_mutex_lock(&log_state.mutex);
+    __atomic_store_n(&log_state.quit, true, __ATOMIC_RELEASE);
+    log_state.asleep = false;
+    pthread_cond_signal(&log_state.wake_cond);
+    pthread_mutex_unlock(&log_state.mutex);
+
+    pthread_join(log_state.thread, NULL);
+
+    /*
+     * Records pushed after the writer's last drain are written here, once
+     * every thread that saw it running is done pushing. Later ones don't
+     * queue anymore.
+     */
+    __atomic_store_n(&log_state.running, false, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&log_state.pushers, __ATOMIC_SEQ_CST) != 0) {
+        sched_yield();
+    }
+    log_drain();
+}
+
+static void
+log_start() {
+    pthread_key_create(&log_state.key, log_thread_exit);
+
+    if (pthread_create(&log_state.thread, NULL, log_writer_thread, NULL) != 0) {
+        return;
+    }
+
+    __atomic_store_n(&log_state.running, true, __ATOMIC_RELEASE);
+    atexit(log_shutdown);
+}
+
+static log_queue_t *
+log_get_queue() {
+    if (COND_UNLIKELY(log_thread_queue == NULL)) {
+        log_queue_t *q = malloc(sizeof(*q));
+
+        q->records = ts_queue_create(sizeof(log_record_t), LOG_QUEUE_RECORDS, TS_QUEUE_SPSC);
+        q->closed = false;
+
+        pthread_mutex_lock(&log_state.mutex);
+        q->next = log_state.queues;
+        __atomic_store_n(&log_state.queues, q, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&log_state.mutex);
+
+        pthread_setspecific(log_state.key, q);
+        log_thread_queue = q;
+    }
+
+    return log_thread_queue;
+}
+
+/* Before the writer starts or after it stops, and on the writer itself */
+static void
+log_out_sync(const log_record_t *rec) {
+    FILE     *loc = (rec->level == LOG_LEVEL_ERROR) ? stderr : stdout;
+    struct tm timeinfo;
+
+    localtime_r(&rec->time, &timeinfo);
+    fprintf(loc, LOG_STATS_FMT "%s\n", timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+        rec->file, rec->line, rec->msg);
+}
+
+static void
+log_out(int level, int line, const char *file, char *fmt, va_list ap) {
+    log_record_t    rec;
+    struct timespec now;
+
+    pthread_once(&log_state.once, log_start);
+
+    /* Coarse clock is a vDSO read, seconds is all that's printed */
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+    rec.time = now.tv_sec;
+    rec.file = file;
+    rec.line = line;
+    rec.level = level;
+    /* Longer messages are cut short */
+    vsnprintf(rec.msg, sizeof(rec.msg), fmt, ap);
+
+    /* Counted before running is checked, so log_shutdown waits for this push */
+    __atomic_add_fetch(&log_state.pushers, 1, __ATOMIC_SEQ_CST);
+
+    if (!__atomic_load_n(&log_state.running, __ATOMIC_SEQ_CST) ||
+        pthread_equal(pthread_self(), log_state.thread)) {
+        __atomic_sub_fetch(&log_state.pushers, 1, __ATOMIC_RELEASE);
+        log_out_sync(&rec);
+        return;
+    }
+
+    log_queue_t *q = log_get_queue();
+
+    /* Full queue, wait for the writer rather than lose the message */
+    while (ts_queue_push(q->records, &rec) != 0) {
+        /* Writer is stopping and may not drain again, out of order beats lost */
+        if (__atomic_load_n(&log_state.quit, __ATOMIC_ACQUIRE)) {
+            __atomic_sub_fetch(&log_state.pushers, 1, __ATOMIC_RELEASE);
+            log_out_sync(&rec);
+            return;
+        }
+        log_wake();
+        sched_yield();
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&log_state.asleep, __ATOMIC_RELAXED)) {
+        log_wake();
+    }
+
+    __atomic_sub_fetch(&log_state.pushers, 1, __ATOMIC_RELEASE);
+}
+
+void
+log_flush() {
+    if (!__atomic_load_n(&log_state.running, __ATOMIC_ACQUIRE) ||
+        pthread_equal(pthread_self(), log_state.thread)) {
+        fflush(stdout);
+        fflush(stderr);
+        return;
+    }
+
+    pthread_mutex_lock(&log_state.mutex);
+    const unsigned long ticket = ++log_state.flush_requested;
+    log_state.asleep = false;
+    pthread_cond_signal(&log_state.wake_cond);
+    while (log_state.flush_done < ticket && !log_state.quit) {
+        pthread_cond_wait(&log_state.flush_cond, &log_state.mutex);
+    }
+    pthread_mutex_unlock(&log_state.mutex);
 }
 
 void
 log_err_(int line, const char *file, char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    log_out(stderr, line, file, fmt, ap);
+    log_out(LOG_LEVEL_ERROR, line, file, fmt, ap);
     va_end(ap);
 }
 
@@ -60,6 +346,14 @@ void
 log_msg_(int line, const char *file, char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    log_out(stdout, line, file, fmt, ap);
+    log_out(LOG_LEVEL_INFO, line, file, fmt, ap);
+    va_end(ap);
+}
+
+void
+log_dbg_(int line, const char *file, char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_out(LOG_LEVEL_DEBUG, line, file, fmt, ap);
     va_end(ap);
-}
\ No newline at end of file
+}
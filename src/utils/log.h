@@ -18,13 +18,49 @@ extern "C" {
 
 #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
 
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_ERROR 2
+
+/* Calls below this level are compiled out */
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN LOG_LEVEL_INFO
+#endif
+
+/*
+ * Messages are formatted into a fixed-size record on the calling thread's own
+ * queue and written out by a background thread, so logging never allocates
+ * or blocks on output unless the queue is full. A lock is only taken to wake
+ * the writer when it is idle.
+ */
 void
 log_msg_(int line, const char *file, char *fmt, ...);
 void
 log_err_(int line, const char *file, char *fmt, ...);
+void
+log_dbg_(int line, const char *file, char *fmt, ...);
+/* Waits until everything logged so far is written */
+void
+log_flush();
 
-#define log_msg(...)     log_msg_(__LINE__, __FILENAME__, __VA_ARGS__)
-#define log_err(...)     log_err_(__LINE__, __FILENAME__, __VA_ARGS__)
+#define log_msg(...)                                        \
+    do {                                                    \
+        if (LOG_LEVEL_INFO >= LOG_LEVEL_MIN) {              \
+            log_msg_(__LINE__, __FILENAME__, __VA_ARGS__);  \
+        }                                                   \
+    } while (0)
+#define log_err(...)                                        \
+    do {                                                    \
+        if (LOG_LEVEL_ERROR >= LOG_LEVEL_MIN) {             \
+            log_err_(__LINE__, __FILENAME__, __VA_ARGS__);  \
+        }                                                   \
+    } while (0)
+#define log_dbg(...)                                        \
+    do {                                                    \
+        if (LOG_LEVEL_DEBUG >= LOG_LEVEL_MIN) {             \
+            log_dbg_(__LINE__, __FILENAME__, __VA_ARGS__);  \
+        }                                                   \
+    } while (0)
 
 #define UNUSED(a)        (void)(a)
 #define COND_UNLIKELY(x) __builtin_expect(x, 0)
@@ -33,6 +69,7 @@ log_err_(int line, const char *file, char *fmt, ...);
     do {                                        \
         if (COND_UNLIKELY(!(x))) {              \
             log_err("Assertion %s failed", #x); \
+            log_flush();                        \
             abort();                            \
         }                                       \
     } while (0)
@@ -0,0 +1,134 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "perf_stats.h"
+
+#include "log.h"
+
+#define PERF_STATS_RING_MASK (PERF_STATS_RING_SIZE - 1)
+
+typedef struct perf_stage_stats {
+    /* Ring of the latest samples, head counts every sample ever written */
+    long          ring[PERF_STATS_RING_SIZE];
+    unsigned long head;
+
+    unsigned long histogram[PERF_STATS_BUCKETS];
+    unsigned long count;
+} perf_stage_stats_t;
+
+static perf_stage_stats_t stats[PERF_STAGE_COUNT];
+
+static const char *const stage_names[PERF_STAGE_COUNT] = {
+    [PERF_STAGE_FRAME] = "frame",
+    [PERF_STAGE_CLEAR] = "clear",
+    [PERF_STAGE_LOOP] = "loop",
+    [PERF_STAGE_BACKGROUND] = "background",
+    [PERF_STAGE_BOUNDS] = "bounds",
+    [PERF_STAGE_PAVEMENT] = "pavement",
+    [PERF_STAGE_RUNWAYS] = "runways",
+    [PERF_STAGE_FLUSH] = "flush",
+    [PERF_STAGE_UPLOAD] = "upload",
+    [PERF_STAGE_SWAP] = "swap",
+};
+
+const char *
+perf_stats_stage_name(perf_stage_t stage) {
+    ASSERT(stage < PERF_STAGE_COUNT);
+    return stage_names[stage];
+}
+
+void
+perf_stats_record(perf_stage_t stage, long time) {
+    ASSERT(stage < PERF_STAGE_COUNT);
+    perf_stage_stats_t *st = &stats[stage];
+    unsigned long       bucket;
+
+    if (time < 0) {
+        time = 0;
+    }
+
+    /* Banded rendering records the same stage from several threads */
+    const unsigned long head = __atomic_fetch_add(&st->head, 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&st->ring[head & PERF_STATS_RING_MASK], time, __ATOMIC_RELAXED);
+
+    bucket = (unsigned long)time / PERF_STATS_BUCKET_NS;
+    if (bucket >= PERF_STATS_BUCKETS) {
+        bucket = PERF_STATS_BUCKETS - 1;
+    }
+
+    __atomic_fetch_add(&st->histogram[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->count, 1, __ATOMIC_RELAXED);
+}
+
+size_t
+perf_stats_recent(perf_stage_t stage, long *out, size_t max) {
+    ASSERT(stage < PERF_STAGE_COUNT);
+    ASSERT(out != NULL);
+    const perf_stage_stats_t *st = &stats[stage];
+    const unsigned long       head = __atomic_load_n(&st->head, __ATOMIC_ACQUIRE);
+    size_t                    n = (head < PERF_STATS_RING_SIZE) ? head : PERF_STATS_RING_SIZE;
+
+    if (n > max) {
+        n = max;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        const unsigned long idx = (head - n + i) & PERF_STATS_RING_MASK;
+        out[i] = __atomic_load_n(&st->ring[idx], __ATOMIC_RELAXED);
+    }
+
+    return n;
+}
+
+long
+perf_stats_percentile(perf_stage_t stage, double pct) {
+    ASSERT(stage < PERF_STAGE_COUNT);
+    const perf_stage_stats_t *st = &stats[stage];
+    const unsigned long       count = __atomic_load_n(&st->count, __ATOMIC_RELAXED);
+    const double              target = (count * pct) / 100.0;
+    unsigned long             seen = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    for (unsigned long i = 0; i < PERF_STATS_BUCKETS; ++i) {
+        seen += __atomic_load_n(&st->histogram[i], __ATOMIC_RELAXED);
+        if ((double)seen >= target) {
+            return (long)((i + 1) * PERF_STATS_BUCKET_NS);
+        }
+    }
+
+    return (long)PERF_STATS_BUCKETS * PERF_STATS_BUCKET_NS;
+}
+
+void
+perf_stats_write(FILE *fp) {
+    ASSERT(fp != NULL);
+
+    for (unsigned s = 0; s < PERF_STAGE_COUNT; ++s) {
+        const perf_stage_stats_t *st = &stats[s];
+
+        if (st->count == 0) {
+            continue;
+        }
+
+        fprintf(fp, "%s: %lu samples, p50 %.3lf ms, p95 %.3lf ms, p99 %.3lf ms\n",
+            stage_names[s], st->count, perf_stats_percentile(s, 50.0) / 1e6,
+            perf_stats_percentile(s, 95.0) / 1e6, perf_stats_percentile(s, 99.0) / 1e6);
+
+        for (unsigned long i = 0; i < PERF_STATS_BUCKETS; ++i) {
+            if (st->histogram[i] == 0) {
+                continue;
+            }
+
+            fprintf(fp, "    < %.3lf ms: %lu\n", ((i + 1) * PERF_STATS_BUCKET_NS) / 1e6,
+                st->histogram[i]);
+        }
+    }
+}
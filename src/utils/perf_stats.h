@@ -0,0 +1,57 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef PERF_STATS_H_
+#define PERF_STATS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Per-stage frame timings, recorded from any thread without locking */
+
+#define PERF_STATS_RING_SIZE  256   /* Samples, power of two */
+#define PERF_STATS_BUCKET_NS  25000 /* Histogram resolution */
+#define PERF_STATS_BUCKETS    4000  /* Anything slower lands in the last bucket */
+
+typedef enum perf_stage {
+    PERF_STAGE_FRAME,
+    PERF_STAGE_CLEAR,
+    PERF_STAGE_LOOP,
+    PERF_STAGE_BACKGROUND,
+    PERF_STAGE_BOUNDS,
+    PERF_STAGE_PAVEMENT,
+    PERF_STAGE_RUNWAYS,
+    PERF_STAGE_FLUSH,
+    PERF_STAGE_UPLOAD,
+    PERF_STAGE_SWAP,
+    PERF_STAGE_COUNT
+} perf_stage_t;
+
+const char *
+perf_stats_stage_name(perf_stage_t stage);
+void
+perf_stats_record(perf_stage_t stage, long time);
+/* Copies up to max of the latest samples, oldest first, returns how many */
+size_t
+perf_stats_recent(perf_stage_t stage, long *out, size_t max);
+/* Percentile (0-100) over every sample since start, rounded up to a bucket */
+long
+perf_stats_percentile(perf_stage_t stage, double pct);
+/* Percentiles and the non-empty histogram buckets of every stage */
+void
+perf_stats_write(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERF_STATS_H_ */
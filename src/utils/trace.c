@@ -0,0 +1,180 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "trace.h"
+
+#include "log.h"
+
+#ifdef GAM_TRACE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils.h"
+
+#define TRACE_BUFFER_EVENTS  65536 /* Per thread, later events are dropped */
+#define TRACE_THREAD_NAME_SZ 32
+
+typedef struct trace_event {
+    const char *name;
+    const char *detail;
+    long        time;
+    long        value;
+    char        phase;
+} trace_event_t;
+
+/* Only the owning thread appends, the exporter reads up to size */
+typedef struct trace_buffer {
+    trace_event_t        events[TRACE_BUFFER_EVENTS];
+    size_t               size;
+    unsigned long        dropped;
+    unsigned             tid;
+    char                 name[TRACE_THREAD_NAME_SZ];
+    struct trace_buffer *next;
+} trace_buffer_t;
+
+static pthread_mutex_t          trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static trace_buffer_t          *trace_buffers = NULL;
+static unsigned                 trace_next_tid = 1;
+static long                     trace_start_time = 0;
+static __thread trace_buffer_t *trace_thread_buffer = NULL;
+
+/* Buffers are kept after their thread exits, so its events can still be exported */
+static trace_buffer_t *
+trace_get_buffer() {
+    if (COND_UNLIKELY(trace_thread_buffer == NULL)) {
+        trace_buffer_t *buf = calloc(1, sizeof(*buf));
+
+        pthread_mutex_lock(&trace_mutex);
+        if (trace_start_time == 0) {
+            trace_start_time = utils_gettime();
+        }
+        buf->tid = trace_next_tid++;
+        snprintf(buf->name, sizeof(buf->name), "thread %u", buf->tid);
+        buf->next = trace_buffers;
+        trace_buffers = buf;
+        pthread_mutex_unlock(&trace_mutex);
+
+        trace_thread_buffer = buf;
+    }
+
+    return trace_thread_buffer;
+}
+
+void
+trace_event_(const char *name, char phase, long value, const char *detail) {
+    trace_buffer_t *buf = trace_get_buffer();
+    const size_t    size = buf->size;
+
+    if (COND_UNLIKELY(size == TRACE_BUFFER_EVENTS)) {
+        buf->dropped += 1;
+        return;
+    }
+
+    trace_event_t *ev = &buf->events[size];
+    ev->name = name;
+    ev->detail = detail;
+    ev->time = utils_gettime();
+    ev->value = value;
+    ev->phase = phase;
+
+    __atomic_store_n(&buf->size, size + 1, __ATOMIC_RELEASE);
+}
+
+void
+trace_thread_name_(const char *name) {
+    ASSERT(name != NULL);
+    trace_buffer_t *buf = trace_get_buffer();
+
+    pthread_mutex_lock(&trace_mutex);
+    snprintf(buf->name, sizeof(buf->name), "%s", name);
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+static void
+trace_write_string(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (const char *c = str; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', fp);
+            fputc(*c, fp);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(fp, "\\u%04x", (unsigned)*c);
+        } else {
+            fputc(*c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void
+trace_write_event(FILE *fp, const trace_buffer_t *buf, const trace_event_t *ev) {
+    fputs(",\n{\"name\":", fp);
+    trace_write_string(fp, ev->name);
+    fprintf(fp, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", ev->phase,
+        (double)(ev->time - trace_start_time) / 1000.0, buf->tid);
+
+    if (ev->phase == 'C') {
+        fputs(",\"args\":{", fp);
+        trace_write_string(fp, ev->name);
+        fprintf(fp, ":%ld}", ev->value);
+    } else if (ev->detail != NULL) {
+        fputs(",\"args\":{\"detail\":", fp);
+        trace_write_string(fp, ev->detail);
+        fputc('}', fp);
+    }
+
+    fputc('}', fp);
+}
+
+/* Events recorded while writing may or may not make it in */
+void
+trace_write_(const char *path) {
+    ASSERT(path != NULL);
+    FILE *fp;
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        log_err("Failed to open %s", path);
+        return;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"gam\"}}",
+        fp);
+
+    pthread_mutex_lock(&trace_mutex);
+
+    for (const trace_buffer_t *buf = trace_buffers; buf != NULL; buf = buf->next) {
+        const size_t size = __atomic_load_n(&buf->size, __ATOMIC_ACQUIRE);
+
+        fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{"
+                    "\"name\":",
+            buf->tid);
+        trace_write_string(fp, buf->name);
+        fputs("}}", fp);
+
+        for (size_t i = 0; i < size; ++i) {
+            trace_write_event(fp, buf, &buf->events[i]);
+        }
+
+        if (buf->dropped > 0) {
+            log_err("Trace buffer of %s full, dropped %lu events", buf->name, buf->dropped);
+        }
+    }
+
+    pthread_mutex_unlock(&trace_mutex);
+
+    fputs("\n]}\n", fp);
+    fclose(fp);
+
+    log_msg("Wrote trace to %s", path);
+}
+
+#endif /* GAM_TRACE */
@@ -0,0 +1,74 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Span and counter tracing, exported as Chrome trace event JSON (load into
+ * chrome://tracing or ui.perfetto.dev). Built only with GAM_TRACE defined,
+ * otherwise every macro compiles to nothing.
+ *
+ * Names and details are stored as pointers, they must outlive the export.
+ */
+
+#ifdef GAM_TRACE
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT_(a, b)
+
+#define TRACE_BEGIN(name)                trace_event_(name, 'B', 0, NULL)
+#define TRACE_BEGIN_DETAIL(name, detail) trace_event_(name, 'B', 0, detail)
+#define TRACE_END(name)                  trace_event_(name, 'E', 0, NULL)
+#define TRACE_COUNTER(name, value)       trace_event_(name, 'C', (long)(value), NULL)
+/* Span from here to the end of the enclosing block */
+#define TRACE_SCOPE(name)                                                         \
+    const char *TRACE_CONCAT(trace_scope_, __LINE__)                              \
+        __attribute__((cleanup(trace_scope_end_), unused)) = trace_scope_begin_(name)
+#define TRACE_THREAD_NAME(name) trace_thread_name_(name)
+#define TRACE_WRITE(path)       trace_write_(path)
+
+void
+trace_event_(const char *name, char phase, long value, const char *detail);
+void
+trace_thread_name_(const char *name);
+void
+trace_write_(const char *path);
+
+static inline const char *
+trace_scope_begin_(const char *name) {
+    trace_event_(name, 'B', 0, (const char *)0);
+    return name;
+}
+
+static inline void
+trace_scope_end_(const char **name) {
+    trace_event_(*name, 'E', 0, (const char *)0);
+}
+
+#else
+
+#define TRACE_BEGIN(name)                ((void)0)
+#define TRACE_BEGIN_DETAIL(name, detail) ((void)0)
+#define TRACE_END(name)                  ((void)0)
+#define TRACE_COUNTER(name, value)       ((void)0)
+#define TRACE_SCOPE(name)                ((void)0)
+#define TRACE_THREAD_NAME(name)          ((void)0)
+#define TRACE_WRITE(path)                ((void)0)
+
+#endif /* GAM_TRACE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H_ */
@@ -8,131 +8,228 @@
 
 #include "ts_queue.h"
 
-#include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
-#include <stdio.h>
 #include <string.h>
 
 #include "log.h"
 
 /*
- * Simple queue implementation (thread-safe provided the user uses
- * some form of synchronization across threads).
+ * head and tail run freely and are masked into the ring, so a full and an
+ * empty queue are told apart by their difference. With several producers, a
+ * slot is reserved by moving tail and published through its sequence number,
+ * which the consumer waits on before reading the slot.
  */
 
 #define VOIDP_ADD(ptr, nbytes) ((uint8_t *)(ptr) + (nbytes))
-#define TS_QUEUE_INIT_SIZE     4
+#define TS_QUEUE_CACHE_LINE    64
 
 struct ts_queue {
-    size_t size;
-    size_t capacity;
-    size_t data_size;
-    void  *data;
-    void  *front;
-    void  *back;
+    size_t          capacity;
+    size_t          mask;
+    size_t          data_size;
+    ts_queue_mode_t mode;
+    void           *data;
+    /* TS_QUEUE_MPSC only, position + 1 once the slot's element is written */
+    size_t         *seq;
+
+    /* Written by the consumer */
+    size_t          head;
+    char            pad0[TS_QUEUE_CACHE_LINE - sizeof(size_t)];
+    /* Written by the producers */
+    size_t          tail;
+    char            pad1[TS_QUEUE_CACHE_LINE - sizeof(size_t)];
 };
 
-static inline size_t
-ts_queue_voidp_diff(void *p1, void *p2) {
-    ASSERT(p1 != NULL);
-    ASSERT(p2 != NULL);
-    ASSERT(p2 >= p1);
-    size_t diff;
-    diff = (size_t)((uint8_t *)p2 - (uint8_t *)p1);
-    return diff;
+static size_t
+ts_queue_round_pow2(size_t n) {
+    size_t pow2 = 1;
+    while (pow2 < n) {
+        pow2 <<= 1;
+    }
+    return pow2;
 }
 
 ts_queue_t *
-ts_queue_create(size_t data_size, size_t min_size) {
+ts_queue_create(size_t data_size, size_t capacity, ts_queue_mode_t mode) {
     ASSERT(data_size > 0);
+    ASSERT(capacity > 0);
     ts_queue_t *q;
 
     q = calloc(1, sizeof(*q));
 
     q->data_size = data_size;
-    q->capacity = ((min_size == 0) ? TS_QUEUE_INIT_SIZE : min_size);
+    q->capacity = ts_queue_round_pow2(capacity);
+    q->mask = q->capacity - 1;
+    q->mode = mode;
     q->data = malloc(data_size * q->capacity);
-    q->front = q->back = q->data;
+    q->seq = NULL;
+
+    if (mode == TS_QUEUE_MPSC) {
+        q->seq = calloc(q->capacity, sizeof(*q->seq));
+    }
 
     return q;
 }
 
-static void
-ts_queue_realloc_data(ts_queue_t *q) {
-    ASSERT(q != NULL);
-    size_t realloc_size, elems_size;
-    void  *new_buf;
+static void *
+ts_queue_slot(ts_queue_t *q, size_t pos) {
+    return VOIDP_ADD(q->data, (pos & q->mask) * q->data_size);
+}
 
-    realloc_size = q->capacity * 2;
-    elems_size = ts_queue_voidp_diff(q->front, q->back);
-    new_buf = malloc(realloc_size * q->data_size);
-    memcpy(new_buf, q->front, elems_size);
-    free(q->data);
+/* Copies n elements into the ring starting at pos, wrapping once if needed */
+static void
+ts_queue_write(ts_queue_t *q, size_t pos, const void *elems, size_t n) {
+    const size_t first = pos & q->mask;
+    const size_t until_end = q->capacity - first;
+    const size_t n1 = (n < until_end) ? n : until_end;
+
+    memcpy(ts_queue_slot(q, pos), elems, n1 * q->data_size);
+    if (n1 < n) {
+        memcpy(q->data, VOIDP_ADD(elems, n1 * q->data_size), (n - n1) * q->data_size);
+    }
+}
 
-    q->data = new_buf;
-    q->front = new_buf;
-    q->back = VOIDP_ADD(q->front, elems_size);
-    q->capacity = realloc_size;
+static void
+ts_queue_read(ts_queue_t *q, size_t pos, void *elems, size_t n) {
+    const size_t first = pos & q->mask;
+    const size_t until_end = q->capacity - first;
+    const size_t n1 = (n < until_end) ? n : until_end;
+
+    memcpy(elems, ts_queue_slot(q, pos), n1 * q->data_size);
+    if (n1 < n) {
+        memcpy(VOIDP_ADD(elems, n1 * q->data_size), q->data, (n - n1) * q->data_size);
+    }
 }
 
-/* Retrieve an address where the next element can go */
-static void *
-ts_queue_next_elem_loc(ts_queue_t *q) {
-    void  *alloc_end;
-    size_t alloc_left_bytes;
+static size_t
+ts_queue_push_spsc(ts_queue_t *q, const void *elems, size_t n) {
+    const size_t tail = q->tail;
+    const size_t free_slots = q->capacity - (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE));
+
+    if (n > free_slots) {
+        n = free_slots;
+    }
+    if (n == 0) {
+        return 0;
+    }
 
-    alloc_end = VOIDP_ADD(q->data, q->data_size * q->capacity);
-    alloc_left_bytes = ts_queue_voidp_diff(q->back, alloc_end);
+    ts_queue_write(q, tail, elems, n);
+    __atomic_store_n(&q->tail, tail + n, __ATOMIC_RELEASE);
 
-    /* If there's less than or equal to one more elem, then reallocate*/
-    if (alloc_left_bytes <= q->data_size) {
-        ts_queue_realloc_data(q);
+    return n;
+}
+
+static size_t
+ts_queue_push_mpsc(ts_queue_t *q, const void *elems, size_t n) {
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    size_t reserved;
+
+    /* Reserve a run of slots the consumer is done with */
+    do {
+        const size_t free_slots =
+            q->capacity - (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE));
+        reserved = (n < free_slots) ? n : free_slots;
+        if (reserved == 0) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(
+        &q->tail, &tail, tail + reserved, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    ts_queue_write(q, tail, elems, reserved);
+    for (size_t i = 0; i < reserved; ++i) {
+        __atomic_store_n(&q->seq[(tail + i) & q->mask], tail + i + 1, __ATOMIC_RELEASE);
     }
 
-    return q->back;
+    return reserved;
 }
 
-void
-ts_queue_push(ts_queue_t *q, void *elem) {
+int
+ts_queue_push(ts_queue_t *q, const void *elem) {
     ASSERT(q != NULL);
     ASSERT(elem != NULL);
-
-    void *ne_loc = ts_queue_next_elem_loc(q);
-    memcpy(ne_loc, elem, q->data_size);
-    /* Advance ending pointer */
-    q->back = VOIDP_ADD(q->back, q->data_size);
-    q->size += 1;
+    return (ts_queue_push_n(q, elem, 1) == 1) ? 0 : 1;
 }
 
-void
-ts_queue_pop(ts_queue_t *q) {
+size_t
+ts_queue_push_n(ts_queue_t *q, const void *elems, size_t n) {
     ASSERT(q != NULL);
-    if (q->front == q->back) {
-        return;
+    ASSERT(elems != NULL || n == 0);
+
+    if (q->mode == TS_QUEUE_SPSC) {
+        return ts_queue_push_spsc(q, elems, n);
+    }
+
+    return ts_queue_push_mpsc(q, elems, n);
+}
+
+/* Number of elements from head on that are fully written */
+static size_t
+ts_queue_readable(ts_queue_t *q, size_t head, size_t max) {
+    if (q->mode == TS_QUEUE_SPSC) {
+        const size_t avail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) - head;
+        return (avail < max) ? avail : max;
+    }
+
+    /* Producers may finish out of order, stop at the first unpublished slot */
+    size_t n = 0;
+    while (n < max &&
+           __atomic_load_n(&q->seq[(head + n) & q->mask], __ATOMIC_ACQUIRE) == head + n + 1) {
+        n += 1;
     }
-    ASSERT(q->size != 0);
 
-    /* Advance starting pointer */
-    q->front = VOIDP_ADD(q->front, q->data_size);
-    q->size -= 1;
+    return n;
 }
 
 int
 ts_queue_front(ts_queue_t *q, void *elem) {
     ASSERT(q != NULL);
     ASSERT(elem != NULL);
-    if (q->front == q->back) {
+    const size_t head = q->head;
+
+    if (ts_queue_readable(q, head, 1) == 0) {
         return 1;
     }
 
-    memcpy(elem, q->front, q->data_size);
+    memcpy(elem, ts_queue_slot(q, head), q->data_size);
     return 0;
 }
 
+void
+ts_queue_pop(ts_queue_t *q) {
+    ASSERT(q != NULL);
+    const size_t head = q->head;
+
+    if (ts_queue_readable(q, head, 1) == 0) {
+        return;
+    }
+
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+}
+
+size_t
+ts_queue_pop_n(ts_queue_t *q, void *elems, size_t max) {
+    ASSERT(q != NULL);
+    ASSERT(elems != NULL || max == 0);
+    const size_t head = q->head;
+    const size_t n = ts_queue_readable(q, head, max);
+
+    if (n == 0) {
+        return 0;
+    }
+
+    ts_queue_read(q, head, elems, n);
+    /* Hands the slots back to the producers */
+    __atomic_store_n(&q->head, head + n, __ATOMIC_RELEASE);
+
+    return n;
+}
+
 size_t
 ts_queue_size(ts_queue_t *q) {
     ASSERT(q != NULL);
-    return q->size;
+    return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
 }
 
 size_t
@@ -144,6 +241,7 @@ ts_queue_capacity(ts_queue_t *q) {
 void *
 ts_queue_destroy(ts_queue_t *q) {
     ASSERT(q != NULL);
+    free(q->seq);
     free(q->data);
     free(q);
     return NULL;
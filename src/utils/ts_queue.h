@@ -15,16 +15,38 @@
 extern "C" {
 #endif
 
+/*
+ * Fixed capacity lock-free ring buffer. There is always a single consumer at a
+ * time, and either a single producer (TS_QUEUE_SPSC) or any number of them
+ * (TS_QUEUE_MPSC).
+ */
+
+typedef enum ts_queue_mode {
+    TS_QUEUE_SPSC,
+    TS_QUEUE_MPSC
+} ts_queue_mode_t;
+
 typedef struct ts_queue ts_queue_t;
 
+/* capacity is rounded up to a power of two */
 ts_queue_t *
-ts_queue_create(size_t data_size, size_t min_size);
-void
-ts_queue_push(ts_queue_t *q, void *elem);
-void
-ts_queue_pop(ts_queue_t *q);
+ts_queue_create(size_t data_size, size_t capacity, ts_queue_mode_t mode);
+/* Returns 1 if the queue is full */
+int
+ts_queue_push(ts_queue_t *q, const void *elem);
+/* Pushes as many of elems as fit, in order, returns how many did */
+size_t
+ts_queue_push_n(ts_queue_t *q, const void *elems, size_t n);
+/* Consumer only, returns 1 if the queue is empty */
 int
 ts_queue_front(ts_queue_t *q, void *elem);
+/* Consumer only */
+void
+ts_queue_pop(ts_queue_t *q);
+/* Consumer only, pops up to max elements into elems, returns how many */
+size_t
+ts_queue_pop_n(ts_queue_t *q, void *elems, size_t max);
+/* Only exact while no other thread uses the queue */
 size_t
 ts_queue_size(ts_queue_t *q);
 size_t
@@ -36,4 +58,4 @@ ts_queue_destroy(ts_queue_t *q);
 }
 #endif
 
-#endif /* TS_QUEUE_H_ */
\ No newline at end of file
+#endif /* TS_QUEUE_H_ */
@@ -0,0 +1,506 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "uring_reader.h"
+
+#include "log.h"
+
+#ifdef GAM_HAVE_IO_URING
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Each slot has at most one operation in flight */
+#define URING_READER_ENTRIES URING_READER_DEPTH
+
+typedef enum uring_slot_state {
+    URING_SLOT_IDLE,
+    URING_SLOT_OPENING,
+    URING_SLOT_READING,
+    URING_SLOT_READY
+} uring_slot_state_t;
+
+/* File f is read through slot f % URING_READER_DEPTH */
+typedef struct uring_slot {
+    uring_slot_state_t state;
+    int                fd;
+    char              *buf;
+    /* From fstat once opened, the file ends there or at an empty read */
+    uint64_t           size;
+    /* Of buf in the file, len bytes of it are read so far */
+    uint64_t           offset;
+    size_t             len;
+    bool               last;
+    int                error;
+} uring_slot_t;
+
+struct uring_reader {
+    const char **paths;
+    size_t       paths_size;
+    /* File being consumed, and the next one to open */
+    size_t       head;
+    size_t       next_open;
+    /* head's chunk was handed out, its slot moves on with the next call */
+    bool         handed_out;
+    /* No new operations, only waiting for the outstanding ones */
+    bool         draining;
+
+    int          ring_fd;
+    unsigned     sq_pending;
+
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    struct io_uring_sqe *sqes;
+
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void        *sq_map;
+    size_t       sq_map_size;
+    void        *cq_map;
+    size_t       cq_map_size;
+    size_t       sqes_size;
+
+    uring_slot_t slots[URING_READER_DEPTH];
+};
+
+static int
+uring_reader_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+uring_reader_enter(const uring_reader_t *ur, unsigned to_submit, unsigned min_complete) {
+    const unsigned flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+    return (int)syscall(__NR_io_uring_enter, ur->ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Kernels before 5.6 have io_uring but not the open and read operations */
+static bool
+uring_reader_supported(int ring_fd) {
+    const size_t           size = sizeof(struct io_uring_probe) +
+                        (IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+    struct io_uring_probe *probe = calloc(1, size);
+    bool                   ok;
+
+    ok = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) ==
+             0 &&
+         probe->last_op >= IORING_OP_READ &&
+         (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+         (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+
+    free(probe);
+    return ok;
+}
+
+static bool
+uring_reader_map(uring_reader_t *ur, const struct io_uring_params *p) {
+    const bool single = (p->features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+    ur->sq_map_size = p->sq_off.array + (p->sq_entries * sizeof(unsigned));
+    ur->cq_map_size = p->cq_off.cqes + (p->cq_entries * sizeof(struct io_uring_cqe));
+    if (single && ur->cq_map_size > ur->sq_map_size) {
+        ur->sq_map_size = ur->cq_map_size;
+    }
+    ur->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+
+    ur->sq_map = mmap(NULL, ur->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ur->ring_fd, IORING_OFF_SQ_RING);
+    if (ur->sq_map == MAP_FAILED) {
+        return false;
+    }
+
+    ur->cq_map = ur->sq_map;
+    if (!single) {
+        ur->cq_map = mmap(NULL, ur->cq_map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ur->ring_fd, IORING_OFF_CQ_RING);
+        if (ur->cq_map == MAP_FAILED) {
+            munmap(ur->sq_map, ur->sq_map_size);
+            return false;
+        }
+    }
+
+    ur->sqes = mmap(NULL, ur->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ur->ring_fd, IORING_OFF_SQES);
+    if (ur->sqes == MAP_FAILED) {
+        if (ur->cq_map != ur->sq_map) {
+            munmap(ur->cq_map, ur->cq_map_size);
+        }
+        munmap(ur->sq_map, ur->sq_map_size);
+        return false;
+    }
+
+    ur->sq_tail = (unsigned *)(void *)((char *)ur->sq_map + p->sq_off.tail);
+    ur->sq_mask = (unsigned *)(void *)((char *)ur->sq_map + p->sq_off.ring_mask);
+    ur->sq_array = (unsigned *)(void *)((char *)ur->sq_map + p->sq_off.array);
+    ur->cq_head = (unsigned *)(void *)((char *)ur->cq_map + p->cq_off.head);
+    ur->cq_tail = (unsigned *)(void *)((char *)ur->cq_map + p->cq_off.tail);
+    ur->cq_mask = (unsigned *)(void *)((char *)ur->cq_map + p->cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe *)(void *)((char *)ur->cq_map + p->cq_off.cqes);
+
+    return true;
+}
+
+uring_reader_t *
+uring_reader_create(const char **paths, size_t paths_size) {
+    ASSERT(paths != NULL || paths_size == 0);
+    struct io_uring_params params;
+    uring_reader_t        *ur;
+    int                    ring_fd;
+
+    memset(&params, 0, sizeof(params));
+    ring_fd = uring_reader_setup(URING_READER_ENTRIES, &params);
+    if (ring_fd < 0) {
+        return NULL;
+    }
+
+    ur = calloc(1, sizeof(*ur));
+    ur->ring_fd = ring_fd;
+
+    if (!uring_reader_supported(ring_fd) || !uring_reader_map(ur, &params)) {
+        close(ring_fd);
+        free(ur);
+        return NULL;
+    }
+
+    ur->paths = paths;
+    ur->paths_size = paths_size;
+    for (size_t i = 0; i < URING_READER_DEPTH; ++i) {
+        ur->slots[i].state = URING_SLOT_IDLE;
+        ur->slots[i].fd = -1;
+    }
+
+    return ur;
+}
+
+static uring_slot_t *
+uring_reader_slot(uring_reader_t *ur, size_t file) {
+    return &ur->slots[file % URING_READER_DEPTH];
+}
+
+/* Only this thread produces, so the entry at the tail is ours until pushed */
+static struct io_uring_sqe *
+uring_reader_get_sqe(uring_reader_t *ur, uring_slot_t *slot) {
+    const unsigned       index = *ur->sq_tail & *ur->sq_mask;
+    struct io_uring_sqe *sqe = &ur->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t)(slot - ur->slots);
+    ur->sq_array[index] = index;
+
+    return sqe;
+}
+
+static void
+uring_reader_push_sqe(uring_reader_t *ur) {
+    __atomic_store_n(ur->sq_tail, *ur->sq_tail + 1, __ATOMIC_RELEASE);
+    ur->sq_pending += 1;
+}
+
+static void
+uring_reader_submit_open(uring_reader_t *ur, uring_slot_t *slot, const char *path) {
+    struct io_uring_sqe *sqe = uring_reader_get_sqe(ur, slot);
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    uring_reader_push_sqe(ur);
+    slot->state = URING_SLOT_OPENING;
+}
+
+static void
+uring_reader_submit_read(uring_reader_t *ur, uring_slot_t *slot) {
+    struct io_uring_sqe *sqe = uring_reader_get_sqe(ur, slot);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(slot->buf + slot->len);
+    sqe->len = (unsigned)(URING_READER_CHUNK - slot->len);
+    sqe->off = slot->offset + slot->len;
+    uring_reader_push_sqe(ur);
+    slot->state = URING_SLOT_READING;
+}
+
+static void
+uring_reader_fail(uring_slot_t *slot, int error) {
+    slot->error = error;
+    slot->len = 0;
+    slot->last = true;
+    slot->state = URING_SLOT_READY;
+}
+
+static void
+uring_reader_ready(uring_slot_t *slot, bool last) {
+    slot->last = last;
+    slot->state = URING_SLOT_READY;
+}
+
+static void
+uring_reader_complete(uring_reader_t *ur, uring_slot_t *slot, int res) {
+    struct stat st;
+
+    if (ur->draining) {
+        if (slot->state == URING_SLOT_OPENING && res >= 0) {
+            slot->fd = res;
+        }
+        slot->state = URING_SLOT_IDLE;
+        return;
+    }
+
+    switch (slot->state) {
+        case URING_SLOT_OPENING:
+            if (res < 0) {
+                uring_reader_fail(slot, -res);
+                break;
+            }
+            slot->fd = res;
+            if (fstat(slot->fd, &st) != 0) {
+                uring_reader_fail(slot, errno);
+                break;
+            }
+            slot->size = (uint64_t)st.st_size;
+            if (slot->size == 0) {
+                uring_reader_ready(slot, true);
+                break;
+            }
+            uring_reader_submit_read(ur, slot);
+            break;
+        case URING_SLOT_READING:
+            if (res == -EAGAIN || res == -EINTR) {
+                uring_reader_submit_read(ur, slot);
+            } else if (res < 0) {
+                uring_reader_fail(slot, -res);
+            } else if (res == 0) {
+                /* Shrunk since the fstat */
+                uring_reader_ready(slot, true);
+            } else {
+                /* Buffered reads can come up short before the end, the rest is read on */
+                slot->len += (size_t)res;
+                if (slot->offset + slot->len >= slot->size) {
+                    uring_reader_ready(slot, true);
+                } else if (slot->len == URING_READER_CHUNK) {
+                    uring_reader_ready(slot, false);
+                } else {
+                    uring_reader_submit_read(ur, slot);
+                }
+            }
+            break;
+        case URING_SLOT_IDLE:
+        case URING_SLOT_READY:
+            ASSERT(false);
+            break;
+    }
+}
+
+static void
+uring_reader_reap(uring_reader_t *ur) {
+    unsigned       head = *ur->cq_head;
+    const unsigned tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+        uring_reader_complete(ur, &ur->slots[cqe->user_data], cqe->res);
+    }
+
+    __atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Submits whatever is queued and, with wait, blocks for at least one completion */
+static int
+uring_reader_flush(uring_reader_t *ur, bool wait) {
+    if (!wait && ur->sq_pending == 0) {
+        return 0;
+    }
+
+    for (;;) {
+        const int ret = uring_reader_enter(ur, ur->sq_pending, wait ? 1 : 0);
+
+        if (ret >= 0) {
+            ur->sq_pending -= (unsigned)ret;
+            return 0;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return errno;
+        }
+        /* Out of resources, completions have to be reaped first */
+        uring_reader_reap(ur);
+    }
+}
+
+/* Keeps the next URING_READER_DEPTH files opening or reading */
+static void
+uring_reader_fill(uring_reader_t *ur) {
+    while (ur->next_open < ur->paths_size && ur->next_open - ur->head < URING_READER_DEPTH) {
+        uring_slot_t *slot = uring_reader_slot(ur, ur->next_open);
+
+        if (slot->buf == NULL) {
+            slot->buf = malloc(URING_READER_CHUNK);
+        }
+        slot->fd = -1;
+        slot->size = 0;
+        slot->offset = 0;
+        slot->len = 0;
+        slot->last = false;
+        slot->error = 0;
+        uring_reader_submit_open(ur, slot, ur->paths[ur->next_open]);
+        ur->next_open += 1;
+    }
+}
+
+/* The consumer is done with head's chunk, read on or move to the next file */
+static void
+uring_reader_advance(uring_reader_t *ur) {
+    uring_slot_t *slot = uring_reader_slot(ur, ur->head);
+
+    if (!slot->last) {
+        slot->offset += slot->len;
+        slot->len = 0;
+        uring_reader_submit_read(ur, slot);
+        return;
+    }
+
+    if (slot->fd >= 0) {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    slot->state = URING_SLOT_IDLE;
+    ur->head += 1;
+}
+
+bool
+uring_reader_next(uring_reader_t *ur, uring_chunk_t *chunk) {
+    ASSERT(ur != NULL && chunk != NULL);
+    uring_slot_t *slot;
+    int           error;
+
+    if (ur->handed_out) {
+        uring_reader_advance(ur);
+        ur->handed_out = false;
+    }
+
+    if (ur->head == ur->paths_size) {
+        return false;
+    }
+
+    uring_reader_fill(ur);
+    slot = uring_reader_slot(ur, ur->head);
+
+    /* Also gets the queued operations going before the chunk is parsed */
+    error = uring_reader_flush(ur, false);
+    uring_reader_reap(ur);
+
+    while (error == 0 && slot->state != URING_SLOT_READY) {
+        error = uring_reader_flush(ur, true);
+        uring_reader_reap(ur);
+    }
+
+    if (error != 0) {
+        log_err("io_uring_enter: %s", strerror(error));
+        uring_reader_fail(slot, error);
+    }
+
+    chunk->file = ur->head;
+    chunk->data = slot->buf;
+    chunk->size = slot->len;
+    chunk->first = (slot->offset == 0);
+    chunk->last = slot->last;
+    chunk->error = slot->error;
+    ur->handed_out = true;
+
+    return true;
+}
+
+void
+uring_reader_skip(uring_reader_t *ur) {
+    ASSERT(ur != NULL);
+
+    /* Nothing is in flight for a chunk that was handed out */
+    if (ur->handed_out) {
+        uring_reader_slot(ur, ur->head)->last = true;
+    }
+}
+
+static bool
+uring_reader_busy(const uring_reader_t *ur) {
+    for (size_t i = 0; i < URING_READER_DEPTH; ++i) {
+        if (ur->slots[i].state == URING_SLOT_OPENING || ur->slots[i].state == URING_SLOT_READING) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void *
+uring_reader_destroy(uring_reader_t *ur) {
+    ASSERT(ur != NULL);
+
+    /* Stopped early, the kernel may still write into the buffers */
+    ur->draining = true;
+    while (uring_reader_busy(ur) && uring_reader_flush(ur, true) == 0) {
+        uring_reader_reap(ur);
+    }
+
+    for (size_t i = 0; i < URING_READER_DEPTH; ++i) {
+        if (ur->slots[i].fd >= 0) {
+            close(ur->slots[i].fd);
+        }
+        free(ur->slots[i].buf);
+    }
+
+    munmap(ur->sqes, ur->sqes_size);
+    if (ur->cq_map != ur->sq_map) {
+        munmap(ur->cq_map, ur->cq_map_size);
+    }
+    munmap(ur->sq_map, ur->sq_map_size);
+    close(ur->ring_fd);
+    free(ur);
+
+    return NULL;
+}
+
+#else
+
+uring_reader_t *
+uring_reader_create(const char **paths, size_t paths_size) {
+    UNUSED(paths);
+    UNUSED(paths_size);
+    return NULL;
+}
+
+bool
+uring_reader_next(uring_reader_t *ur, uring_chunk_t *chunk) {
+    UNUSED(ur);
+    UNUSED(chunk);
+    ASSERT(false);
+    return false;
+}
+
+void
+uring_reader_skip(uring_reader_t *ur) {
+    UNUSED(ur);
+    ASSERT(false);
+}
+
+void *
+uring_reader_destroy(uring_reader_t *ur) {
+    UNUSED(ur);
+    return NULL;
+}
+
+#endif /* GAM_HAVE_IO_URING */
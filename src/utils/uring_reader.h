@@ -0,0 +1,61 @@
+/**
+ * Copyright 2022 Bennett Anderson
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef URING_READER_H_
+#define URING_READER_H_
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reads a list of files through io_uring, with the opens and reads of the
+ * next URING_READER_DEPTH files in flight while the current one is
+ * consumed. Chunks are still handed out in file order. Linux only, create
+ * returns NULL wherever io_uring can't be used (other platforms, old
+ * kernels, seccomp); read synchronously then.
+ */
+
+#define URING_READER_DEPTH 32          /* Files in flight */
+#define URING_READER_CHUNK (1 << 20)   /* Bytes per read */
+
+typedef struct uring_reader uring_reader_t;
+
+typedef struct uring_chunk {
+    /* Index into the paths */
+    size_t file;
+    /* Writable, valid until the next call */
+    char  *data;
+    size_t size;
+    bool   first;
+    /* Also set along with error */
+    bool   last;
+    /* errno of a failed open or read, there is no data then */
+    int    error;
+} uring_chunk_t;
+
+uring_reader_t *
+uring_reader_create(const char **paths, size_t paths_size);
+/* Blocks until the next chunk is read, false once every file is done */
+bool
+uring_reader_next(uring_reader_t *ur, uring_chunk_t *chunk);
+/* The rest of the file of the last chunk isn't read, next moves on to the following one */
+void
+uring_reader_skip(uring_reader_t *ur);
+/* Waits for whatever is still in flight */
+void *
+uring_reader_destroy(uring_reader_t *ur);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* URING_READER_H_ */
@@ -9,6 +9,7 @@
 #include "utils.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,6 +44,18 @@ utils_strdup(const char *str) {
     return str_copy;
 }
 
+void
+utils_str_sanitize(char *buf, size_t size, const char *str) {
+    ASSERT(buf != NULL && size > 0);
+    ASSERT(str != NULL);
+    size_t i;
+
+    for (i = 0; str[i] != '\0' && i + 1 < size; ++i) {
+        buf[i] = isalnum((unsigned char)str[i]) ? str[i] : '_';
+    }
+    buf[i] = '\0';
+}
+
 char *
 utils_str_split_at(const char *data, unsigned index) {
     size_t   len = strlen(data);
@@ -109,4 +122,17 @@ utils_gettime_seconds() {
     struct timespec tp;
     VRET0(clock_gettime(CLOCK_MONOTONIC, &tp));
     return tp.tv_sec;
-}
\ No newline at end of file
+}
+
+void
+utils_sleep_until(long deadline) {
+    struct timespec tp;
+    int             ret;
+
+    tp.tv_sec = deadline / 1000000000L;
+    tp.tv_nsec = deadline % 1000000000L;
+
+    do {
+        ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tp, NULL);
+    } while (ret == EINTR);
+}
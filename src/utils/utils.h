@@ -9,6 +9,8 @@
 #ifndef UTILS_H_
 #define UTILS_H_
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -19,6 +21,10 @@ utils_strip_newline(char *str);
 char *
 utils_strdup(const char *str);
 
+/* Copies str for a file name, anything but ASCII alphanumerics becomes '_'. Cut to fit size */
+void
+utils_str_sanitize(char *buf, size_t size, const char *str);
+
 /* These operate on spaces: " " */
 char *
 utils_str_split_at(const char *data, unsigned index);
@@ -29,6 +35,9 @@ long
 utils_gettime();
 long
 utils_gettime_seconds();
+/* Absolute deadline on the utils_gettime clock, in nanoseconds */
+void
+utils_sleep_until(long deadline);
 
 #ifdef __cplusplus
 }
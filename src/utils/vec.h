@@ -10,32 +10,133 @@
 #define VEC_H_
 
 #include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-typedef struct vector vector_t;
-
-vector_t *
-vector_create(size_t data_size, size_t init_size);
-void *
-vector_begin(const vector_t *vec);
-void *
-vector_end(const vector_t *vec);
-void
-vector_push(vector_t *vec, void *elem);
-void
-vector_get(const vector_t *vec, size_t index, void *data_out);
-void
-vector_get_ref(const vector_t *vec, size_t index, void **data_out);
-size_t
-vector_size(const vector_t *vec);
-void *
-vector_destroy(vector_t *vec);
+#define VECTOR_INIT_CAPACITY 4
+
+/*
+ * Declares name_t, a growable array of type, along with its inline
+ * functions. The struct is meant to be embedded by value; data holds size
+ * elements and may be NULL while capacity is 0.
+ */
+#define VECTOR_DEFINE(name, type)                                                              \
+    typedef struct name {                                                                      \
+        type  *data;                                                                           \
+        size_t size;                                                                           \
+        size_t capacity;                                                                       \
+    } name##_t;                                                                                \
+                                                                                               \
+    /* Grows capacity to at least the given one */                                             \
+    static inline void name##_reserve(name##_t *vec, size_t capacity) {                        \
+        ASSERT(vec != NULL);                                                                   \
+        if (capacity <= vec->capacity) {                                                       \
+            return;                                                                            \
+        }                                                                                      \
+        vec->data = realloc(vec->data, capacity * sizeof(type));                               \
+        vec->capacity = capacity;                                                              \
+    }                                                                                          \
+                                                                                               \
+    static inline void name##_init(name##_t *vec, size_t capacity) {                           \
+        ASSERT(vec != NULL);                                                                   \
+        vec->data = NULL;                                                                      \
+        vec->size = 0;                                                                         \
+        vec->capacity = 0;                                                                     \
+        name##_reserve(vec, capacity);                                                         \
+    }                                                                                          \
+                                                                                               \
+    /* Room for n more elements, doubling so pushes stay amortized O(1) */                     \
+    static inline void name##_grow(name##_t *vec, size_t n) {                                  \
+        size_t capacity = (vec->capacity == 0) ? VECTOR_INIT_CAPACITY : vec->capacity;         \
+        if (vec->size + n <= vec->capacity) {                                                  \
+            return;                                                                            \
+        }                                                                                      \
+        while (capacity < vec->size + n) {                                                     \
+            capacity *= 2;                                                                     \
+        }                                                                                      \
+        name##_reserve(vec, capacity);                                                         \
+    }                                                                                          \
+                                                                                               \
+    static inline void name##_push(name##_t *vec, type elem) {                                 \
+        ASSERT(vec != NULL);                                                                   \
+        if (COND_UNLIKELY(vec->size == vec->capacity)) {                                       \
+            name##_grow(vec, 1);                                                               \
+        }                                                                                      \
+        vec->data[vec->size] = elem;                                                           \
+        vec->size += 1;                                                                        \
+    }                                                                                          \
+                                                                                               \
+    static inline void name##_push_n(name##_t *vec, const type *elems, size_t n) {             \
+        ASSERT(vec != NULL);                                                                   \
+        ASSERT(elems != NULL || n == 0);                                                       \
+        name##_grow(vec, n);                                                                   \
+        if (n > 0) {                                                                           \
+            memcpy(vec->data + vec->size, elems, n * sizeof(type));                            \
+        }                                                                                      \
+        vec->size += n;                                                                        \
+    }                                                                                          \
+                                                                                               \
+    static inline type name##_get(const name##_t *vec, size_t index) {                         \
+        ASSERT(index < vec->size);                                                             \
+        return vec->data[index];                                                               \
+    }                                                                                          \
+                                                                                               \
+    static inline type *name##_ref(const name##_t *vec, size_t index) {                        \
+        ASSERT(index < vec->size);                                                             \
+        return &vec->data[index];                                                              \
+    }                                                                                          \
+                                                                                               \
+    static inline type *name##_back(const name##_t *vec) {                                     \
+        ASSERT(vec->size > 0);                                                                 \
+        return &vec->data[vec->size - 1];                                                      \
+    }                                                                                          \
+                                                                                               \
+    /* Raw elements for tight loops, valid until the next push */                              \
+    static inline type *name##_span(const name##_t *vec, size_t *size) {                       \
+        *size = vec->size;                                                                     \
+        return vec->data;                                                                      \
+    }                                                                                          \
+                                                                                               \
+    static inline size_t name##_size(const name##_t *vec) {                                    \
+        return vec->size;                                                                      \
+    }                                                                                          \
+                                                                                               \
+    static inline void name##_clear(name##_t *vec) {                                           \
+        vec->size = 0;                                                                         \
+    }                                                                                          \
+                                                                                               \
+    /* Gives back spare capacity, for vectors that are done growing */                         \
+    static inline void name##_shrink_to_fit(name##_t *vec) {                                   \
+        ASSERT(vec != NULL);                                                                   \
+        if (vec->size == vec->capacity) {                                                      \
+            return;                                                                            \
+        }                                                                                      \
+        if (vec->size == 0) {                                                                  \
+            free(vec->data);                                                                   \
+            vec->data = NULL;                                                                  \
+        } else {                                                                               \
+            vec->data = realloc(vec->data, vec->size * sizeof(type));                          \
+        }                                                                                      \
+        vec->capacity = vec->size;                                                             \
+    }                                                                                          \
+                                                                                               \
+    static inline void name##_free(name##_t *vec) {                                            \
+        ASSERT(vec != NULL);                                                                   \
+        free(vec->data);                                                                       \
+        vec->data = NULL;                                                                      \
+        vec->size = 0;                                                                         \
+        vec->capacity = 0;                                                                     \
+    }
+
+VECTOR_DEFINE(vector_double, double)
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif /* VEC_H_ */
\ No newline at end of file
+#endif /* VEC_H_ */